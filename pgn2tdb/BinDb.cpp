@@ -18,7 +18,10 @@
 #include "CompactGame.h"
 #include "PackedGameBinDb.h"
 #include "ListableGameBinDb.h"
+#include "PieceSquareMask.h"
 #include "BinDb.h"
+#include "PositionIndex.h"
+#include "PgnPipeline.h"
 
 /*
 
@@ -64,6 +67,9 @@ The following are not needed for A) only for B) and C)
     Now only called by BinDbRemoveDuplicatesAndWrite()
 9) void BinDbCreationEnd()
     clears internal games vector
+10) void BinDbSetMemoryCap( uint32_t cap_mb, const std::string &temp_base )
+    Optional, before 5). If the games array grows beyond cap_mb megabytes, games are spilled to
+    temporary files as sorted runs and 7) becomes a k-way merge of the runs instead
 */
 
 static uint32_t game_id_bottom = 1; // reserve 0 as a special value
@@ -274,7 +280,9 @@ void BinDbClose()
     }
 }
 
-void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_pgn_file )
+// nbr_threads is the number of threads parsing the .pgn files, 0 means one per core and 1
+//  means the original single threaded PgnRead::Process()
+void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_pgn_file, bool build_position_index, int nbr_threads, uint32_t memory_cap_mb )
 {
     bool ok=true;
     bool created_new_db_file = false;
@@ -283,6 +291,7 @@ void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_
     // db_primitive_error_msg();   // clear error reporting mechanism
 
     BinDbReadBegin();
+    BinDbSetMemoryCap( memory_cap_mb, fout );
     FILE *ofile = fopen( fout.c_str(), "wb" );
     if( ofile )
     {
@@ -314,8 +323,17 @@ void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_
             printf( "%s\n", desc.c_str() );
             ProgressBar progress_bar( title, desc, true );
             uint32_t begin = BinDbGetGamesSize();
-            PgnRead pgn('B',&progress_bar);
-            bool aborted = pgn.Process(ifile);
+            bool aborted;
+            if( nbr_threads == 1 )
+            {
+                PgnRead pgn('B',&progress_bar);
+                aborted = pgn.Process(ifile);
+            }
+            else
+            {
+                PgnPipeline pipeline( nbr_threads, &progress_bar );
+                aborted = pipeline.Process(ifile);
+            }
             uint32_t end = BinDbGetGamesSize();
             BinDbNormaliseOrder( begin, end );
             if( aborted )
@@ -339,6 +357,15 @@ void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_
         fclose(ofile);
         ofile = NULL;
     }
+    if( ok && build_position_index )
+    {
+        std::string title( "Creating position index");
+        printf( "%s\n", title.c_str() );
+        ProgressBar progress_bar( title, title, true );
+        ok = PositionIndexBuild( fout, BinDbLoadAllGamesGetVector(), &progress_bar );
+        if( !ok )
+            error_msg = "Cannot create position index";
+    }
     if( ok )
     {
         wxSafeYield();
@@ -602,11 +629,34 @@ static std::vector< smart_ptr<ListableGame> > games;
 std::vector< smart_ptr<ListableGame> > &BinDbLoadAllGamesGetVector() { return games; }
 static int game_counter;
 
+// External memory mode (see BinDbSetMemoryCap()). Whenever the games vector grows beyond
+//  spill_cap bytes it is spilled to two temporary files. The games file has every game in
+//  the order read, the runs file has the same games as a series of runs, each sorted by moves.
+//  A spilled game is identified by its sequence number, its position in the games file
+#define SPILL_BLOCK 4096    // games file offset of every SPILL_BLOCK'th game is kept in memory
+static uint64_t    spill_cap;           // 0 means keep all games in memory
+static uint64_t    spill_mem;           // approximate memory used by the games vector
+static std::string spill_base;          // temporary files are spill_base+".spill1" and ".spill2"
+static FILE       *spill_games;
+static FILE       *spill_runs;
+static uint64_t    spill_games_posn;
+static uint64_t    spill_runs_posn;
+static std::vector<uint64_t> spill_block_offsets;   // games file offsets
+static std::vector<uint64_t> spill_run_offsets;     // runs file offset of each run
+static uint32_t    spill_nbr_games;     // games spilled so far, also sequence number of games[0]
+static uint32_t    spill_file_begin;    // sequence number of the first game of the current .pgn
+static std::vector<uint32_t> spill_dates;   // DateBin() of its spilled games, for BinDbNormaliseOrder()
+static std::vector< std::pair<uint32_t,uint32_t> > spill_reversed;  // [begin,end) to be read backwards
+static bool        spill_error;
+static void Spill();
+static void SpillEnd();
+
 // ..When we've finished creating and appending to databases, save memory by clearing it (new in V3.01)
 void BinDbCreationEnd()
 {
     games.clear();  // In the future consider moving the games to the in memory database instead of reloading
                     //  if the user answers yes to "would you like to use the new database now"
+    SpillEnd();
 }
 
 // Start reading BinDb game data
@@ -639,6 +689,18 @@ bool bin_db_append( const char *fen, const char *event, const char *site, const
     bool aborted = false;
     if( (++game_counter % 10000) == 0 )
         cprintf( "%d games read from input .pgn so far\n", game_counter );
+    BinDbPendingGame pg;
+    if( BinDbPrepareGame( fen, event, site, date, round, white, black, result, white_elo, black_elo, eco, nbr_moves, moves, pg ) )
+        BinDbAppendPrepared( pg );
+    return aborted;
+}
+
+// Everything bin_db_append() does except adding the game to the games array. Safe to call
+//  on many threads at once. Returns true if the game should be added
+bool BinDbPrepareGame( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                  const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                  int nbr_moves, thc::Move *moves, BinDbPendingGame &pg )
+{
     if( fen )
         return false;
     if( nbr_moves < 3 )    // skip 'games' with zero, one or two moves
@@ -715,35 +777,53 @@ bool bin_db_append( const char *fen, const char *event, const char *site, const
 
     CompressMoves press;
     std::vector<thc::Move> v(moves,moves+nbr_moves);
-    std::string compressed_moves = press.Compress(v);
-    std::string sevent(event);
-    std::string ssite(site);
-    std::string swhite(white);
-    if( swhite.length()>5 && swhite.substr(swhite.length()-5)==" (wh)" )
-        swhite = swhite.substr( 0, swhite.length()-5 );
-    std::string sblack(black);
-    if( sblack.length()>5 && sblack.substr(sblack.length()-5)==" (bl)" )
-        sblack = sblack.substr( 0, sblack.length()-5 );
+    pg.compressed_moves = press.Compress(v);
+    pg.event = event;
+    pg.site  = site;
+    pg.white = white;
+    if( pg.white.length()>5 && pg.white.substr(pg.white.length()-5)==" (wh)" )
+        pg.white = pg.white.substr( 0, pg.white.length()-5 );
+    pg.black = black;
+    if( pg.black.length()>5 && pg.black.substr(pg.black.length()-5)==" (bl)" )
+        pg.black = pg.black.substr( 0, pg.black.length()-5 );
+    pg.date      = yyyy==0 ? Date2Bin(date) : date_bin;
+    pg.round     = Round2Bin(round);
+    pg.result    = Result2Bin(result);
+    pg.eco       = Eco2Bin(eco);
+    pg.white_elo = elo_w;
+    pg.black_elo = elo_b;
+    return true;
+}
+
+// Add a game prepared by BinDbPrepareGame() to the games array. Games must be added in .pgn
+//  order, one thread at a time
+void BinDbAppendPrepared( BinDbPendingGame &pg )
+{
     ListableGameBinDb gb
     (
         bin_db_append_cb_idx,
-        games.size(),
-        sevent,
-        ssite,
-        swhite,
-        sblack,
-        yyyy==0 ? Date2Bin(date) : date_bin,
-        Round2Bin(round),
-        Result2Bin(result),
-        Eco2Bin(eco),
-        elo_w,
-        elo_b,
-        compressed_moves
+        spill_nbr_games + games.size(),
+        pg.event,
+        pg.site,
+        pg.white,
+        pg.black,
+        pg.date,
+        pg.round,
+        pg.result,
+        pg.eco,
+        pg.white_elo,
+        pg.black_elo,
+        pg.compressed_moves
     );
     make_smart_ptr( ListableGameBinDb, new_gb, gb );
     games.push_back( std::move(new_gb) );
-    //cprintf( "bin_db_append(): Out Added game %s-%s, %u games\n", white, black, games.size() );
-    return aborted;
+    if( spill_cap )
+    {
+        spill_mem += sizeof(ListableGameBinDb) + 64 + pg.compressed_moves.length();    // 64 for the shared_ptr, fields etc.
+        if( spill_mem > spill_cap )
+            Spill();
+    }
+    //cprintf( "bin_db_append(): Out Added game %s-%s, %u games\n", pg.white.c_str(), pg.black.c_str(), games.size() );
 }
 
 struct FileHeader
@@ -754,8 +834,95 @@ struct FileHeader
     int nbr_sites;
     int nbr_games;
     int locked;         // added with DATABASE_VERSION_NUMBER_LOCKABLE
+    int footer_len;     // added with the FileFooter, sizeof(FileFooter)
+};
+
+// The FileFooter is the last thing in the file. It follows the games and three tables, a
+//  fixed width offset table (allows random access to games and lets the load be split
+//  across threads without first scanning the games), a table of checksums, one for each
+//  GAMES_PER_CHECKSUM games and a piece square table (the PieceSquareMasks combos then a
+//  uint64_t mask for each game, lets searches skip games without playing through them).
+//  Versions that predate the footer read nbr_games games and never look any further, so
+//  they can still read files that have one. Files without a footer have a shorter
+//  FileHeader (see hdr_len) and are read by scanning the games. The footer grows by adding
+//  fields before footer_len and signature, fields missing from a shorter (older) footer
+//  read as zero.
+#define GAMES_PER_CHECKSUM 4096
+#define FILE_FOOTER_MIN_LEN 96  // the original FileFooter, without the piece square table
+
+// Tarrasch can append games to a file in place, in an extension after the footer that ends
+//  with a footer of its own with FOOTER_FLAG_EXTENSION (see BinDbAppendInPlace() in the
+//  Tarrasch sources). We only ever write complete files, without extensions
+
+// The file also has a fingerprint table, the DupFingerprint (see below) of each game, sorted,
+//  so Tarrasch can append to it in place without reading every game to look for duplicates
+
+// The players, events and sites strings are each written in strcmp() order, so the string
+//  ids in the game headers are also sort keys. Column sorts in the games dialogs use them
+//  directly, with no string compares (older files are checked when they are loaded instead)
+#define FOOTER_FLAG_STRINGS_SORTED 1
+#define FOOTER_FLAG_EXTENSION      2
+struct FileFooter
+{
+    uint64_t strings_offset;            // file offset and size of the players, events, sites strings
+    uint64_t strings_size;
+    uint64_t games_offset;              // file offset and size of the games
+    uint64_t games_size;
+    uint64_t offset_table_offset;       // nbr_games+1 offsets, relative to games_offset, the last
+    uint64_t offset_table_size;         //  one is games_size
+    uint64_t checksum_table_offset;     // CRC-32 of each GAMES_PER_CHECKSUM games
+    uint64_t checksum_table_size;
+    uint32_t nbr_games;
+    uint32_t offset_width;              // 4 or 8 bytes (8 only if games_size needs it)
+    uint32_t games_per_checksum;
+    uint32_t strings_checksum;          // CRC-32 of the strings
+    uint32_t offset_table_checksum;     // CRC-32 of the offset table
+    uint32_t checksum_table_checksum;   // CRC-32 of the checksum table
+    uint64_t piece_square_table_offset; // PIECE_SQUARE_NBR_COMBOS (piece,square) pairs, then
+    uint64_t piece_square_table_size;   //  nbr_games uint64_t masks
+    uint32_t piece_square_table_checksum;   // CRC-32 of the piece square table
+    uint32_t nbr_piece_square_combos;
+    uint32_t flags;                     // FOOTER_FLAG_xxx
+    uint32_t reserved;
+    uint64_t prev_len;                  // FOOTER_FLAG_EXTENSION only, the file length before
+    uint32_t nbr_players;               //  the extension, and the number of players, events
+    uint32_t nbr_events;                //  and sites strings it adds
+    uint32_t nbr_sites;
+    uint32_t reserved2;
+    uint64_t fingerprint_table_offset;  // nbr_games uint64_t fingerprints in ascending order, then
+    uint64_t fingerprint_table_size;    //  the uint32_t game number (from 0) of each
+    uint32_t fingerprint_table_checksum;    // CRC-32 of the fingerprint table
+    uint32_t fingerprint_version;       // DUP_FINGERPRINT_VERSION, tables of other versions are ignored
+    uint32_t footer_len;                // sizeof(FileFooter), a future compatibility feature
+    char     signature[4];              // "TDBF"
+};
+
+// CRC-32 (the zlib/ethernet polynomial) for the FileFooter checksums, also used by PositionIndex
+struct Crc32Table
+{
+    uint32_t entry[256];
+    Crc32Table()
+    {
+        for( uint32_t i=0; i<256; i++ )
+        {
+            uint32_t c = i;
+            for( int j=0; j<8; j++ )
+                c = (c&1) ? (0xedb88320 ^ (c>>1)) : (c>>1);
+            entry[i] = c;
+        }
+    }
 };
 
+uint32_t Crc32( uint32_t crc, const void *buf, size_t len )
+{
+    static const Crc32Table table;
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    crc = ~crc;
+    while( len-- )
+        crc = table.entry[(crc^*p++) & 0xff] ^ (crc>>8);
+    return ~crc;
+}
+
 bool TestBinaryBlock()
 {
     bool ok;
@@ -1031,7 +1198,15 @@ static bool IsYearMatch( const char *date1, const char *date2 )
 
 uint32_t BinDbGetGamesSize()
 {
-    return games.size();
+    return spill_nbr_games + games.size();
+}
+
+// DateBin() of a game, by sequence number, spilled or not
+static int SeqDateBin( uint32_t seq )
+{
+    if( seq < spill_nbr_games )
+        return spill_dates[seq-spill_file_begin];
+    return games[seq-spill_nbr_games]->DateBin();
 }
 
 void BinDbNormaliseOrder( uint32_t begin, uint32_t end )
@@ -1044,8 +1219,8 @@ void BinDbNormaliseOrder( uint32_t begin, uint32_t end )
     {
         unsigned int j = begin + (rand() % sz);
         unsigned int k = begin + (rand() % sz);
-        int jbin = games[j]->DateBin();
-        int kbin = games[k]->DateBin();
+        int jbin = SeqDateBin(j);
+        int kbin = SeqDateBin(k);
         if( k>j && kbin>jbin )
             forward_cnt++;        //forward if later in the file has a later date
         if( k>j && kbin<jbin )
@@ -1062,15 +1237,24 @@ void BinDbNormaliseOrder( uint32_t begin, uint32_t end )
         neither = false;
     }
     cprintf( "BinDbNormaliseOrder(): out forward_cnt=%u, reverse_cnt=%u, forward=%s, reverse=%s\n", forward_cnt, reverse_cnt, forward?"true":"false", reverse?"true (reversing)":"false" );
-    if( reverse )
+    spill_file_begin = end;
+    spill_dates.clear();
+    if( reverse && begin<spill_nbr_games )
+    {
+        spill_reversed.push_back( std::pair<uint32_t,uint32_t>(begin,end) );   // reversed when read back
+        cprintf( "reverse deferred\n" );
+    }
+    else if( reverse )
     {
+        begin -= spill_nbr_games;
+        end   -= spill_nbr_games;
         uint32_t base = games[begin]->game_id;
         std::reverse( games.begin()+begin, games.begin()+end );
         for( uint32_t i=begin; i<end; i++ )
             games[i]->game_id = base+i;
         cprintf( "reverse end\n" );
     }
-    if( sz )
+    if( sz && spill_nbr_games==0 )
     {
         if( begin > 0 )
         {
@@ -1197,15 +1381,6 @@ static bool predicate_sorts_by_id( const smart_ptr<ListableGame> &e1, const smar
     return ret;
 }
 
-static bool predicate_sorts_by_game_moves( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
-{
-    bool ret = std::string(e1->CompressedMoves()) < std::string(e2->CompressedMoves());
-    predicate_count++;
-    if( (predicate_count & 0xffff) == 0 )
-        sort_progress_probe();
-    return ret;
-}
-
 static bool predicate_sorts_by_player( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
 {
     bool ret;
@@ -1311,6 +1486,57 @@ static void replace_once( std::string &s, const std::string from, const std::str
 #endif
 
 
+// Two games can only be duplicates if they have the same moves, result and year (see
+//  DupDetect()), a 128 bit fingerprint of those three things groups potential duplicates
+//  together without sorting. The players needn't match exactly, so they are left out of
+//  the fingerprint and compared within each group. The low 64 bits are stored in the
+//  FileFooter fingerprint table, so DupFingerprintCalc() must match Tarrasch's exactly
+#define DUP_NONE 0xffffffff
+#define DUP_FINGERPRINT_VERSION 1
+struct DupFingerprint
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+static uint64_t DupMix( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void DupFingerprintCalc( const smart_ptr<ListableGame> &p, DupFingerprint &fp )
+{
+    uint64_t lo = 0xcbf29ce484222325ULL;    // FNV-1a
+    uint64_t hi = 0x9e3779b97f4a7c15ULL;    // multiply and rotate
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p->CompressedMoves());
+    uint64_t len = 0;
+    while( *s )
+    {
+        lo = (lo ^ *s) * 0x100000001b3ULL;
+        hi = (hi ^ *s) * 0x87c37b91114253d5ULL;
+        hi = (hi << 31) | (hi >> 33);
+        s++;
+        len++;
+    }
+    uint64_t year = (p->DateBin()>>9) & 0x3ff;
+    uint64_t extra = (len<<16) | (year<<2) | (p->ResultBin()&3);
+    fp.lo = DupMix( lo ^ extra );
+    fp.hi = DupMix( hi + extra*0x9e3779b97f4a7c15ULL );
+}
+
+static bool predicate_is_not_dup( const smart_ptr<ListableGame> &p )
+{
+    return p->game_id != GAME_ID_SENTINEL;
+}
+
+static bool SpillRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &dup_title, std::string &write_title,
+                            std::string &optional_title, FILE *ofile, bool locked, wxWindow *window );
+
 // New in V3.01a - incorporate write file so can do that before writing dups to TarraschDbDuplicate.pgn
 bool BinDbRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &title, int step, FILE *ofile, bool locked, wxWindow *window )
 {
@@ -1339,15 +1565,50 @@ bool BinDbRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &tit
     std::string write_title(buf);
     sprintf( buf, "%s, step %d of %d", title.c_str(), step+2, step+2 );
     std::string optional_title(buf);
+    if( spill_nbr_games > 0 )
+        return SpillRemoveDuplicatesAndWrite( generate_dup_pgn_file, dup_title, write_title, optional_title, ofile, locked, window );
+    int nbr_games = games.size();
+    std::vector<uint32_t> next_in_group( nbr_games, DUP_NONE );  // games with the same fingerprint, in id order
+    std::vector<uint32_t> last_in_group( nbr_games, DUP_NONE );  // set for the first game of each group only
     {
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 before");
         std::string desc("Duplicate Removal - phase 1");
         printf( "%s\n", desc.c_str() );
         ProgressBar progress_bar( dup_title, desc, true, window );
         progress_bar.DrawNow();
-        sort_before( games.begin(), games.end(), predicate_sorts_by_game_moves, &progress_bar );
-        std::sort( games.begin(), games.end(), predicate_sorts_by_game_moves );
-        sort_after();
+        ProgressBar *pb = &progress_bar;
+
+        // Group games by fingerprint with a hash table, open addressing, at most half full
+        std::vector<DupFingerprint> fingerprints( nbr_games );
+        uint32_t table_size = 1024;
+        while( table_size < 2*static_cast<uint32_t>(nbr_games) )
+            table_size *= 2;
+        std::vector<uint32_t> table( table_size, DUP_NONE );
+        for( int i=0; i<nbr_games; i++ )
+        {
+            if( pb->Perfraction( i,nbr_games) )
+                return false;   // abort
+            DupFingerprint &fp = fingerprints[i];
+            DupFingerprintCalc( games[i], fp );
+            uint32_t slot = static_cast<uint32_t>(fp.lo) & (table_size-1);
+            for(;;)
+            {
+                uint32_t first = table[slot];
+                if( first == DUP_NONE )
+                {
+                    table[slot] = i;
+                    last_in_group[i] = i;
+                    break;
+                }
+                if( fingerprints[first].lo==fp.lo && fingerprints[first].hi==fp.hi )
+                {
+                    next_in_group[ last_in_group[first] ] = i;
+                    last_in_group[first] = i;
+                    break;
+                }
+                slot = (slot+1) & (table_size-1);
+            }
+        }
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 after");
     }
     {
@@ -1357,139 +1618,83 @@ bool BinDbRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &tit
         ProgressBar progress_bar( dup_title, desc, true, window );
         progress_bar.DrawNow();
         ProgressBar *pb = &progress_bar;
-        int nbr_games = games.size();
-
-        // State variable - true when traversing duplicates
-        bool in_dups=false;
-
-        // State variable - points to first of group of duplicates
-        int start=0;
-        for( int i=0; i<nbr_games-1; i++ )    // note we stop at second last element
+        std::vector< smart_ptr<ListableGame> > group;
+        for( int i=0; i<nbr_games; i++ )
         {
             if( pb->Perfraction( i,nbr_games) )
                 return false;   // abort
 
-            // Does this element match the next element? (there's always another element because
-            //  remember we stop at second to last element not last element)
-            bool next_matches = (0 == strcmp(games[i]->CompressedMoves(),games[i+1]->CompressedMoves()) );
-
-            // end will point beyond end of a group of duplicates if we identify such a group this time
-            //  through the loop
-            int end = i;
-
-            // State machine to maintain in_dups and start state variables
-            if( in_dups )
-            {
-                if( !next_matches )
-                {
-                    in_dups = false;
-                    end = i+1;  // Leaving a group of duplicates, evaluate them
-                }
-            }
-            else
-            {
-                if( next_matches )
-                {
-                    in_dups = true;
-                    start = i;
-                }
-            }
-
-            // One special case - a group of duplicates at the end
-            bool last = (i+1 >= nbr_games-1);  // is this the last time thru loop?
-            if( last && in_dups )
-                end = i+2;  // i points at second last element, end should point beyond last element
-
-            // Found a group of (potential) duplicates. So far we only know that the moves are
-            //  identical. We have more work to do to identify the real duplicates. Real duplicates
-            //  are marked with id = GAME_ID_SENTINEL so that they group together when we do a final
-            //  sort by id.
-            if( end > i )
+            // Found a group of (potential) duplicates, the first game of a group with more than
+            //  one game. So far we only know that the moves, result and year are the same. We
+            //  have more work to do to identify the real duplicates. Real duplicates are marked
+            //  with id = GAME_ID_SENTINEL so that they can be moved to the end
+            if( last_in_group[i]==DUP_NONE || next_in_group[i]==DUP_NONE )
+                continue;
+            group.clear();
+            for( uint32_t idx=i; idx!=DUP_NONE; idx=next_in_group[idx] )
+                group.push_back( games[idx] );
+            int end = group.size();
+
+            // For each game in group of duplicates
+            for( int idx=0; idx<end; idx++ )
             {
+                smart_ptr<ListableGame> p = group[idx];
 
-                // First reorder the group by id
-                std::sort( games.begin()+start, games.begin()+end, predicate_sorts_by_id );
-#if 0
+                // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
+                if( p->game_id != GAME_ID_SENTINEL )
                 {
-                    cprintf( "Eval Dups in\n" );
-                    for( int idx=start; idx<end; idx++ )
-                    {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
-                    }
-                }
-#endif
-
-                // For each game in group of duplicates
-                for( int idx=start; idx<end; idx++ )
-                {
-                    smart_ptr<ListableGame> p = games[idx];
-
-                    // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
-                    if( p->game_id != GAME_ID_SENTINEL )
-                    {
 
-                        // Sweep through the rest of the group and mark each game in turn a dup if it matches
-                        std::vector<std::string> white_tokens;
-                        Split(p->White(),white_tokens);
-                        std::vector<std::string> black_tokens;
-                        Split(p->Black(),black_tokens);
+                    // Sweep through the rest of the group and mark each game in turn a dup if it matches
+                    std::vector<std::string> white_tokens;
+                    Split(p->White(),white_tokens);
+                    std::vector<std::string> black_tokens;
+                    Split(p->Black(),black_tokens);
 
-                        // Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
-                        //  game in main loop
+                    // Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
+                    //  game in main loop
 #ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        int nbr_dups=0;
+                    int nbr_dups=0;
 #endif
-                        std::string str_dup_games;
-                        for( int j=idx+1; j<end; j++ )
+                    std::string str_dup_games;
+                    for( int j=idx+1; j<end; j++ )
+                    {
+                        smart_ptr<ListableGame> q = group[j];
+                        if( q->game_id!=GAME_ID_SENTINEL && 0==strcmp(p->CompressedMoves(),q->CompressedMoves())
+                                                         && DupDetect(p,white_tokens,black_tokens,q) )
                         {
-                            smart_ptr<ListableGame> q = games[j];
-                            if( q->game_id!=GAME_ID_SENTINEL && DupDetect(p,white_tokens,black_tokens,q) )
-                            {
-                                q->game_id = GAME_ID_SENTINEL;
+                            q->game_id = GAME_ID_SENTINEL;
 #ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                                GameDocument the_game;
-                                CompactGame pact;
-                                std::string str;
-                                if( nbr_dups == 0 )
-                                {
-                                    p->GetCompactGame( pact );
-                                    pact.Upscale(the_game);
-                                    the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
-                                    the_game.ToFileTxtGameBody( str );
-                                    str_dup_games += str;
-                                }
-                                nbr_dups++;
-                                q->GetCompactGame( pact );
+                            GameDocument the_game;
+                            CompactGame pact;
+                            std::string str;
+                            if( nbr_dups == 0 )
+                            {
+                                p->GetCompactGame( pact );
                                 pact.Upscale(the_game);
                                 the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
+                                str_dup_games += str;
                                 the_game.ToFileTxtGameBody( str );
                                 str_dup_games += str;
-#endif
                             }
-                        }
-#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        if( pgn_dup2 && nbr_dups>0 )
-                        {
-                            if( nbr_dups > 1 )
-                                replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
-                            fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
-                        }
+                            nbr_dups++;
+                            q->GetCompactGame( pact );
+                            pact.Upscale(the_game);
+                            the_game.ToFileTxtGameDetails( str );
+                            str_dup_games += str;
+                            the_game.ToFileTxtGameBody( str );
+                            str_dup_games += str;
 #endif
+                        }
                     }
-                }
-#if 0
-                {
-                    cprintf( "Eval Dups out\n" );
-                    for( int idx=start; idx<end; idx++ )
+#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
+                    if( pgn_dup2 && nbr_dups>0 )
                     {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
+                        if( nbr_dups > 1 )
+                            replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
+                        fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
                     }
-                }
 #endif
+                }
             }
         }
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 after");
@@ -1497,15 +1702,10 @@ bool BinDbRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &tit
     int nbr_deleted=0;
     {
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 3 before");
-        std::string desc("Duplicate Removal - phase 3");
-        printf( "%s\n", desc.c_str() );
-        ProgressBar progress_bar( dup_title, desc, true, window );
-        //progress_bar.DrawNow();
-        sort_before( games.begin(), games.end(), predicate_sorts_by_id, &progress_bar );
-        std::sort( games.begin(), games.end(), predicate_sorts_by_id );
-        sort_after();
 
-        // Games to be deleted are at the end - with id GAME_ID_SENTINEL, count them
+        // The games are still in id order, move the games to be deleted (with id GAME_ID_SENTINEL)
+        //  to the end, keeping the order of the rest, and count them
+        std::stable_partition( games.begin(), games.end(), predicate_is_not_dup );
         for( int i=games.size()-1; i>=0; i-- )
         {
             if( games[i]->game_id != GAME_ID_SENTINEL )
@@ -1597,8 +1797,37 @@ void debug_helper( int idx, int nbr_games, int part, const char *white, const ch
     }
 }
 
+// Where WriteOut() gets the games to write, in order
+class WriteOutSource
+{
+public:
+    virtual ~WriteOutSource() {}
+    virtual void ChooseCombos( PieceSquareMasks &psm, int nbr_games ) = 0;
+    virtual smart_ptr<ListableGame> Next() = 0;
+};
+
+// The first nbr_games games of the games vector
+class WriteOutGames : public WriteOutSource
+{
+public:
+    WriteOutGames() { idx=0; }
+    virtual void ChooseCombos( PieceSquareMasks &psm, int nbr_games ) { psm.ChooseCombos(games,nbr_games); }
+    virtual smart_ptr<ListableGame> Next() { return games[idx++]; }
+private:
+    size_t idx;
+};
+
+static bool WriteOut( FILE *ofile, int nbr_games, WriteOutSource &src, bool locked, ProgressBar *pb );
+
 // Return bool okay
 bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, ProgressBar *pb )
+{
+    WriteOutGames src;
+    return WriteOut( ofile, games.size()-nbr_to_omit_from_end, src, locked, pb );
+}
+
+// Return bool okay
+static bool WriteOut( FILE *ofile, int nbr_games, WriteOutSource &src, bool locked, ProgressBar *pb )
 {
     std::set<std::string> set_player;
     std::set<std::string> set_site;
@@ -1630,19 +1859,25 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         fwrite( &ver, 1, 1, ofile );
     }
     std::set<std::string>::iterator it = set_player.begin();
+    FileFooter ff;
+    memset( &ff, 0, sizeof(ff) );
+    uint64_t posn = sizeof(compatibility_header) + sizeof(FileHeader);    // track file position ourselves, ftell() is
+                                                                        //  only 32 bits on some platforms
     FileHeader fh;
     fh.hdr_len     = sizeof(FileHeader);
     fh.nbr_players = std::distance( set_player.begin(), set_player.end() );
     fh.nbr_events  = std::distance( set_event.begin(),  set_event.end() );
     fh.nbr_sites   = std::distance( set_site.begin(),   set_site.end() );
-    fh.nbr_games   = games.size() - nbr_to_omit_from_end;
+    fh.nbr_games   = nbr_games;
     fh.locked      = locked;
+    fh.footer_len  = sizeof(FileFooter);
     printf( "%d games, %d players, %d events, %d sites\n", fh.nbr_games, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
     int nbr_bits_player = BitsRequired(fh.nbr_players);
     int nbr_bits_event  = BitsRequired(fh.nbr_events);
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
     fwrite( &fh, sizeof(fh), 1, ofile );
+    ff.strings_offset = posn;
     int idx=0;
     int total_strings = fh.nbr_players + fh.nbr_events + fh.nbr_sites + fh.nbr_games;
     int nbr_strings_so_far = 0;
@@ -1652,6 +1887,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_player[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1666,6 +1903,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_event[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1680,6 +1919,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_site[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1705,9 +1946,21 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     bb.Next(12);                // BlackElo
     int bb_sz = bb.Size();
     cprintf( "bb_sz=%d\n", bb_sz );
+    ff.strings_size = posn - ff.strings_offset;
+    ff.games_offset = posn;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> checksums;
+    uint32_t checksum = 0;
+    PieceSquareMasks psm;
+    src.ChooseCombos( psm, fh.nbr_games );
+    std::vector<uint64_t> masks;
+    masks.reserve( fh.nbr_games );
+    std::vector< std::pair<uint64_t,uint32_t> > fingerprints;
+    fingerprints.reserve( fh.nbr_games );
     for( int i=0; i<fh.nbr_games; i++ )
     {
-        smart_ptr<ListableGame> ptr = games[i];
+        offsets.push_back( posn - ff.games_offset );
+        smart_ptr<ListableGame> ptr = src.Next();
         int white_offset = map_player[std::string(ptr->White())];
         int black_offset = map_player[std::string(ptr->Black())];
         int event_offset = map_event[std::string(ptr->Event())];
@@ -1726,10 +1979,22 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         bb.Write(8,ptr->WhiteEloBin());     // WhiteElo 12 bits (range 0..4095)
         bb.Write(9,ptr->BlackEloBin());     // BlackElo
         fwrite( bb.GetPtr(), bb_sz, 1, ofile );
+        checksum = Crc32( checksum, bb.GetPtr(), bb_sz );
         // debug_helper( i, fh.nbr_games, 1, ptr->White(), ptr->Black(), bb.GetPtr(), bb_sz );
         int n = strlen(ptr->CompressedMoves()) + 1;
         const char *cstr = ptr->CompressedMoves();
         fwrite( cstr, n, 1, ofile );
+        checksum = Crc32( checksum, cstr, n );
+        masks.push_back( psm.GameMask(cstr) );
+        DupFingerprint fp;
+        DupFingerprintCalc( ptr, fp );
+        fingerprints.push_back( std::pair<uint64_t,uint32_t>(fp.lo,i) );
+        posn += bb_sz + n;
+        if( (i+1)%GAMES_PER_CHECKSUM==0 || i+1==fh.nbr_games )
+        {
+            checksums.push_back( checksum );
+            checksum = 0;
+        }
         // debug_helper( i, fh.nbr_games, 2, ptr->White(), ptr->Black(), cstr, n );
         if( (i % 10000) == 0 )
             cprintf( "%d games written to compressed file so far\n", i );
@@ -1738,10 +2003,508 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
             if( pb->Perfraction( nbr_strings_so_far, total_strings ) )
                 return false;   // abort
     }
+
+    // Offset table, checksum table, piece square table and finally the footer
+    offsets.push_back( posn - ff.games_offset );
+    ff.games_size = posn - ff.games_offset;
+    ff.nbr_games  = fh.nbr_games;
+    ff.offset_width = (ff.games_size > 0xffffffff ? 8 : 4);
+    ff.offset_table_offset = posn;
+    for( size_t i=0; i<offsets.size(); i++ )
+    {
+        uint32_t offset32 = static_cast<uint32_t>(offsets[i]);
+        const void *offset = (ff.offset_width==8 ? static_cast<const void *>(&offsets[i]) : static_cast<const void *>(&offset32));
+        fwrite( offset, ff.offset_width, 1, ofile );
+        ff.offset_table_checksum = Crc32( ff.offset_table_checksum, offset, ff.offset_width );
+    }
+    ff.offset_table_size = offsets.size() * ff.offset_width;
+    posn += ff.offset_table_size;
+    ff.checksum_table_offset = posn;
+    ff.checksum_table_size = checksums.size() * sizeof(uint32_t);
+    if( checksums.size() > 0 )
+    {
+        fwrite( &checksums[0], sizeof(uint32_t), checksums.size(), ofile );
+        ff.checksum_table_checksum = Crc32( 0, &checksums[0], ff.checksum_table_size );
+    }
+    posn += ff.checksum_table_size;
+    uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2];
+    psm.GetCombos( combos );
+    fwrite( combos, sizeof(combos), 1, ofile );
+    ff.piece_square_table_checksum = Crc32( 0, combos, sizeof(combos) );
+    if( masks.size() > 0 )
+    {
+        fwrite( &masks[0], sizeof(uint64_t), masks.size(), ofile );
+        ff.piece_square_table_checksum = Crc32( ff.piece_square_table_checksum, &masks[0], masks.size()*sizeof(uint64_t) );
+    }
+    ff.piece_square_table_offset = posn;
+    ff.piece_square_table_size = sizeof(combos) + masks.size()*sizeof(uint64_t);
+    ff.nbr_piece_square_combos = psm.NbrCombos();
+    posn += ff.piece_square_table_size;
+    std::sort( fingerprints.begin(), fingerprints.end() );
+    std::vector<uint64_t> keys( fingerprints.size() );
+    std::vector<uint32_t> game_nbrs( fingerprints.size() );
+    for( size_t i=0; i<fingerprints.size(); i++ )
+    {
+        keys[i] = fingerprints[i].first;
+        game_nbrs[i] = fingerprints[i].second;
+    }
+    std::vector< std::pair<uint64_t,uint32_t> >().swap( fingerprints );
+    ff.fingerprint_table_offset = posn;
+    if( keys.size() > 0 )
+    {
+        fwrite( &keys[0], sizeof(uint64_t), keys.size(), ofile );
+        fwrite( &game_nbrs[0], sizeof(uint32_t), game_nbrs.size(), ofile );
+        ff.fingerprint_table_checksum = Crc32( 0, &keys[0], keys.size()*sizeof(uint64_t) );
+        ff.fingerprint_table_checksum = Crc32( ff.fingerprint_table_checksum, &game_nbrs[0], game_nbrs.size()*sizeof(uint32_t) );
+    }
+    ff.fingerprint_table_size = keys.size() * (sizeof(uint64_t)+sizeof(uint32_t));
+    ff.fingerprint_version = DUP_FINGERPRINT_VERSION;
+    ff.games_per_checksum = GAMES_PER_CHECKSUM;
+    ff.flags = FOOTER_FLAG_STRINGS_SORTED;     // std::set order is strcmp() order
+    ff.footer_len = sizeof(FileFooter);
+    memcpy( ff.signature, "TDBF", 4 );
+    fwrite( &ff, sizeof(ff), 1, ofile );
     printf( "%d games written to compressed file\n", fh.nbr_games );
     return true;
 }
 
+/*
+    External memory mode
+
+    Spill() writes the games vector out as one more sorted run whenever it grows beyond the
+    memory cap, so memory use while reading .pgn files doesn't depend on how many games there
+    are. SpillRemoveDuplicatesAndWrite() then does the job of BinDbRemoveDuplicatesAndWrite()
+    in two passes over the temporary files;
+     1) A k-way merge of the runs brings together each group of games with the same moves,
+        the duplicates in the group are found exactly as before and noted in a bit vector
+     2) The surviving games are read back from the games file in database order and written
+    Only the strings (players, events, sites) and a few bytes per game (the duplicate bits,
+    and the offset table and piece square masks being written) stay in memory
+*/
+
+// Enable external memory mode, cap_mb 0 disables it
+void BinDbSetMemoryCap( uint32_t cap_mb, const std::string &temp_base )
+{
+    spill_cap  = static_cast<uint64_t>(cap_mb) * 1024 * 1024;
+    spill_base = temp_base;
+}
+
+static bool SpillSeek( FILE *f, uint64_t offset )
+{
+#ifdef THC_WINDOWS
+    return 0 == _fseeki64( f, offset, SEEK_SET );
+#else
+    return 0 == fseeko( f, offset, SEEK_SET );
+#endif
+}
+
+static void SpillWrite( FILE *f, uint64_t &posn, const void *buf, size_t len )
+{
+    if( len>0 && 1!=fwrite(buf,len,1,f) )
+        spill_error = true;
+    posn += len;
+}
+
+// Remove the temporary files and reset
+static void SpillEnd()
+{
+    if( spill_games )
+    {
+        fclose( spill_games );
+        remove( (spill_base+".spill1").c_str() );
+    }
+    if( spill_runs )
+    {
+        fclose( spill_runs );
+        remove( (spill_base+".spill2").c_str() );
+    }
+    spill_games = NULL;
+    spill_runs  = NULL;
+    spill_games_posn = 0;
+    spill_runs_posn  = 0;
+    spill_block_offsets.clear();
+    spill_run_offsets.clear();
+    spill_nbr_games  = 0;
+    spill_file_begin = 0;
+    spill_dates.clear();
+    spill_reversed.clear();
+    spill_mem   = 0;
+    spill_error = false;
+}
+
+static bool predicate_sorts_by_moves_only( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
+{
+    return strcmp( e1->CompressedMoves(), e2->CompressedMoves() ) < 0;
+}
+
+// Append the games vector to the games file, and as a new run sorted by moves to the
+//  runs file, then empty it. Each game is written as its fields (see PackedGameBinDb), with
+//  a length in the games file and a sequence number and length in the runs file
+static void Spill()
+{
+    if( spill_error || games.size()==0 )
+        return;
+    if( !spill_games )
+    {
+        spill_games = fopen( (spill_base+".spill1").c_str(), "w+b" );
+        spill_runs  = fopen( (spill_base+".spill2").c_str(), "w+b" );
+        if( !spill_games || !spill_runs )
+        {
+            printf( "Error: Cannot create temporary files %s.spill1 and .spill2\n", spill_base.c_str() );
+            spill_error = true;
+            return;
+        }
+    }
+    uint32_t hdr_len = bin_db_control_blocks[bin_db_append_cb_idx].bb.FrozenSize();
+    uint32_t nbr = games.size();
+    for( uint32_t i=0; i<nbr; i++ )
+    {
+        uint32_t seq = spill_nbr_games + i;
+        if( seq%SPILL_BLOCK == 0 )
+            spill_block_offsets.push_back( spill_games_posn );
+        const char *moves = games[i]->CompressedMoves();
+        uint32_t len = hdr_len + strlen(moves);
+        SpillWrite( spill_games, spill_games_posn, &len, sizeof(len) );
+        SpillWrite( spill_games, spill_games_posn, moves-hdr_len, len );
+        if( seq >= spill_file_begin )
+            spill_dates.push_back( games[i]->DateBin() );
+        games[i]->game_id = seq;
+    }
+    std::sort( games.begin(), games.end(), predicate_sorts_by_moves_only );
+    spill_run_offsets.push_back( spill_runs_posn );
+    for( uint32_t i=0; i<nbr; i++ )
+    {
+        const char *moves = games[i]->CompressedMoves();
+        uint32_t hdr[2];
+        hdr[0] = games[i]->game_id;
+        hdr[1] = hdr_len + strlen(moves);
+        SpillWrite( spill_runs, spill_runs_posn, hdr, sizeof(hdr) );
+        SpillWrite( spill_runs, spill_runs_posn, moves-hdr_len, hdr[1] );
+    }
+    spill_nbr_games += nbr;
+    games.clear();
+    spill_mem = 0;
+    printf( "%u games spilled to temporary files\n", spill_nbr_games );
+}
+
+// Sequence number to database order and vice versa, reversing the .pgn files that
+//  BinDbNormaliseOrder() couldn't reverse in memory
+static uint32_t SpillReorder( uint32_t n )
+{
+    for( size_t i=0; i<spill_reversed.size(); i++ )
+    {
+        if( spill_reversed[i].first<=n && n<spill_reversed[i].second )
+            return spill_reversed[i].first + (spill_reversed[i].second-1-n);
+    }
+    return n;
+}
+
+// Read one run from the runs file, one game at a time
+class SpillRunReader
+{
+public:
+    uint32_t    seq;
+    std::string fields;
+    const char *Moves() const { return fields.c_str() + hdr_len; }
+
+    void Init( uint64_t begin, uint64_t end, size_t buf_size, uint32_t hdr_len )
+    {
+        posn = begin;
+        this->end = end;
+        buf.resize( buf_size );
+        buf_begin = buf_end = 0;
+        this->hdr_len = hdr_len;
+    }
+
+    // Returns false at the end of the run
+    bool Next()
+    {
+        uint32_t hdr[2];
+        if( !Fill(sizeof(hdr)) )
+            return false;
+        memcpy( hdr, &buf[buf_begin], sizeof(hdr) );
+        buf_begin += sizeof(hdr);
+        if( !Fill(hdr[1]) )
+        {
+            spill_error = true;
+            return false;
+        }
+        seq = hdr[0];
+        fields.assign( &buf[buf_begin], hdr[1] );
+        buf_begin += hdr[1];
+        return true;
+    }
+
+private:
+    uint64_t posn;
+    uint64_t end;
+    std::vector<char> buf;
+    size_t buf_begin;
+    size_t buf_end;
+    uint32_t hdr_len;
+
+    // Make sure at least len bytes are buffered, returns false if there aren't that many left
+    bool Fill( size_t len )
+    {
+        if( buf_end-buf_begin >= len )
+            return true;
+        if( buf_begin > 0 )
+        {
+            memmove( &buf[0], &buf[buf_begin], buf_end-buf_begin );
+            buf_end -= buf_begin;
+            buf_begin = 0;
+        }
+        if( buf.size() < len )
+            buf.resize( len );
+        uint64_t n = buf.size() - buf_end;
+        if( n > end-posn )
+            n = end-posn;
+        if( n > 0 )
+        {
+            if( !SpillSeek(spill_runs,posn) || 1!=fread(&buf[buf_end],static_cast<size_t>(n),1,spill_runs) )
+            {
+                spill_error = true;
+                return false;
+            }
+            posn    += n;
+            buf_end += static_cast<size_t>(n);
+        }
+        return buf_end >= len;
+    }
+};
+
+// For the merge, a heap with the run with the lowest moves on top
+struct SpillRunCompare
+{
+    std::vector<SpillRunReader> *runs;
+    bool operator()( int a, int b ) const { return strcmp( (*runs)[a].Moves(), (*runs)[b].Moves() ) > 0; }
+};
+
+// Read games from the games file by sequence number, a block at a time
+class SpillGamesReader
+{
+public:
+    SpillGamesReader() { block_idx = 0xffffffff; }
+    const std::string &Read( uint32_t seq )
+    {
+        uint32_t idx = seq / SPILL_BLOCK;
+        if( idx != block_idx )
+        {
+            block_idx = idx;
+            uint32_t nbr = spill_nbr_games - idx*SPILL_BLOCK;
+            if( nbr > SPILL_BLOCK )
+                nbr = SPILL_BLOCK;
+            block.resize( nbr );
+            bool ok = SpillSeek( spill_games, spill_block_offsets[idx] );
+            for( uint32_t i=0; ok && i<nbr; i++ )
+            {
+                uint32_t len;
+                ok = (1 == fread(&len,sizeof(len),1,spill_games) );
+                if( ok )
+                {
+                    block[i].resize( len );
+                    ok = (len==0 || 1==fread(&block[i][0],len,1,spill_games) );
+                }
+            }
+            if( !ok )
+                spill_error = true;
+        }
+        return block[seq%SPILL_BLOCK];
+    }
+private:
+    uint32_t block_idx;
+    std::vector<std::string> block;
+};
+
+// The games that aren't duplicates, in database order
+class WriteOutSpilled : public WriteOutSource
+{
+public:
+    WriteOutSpilled( const std::vector<bool> &dup ) : dup(dup) { posn=0; }
+
+    // A preliminary pass to collect the same sample of games PieceSquareMasks::ChooseCombos()
+    //  would take from the games vector
+    virtual void ChooseCombos( PieceSquareMasks &psm, int nbr_games )
+    {
+        std::vector< smart_ptr<ListableGame> > sample;
+        size_t step = PieceSquareMasks::SampleStep( nbr_games );
+        SpillGamesReader reader;
+        size_t i=0;
+        for( uint32_t n=0; n<dup.size(); n++ )
+        {
+            if( dup[n] )
+                continue;
+            if( i++ % step == 0 )
+            {
+                ListableGameBinDb gb( bin_db_append_cb_idx, n, reader.Read(SpillReorder(n)) );
+                make_smart_ptr( ListableGameBinDb, new_gb, gb );
+                sample.push_back( std::move(new_gb) );
+            }
+        }
+        psm.ChooseCombos( sample, sample.size(), 1 );
+    }
+
+    virtual smart_ptr<ListableGame> Next()
+    {
+        while( dup[posn] )
+            posn++;
+        ListableGameBinDb gb( bin_db_append_cb_idx, posn, reader.Read(SpillReorder(posn)) );
+        make_smart_ptr( ListableGameBinDb, new_gb, gb );
+        posn++;
+        return new_gb;
+    }
+
+private:
+    const std::vector<bool> &dup;
+    uint32_t posn;
+    SpillGamesReader reader;
+};
+
+// Find the duplicates amongst a group of spilled games with the same moves, exactly as
+//  BinDbRemoveDuplicatesAndWrite() does
+static void SpillDupDetect( std::vector< smart_ptr<ListableGame> > &group, std::vector<bool> &dup )
+{
+    std::sort( group.begin(), group.end(), predicate_sorts_by_id );
+    size_t end = group.size();
+    for( size_t idx=0; idx<end; idx++ )
+    {
+        smart_ptr<ListableGame> p = group[idx];
+        if( !dup[p->game_id] )
+        {
+            std::vector<std::string> white_tokens;
+            Split(p->White(),white_tokens);
+            std::vector<std::string> black_tokens;
+            Split(p->Black(),black_tokens);
+            for( size_t j=idx+1; j<end; j++ )
+            {
+                smart_ptr<ListableGame> q = group[j];
+                if( !dup[q->game_id] && DupDetect(p,white_tokens,black_tokens,q) )
+                    dup[q->game_id] = true;
+            }
+        }
+    }
+}
+
+static bool SpillRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &dup_title, std::string &write_title,
+                            std::string &optional_title, FILE *ofile, bool locked, wxWindow *window )
+{
+    bool ok = true;
+    Spill();
+    uint32_t nbr_games = spill_nbr_games;
+    std::vector<bool> dup( nbr_games, false );   // indexed by position in the database
+    int nbr_deleted=0;
+    if( !spill_error )
+    {
+        std::string desc("Duplicate Removal - merging sorted runs");
+        printf( "%s\n", desc.c_str() );
+        ProgressBar progress_bar( dup_title, desc, true, window );
+        progress_bar.DrawNow();
+        fflush( spill_games );
+        fflush( spill_runs );
+        size_t nbr_runs = spill_run_offsets.size();
+        spill_run_offsets.push_back( spill_runs_posn );
+        size_t buf_size = static_cast<size_t>( spill_cap / (2*nbr_runs) );
+        if( buf_size > 1024*1024 )
+            buf_size = 1024*1024;
+        if( buf_size < 4096 )
+            buf_size = 4096;
+        uint32_t hdr_len = bin_db_control_blocks[bin_db_append_cb_idx].bb.FrozenSize();
+        std::vector<SpillRunReader> runs( nbr_runs );
+        SpillRunCompare compare;
+        compare.runs = &runs;
+        std::vector<int> heap;
+        for( size_t i=0; i<nbr_runs; i++ )
+        {
+            runs[i].Init( spill_run_offsets[i], spill_run_offsets[i+1], buf_size, hdr_len );
+            if( runs[i].Next() )
+                heap.push_back( static_cast<int>(i) );
+        }
+        std::make_heap( heap.begin(), heap.end(), compare );
+        std::vector< smart_ptr<ListableGame> > group;
+        uint32_t nbr_merged = 0;
+        while( heap.size() > 0 && !spill_error )
+        {
+            if( (nbr_merged%1024)==0 && progress_bar.Perfraction(nbr_merged,nbr_games) )
+            {
+                SpillEnd();
+                return false;   // abort
+            }
+            nbr_merged++;
+            std::pop_heap( heap.begin(), heap.end(), compare );
+            SpillRunReader &r = runs[heap.back()];
+            ListableGameBinDb gb( bin_db_append_cb_idx, SpillReorder(r.seq), r.fields );
+            make_smart_ptr( ListableGameBinDb, new_gb, gb );
+            group.push_back( std::move(new_gb) );
+            if( r.Next() )
+                std::push_heap( heap.begin(), heap.end(), compare );
+            else
+                heap.pop_back();
+
+            // End of a group of games with the same moves?
+            if( heap.size()==0 || 0!=strcmp(runs[heap.front()].Moves(),group[0]->CompressedMoves()) )
+            {
+                if( group.size() > 1 )
+                    SpillDupDetect( group, dup );
+                group.clear();
+            }
+        }
+        for( uint32_t i=0; i<nbr_games; i++ )
+        {
+            if( dup[i] )
+                nbr_deleted++;
+        }
+    }
+    if( spill_error )
+    {
+        printf( "Error: Cannot read or write temporary files %s.spill1 and .spill2\n", spill_base.c_str() );
+        SpillEnd();
+        return false;
+    }
+    printf( "Duplicate Removal complete - %d duplicates removed\n", nbr_deleted );
+    if( ofile )
+    {
+        std::string desc("Writing file");
+        printf( "%s\n", desc.c_str() );
+        ProgressBar progress_bar( write_title, desc, true, window );
+        WriteOutSpilled src( dup );
+        ok = WriteOut( ofile, nbr_games-nbr_deleted, src, locked, &progress_bar );
+    }
+    if( ok && nbr_deleted && generate_dup_pgn_file )
+    {
+        FILE *pgn_dup = fopen("TarraschDbDuplicatesFile.pgn","wb");
+        if( pgn_dup )
+        {
+            std::string desc("Saving duplicates to TarraschDbDuplicatesFile.pgn");
+            printf( "%s\n", desc.c_str() );
+            ProgressBar progress_bar(optional_title, desc, true, window);
+            SpillGamesReader reader;
+            int nbr_saved = 0;
+            for( uint32_t i=0; i<nbr_games; i++ )
+            {
+                if( !dup[i] )
+                    continue;
+                ListableGameBinDb gb( bin_db_append_cb_idx, i, reader.Read(SpillReorder(i)) );
+                GameDocument  the_game;
+                CompactGame pact;
+                gb.GetCompactGame( pact );
+                pact.Upscale(the_game);
+                std::string str;
+                the_game.ToFileTxtGameDetails( str );
+                fwrite(str.c_str(),1,str.length(),pgn_dup);
+                the_game.ToFileTxtGameBody( str );
+                fwrite(str.c_str(),1,str.length(),pgn_dup);
+                if( progress_bar.Perfraction( ++nbr_saved, nbr_deleted ) )
+                    break;
+            }
+            fclose(pgn_dup);
+        }
+        cprintf( "Number of duplicates deleted: %d\n", nbr_deleted );
+    }
+    ok = ok && !spill_error;
+    SpillEnd();
+    return ok;
+}
+
 void ReadStrings( FILE *fin, int nbr_strings, std::vector<std::string> &strings )
 {
     for( int i=0; i<nbr_strings; i++ )
@@ -1784,10 +2547,12 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
     int hdr_len = fh.hdr_len;   // future compatibility feature - if FileHeader gets longer so will fh.hdr_len
-    if( hdr_len >= sizeof(FileHeader) )  // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
-    {                                    //  databases of that version have a smaller header without lockable
-        locked = static_cast<bool>(fh.locked);
+    if( 0<=hdr_len && hdr_len<sizeof(FileHeader) )  // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
+    {                                               //  databases of that version have a smaller header without lockable, and
+                                                    //  databases that predate the FileFooter don't have footer_len
+        memset( reinterpret_cast<char *>(&fh)+hdr_len, 0, sizeof(FileHeader)-hdr_len );
     }
+    locked = static_cast<bool>(fh.locked);
     if( hdr_len != sizeof(FileHeader) )
     {
         fseek(fin,compatibility_header_size+hdr_len,SEEK_SET);  // if necessary skip to a different point than
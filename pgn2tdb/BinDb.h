@@ -21,20 +21,43 @@ bool bin_db_append( const char *fen, const char *event, const char *site, const
                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
                   int nbr_moves, thc::Move *moves );
 
+// A game read from a .pgn, checked and compressed but not yet added to the games array, so
+//  that the reading and compressing can be spread across threads (see PgnPipeline.h)
+struct BinDbPendingGame
+{
+    std::string event;
+    std::string site;
+    std::string white;
+    std::string black;
+    uint32_t    date;
+    uint16_t    round;
+    uint8_t     result;
+    uint16_t    eco;
+    uint16_t    white_elo;
+    uint16_t    black_elo;
+    std::string compressed_moves;
+};
+bool BinDbPrepareGame( const char *fen, const char *event, const char *site, const char *date, const char *round,
+                  const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
+                  int nbr_moves, thc::Move *moves, BinDbPendingGame &pg );
+void BinDbAppendPrepared( BinDbPendingGame &pg );
+
 bool TestBinaryBlock();
 void BinDbCreationEnd();
 uint8_t BinDbReadBegin();
 uint32_t BinDbGetGamesSize();
 void BinDbNormaliseOrder( uint32_t begin, uint32_t end );
+void BinDbSetMemoryCap( uint32_t cap_mb, const std::string &temp_base );
 bool BinDbRemoveDuplicatesAndWrite( bool generate_dup_pgn_file, std::string &title, int step, FILE *ofile, bool locked, wxWindow *window );
 bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, ProgressBar *pb=NULL );
 bool PgnStateMachine( FILE *pgn_file, int &typ, char *buf, int buflen );
 
-void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_pgn_file=false );
+void Pgn2Tdb( std::vector<std::string> fin, std::string fout, bool generate_dup_pgn_file=false, bool build_position_index=false, int nbr_threads=0, uint32_t memory_cap_mb=0 );
 void Tdb2Pgn( const char *infile, const char *outfile );
 void Tdb2Pgn( FILE *fin, FILE *fout );
 
 int BitsRequired( int max );
 void ReadStrings( FILE *fin, int nbr_strings, std::vector<std::string> &strings );
+uint32_t Crc32( uint32_t crc, const void *buf, size_t len );
 
 #endif  // BINDB_H
@@ -0,0 +1,84 @@
+/****************************************************************************
+ * BinDbMappedFile - Read only memory mapping of BinDb files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef BINDB_MAPPED_FILE_H
+#define BINDB_MAPPED_FILE_H
+#include <stdio.h>
+#include <stdint.h>
+#include "Portability.h"
+#ifdef THC_WINDOWS
+#include <windows.h>    // for CreateFileMapping() etc.
+#include <io.h>         // for _get_osfhandle()
+#else
+#include <sys/mman.h>   // for mmap()
+#include <sys/stat.h>   // for fstat()
+#endif
+
+// A read only memory mapping of a complete .tdb file. BinDbLoadAllGames() builds games
+//  that point straight into the mapping rather than copying each game into a std::string.
+//  Ownership passes to the control block used by those games, so the mapping is released
+//  when that control block is recycled. The optional .tdi position index (see PositionIndex.h)
+//  is mapped the same way
+class BinDbMappedFile
+{
+public:
+    const char *base;
+    uint64_t    len;
+
+    BinDbMappedFile() { base=NULL; len=0; }
+    ~BinDbMappedFile() { Unmap(); }
+
+    // Return bool ok
+    bool Map( FILE *f )
+    {
+        Unmap();
+        if( !f )
+            return false;
+#ifdef THC_WINDOWS
+        HANDLE hfile = reinterpret_cast<HANDLE>( _get_osfhandle(_fileno(f)) );
+        if( hfile == INVALID_HANDLE_VALUE )
+            return false;
+        LARGE_INTEGER sz;
+        if( !GetFileSizeEx(hfile,&sz) || sz.QuadPart==0 || static_cast<uint64_t>(sz.QuadPart) > static_cast<uint64_t>(SIZE_MAX) )
+            return false;
+        HANDLE hmap = CreateFileMapping( hfile, NULL, PAGE_READONLY, 0, 0, NULL );
+        if( hmap == NULL )
+            return false;
+        void *p = MapViewOfFile( hmap, FILE_MAP_READ, 0, 0, 0 );
+        CloseHandle(hmap);  // the view keeps the mapping alive
+        if( p == NULL )
+            return false;
+        len = static_cast<uint64_t>(sz.QuadPart);
+#else
+        struct stat st;
+        int fd = fileno(f);
+        if( fstat(fd,&st)!=0 || st.st_size==0 || static_cast<uint64_t>(st.st_size) > static_cast<uint64_t>(SIZE_MAX) )
+            return false;
+        void *p = mmap( NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( p == MAP_FAILED )
+            return false;
+        len = static_cast<uint64_t>(st.st_size);
+#endif
+        base = static_cast<const char *>(p);
+        return true;
+    }
+
+    void Unmap()
+    {
+        if( base )
+        {
+#ifdef THC_WINDOWS
+            UnmapViewOfFile( base );
+#else
+            munmap( const_cast<char *>(base), static_cast<size_t>(len) );
+#endif
+        }
+        base = NULL;
+        len  = 0;
+    }
+};
+
+#endif  // BINDB_MAPPED_FILE_H
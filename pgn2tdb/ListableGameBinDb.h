@@ -25,6 +25,14 @@ public:
         CalculatePromotionAttribute();
     }
 
+    // Point straight into a memory mapped .tdb file, no copying
+    ListableGameBinDb( int cb_idx, uint32_t game_id, const char *mapped_game )
+        : pack( cb_idx, mapped_game )
+    {
+        this->game_id = game_id;
+        CalculatePromotionAttribute();
+    }
+
     ListableGameBinDb(
         uint8_t cb_idx,
         uint32_t game_id,
@@ -9,9 +9,12 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include "CompactGame.h"
 #include "BinaryBlock.h"
 
+class BinDbMappedFile;
+
 struct PackedGameBinDbControlBlock
 {
     BinaryBlock bb;
@@ -21,6 +24,15 @@ struct PackedGameBinDbControlBlock
     std::map<std::string,int> map_players;
     std::map<std::string,int> map_events;
     std::map<std::string,int> map_sites;
+
+    // True if players, events and sites are each in strcmp() order, so the ids in the games
+    //  sort the same way as the strings (see FOOTER_FLAG_STRINGS_SORTED in BinDb.cpp)
+    bool strings_sorted;
+    PackedGameBinDbControlBlock() { strings_sorted=false; }
+
+    // If the games using this control block were loaded straight from a memory mapped
+    //  .tdb file, they point into the mapping, which must live as long as they do
+    std::shared_ptr<BinDbMappedFile> mapped_file;
 };
 
 extern std::vector<PackedGameBinDbControlBlock> bin_db_control_blocks;
@@ -30,6 +42,8 @@ class PackedGameBinDb
 private:
     uint8_t     cb_idx;     // control block idx
     std::string fields;
+    const char *mapped_fields;  // if not NULL, use these fields (in a memory mapped file) instead
+    const char *Fields() const { return mapped_fields ? mapped_fields : fields.c_str(); }
 
 public:
     uint8_t     GetControlBlockIdx() { return cb_idx; }
@@ -37,11 +51,15 @@ public:
     static bool RequestRecycle( int cb_idx );
     static PackedGameBinDbControlBlock& GetControlBlock(int cb_idx);
 
-    bool Empty() { return fields.size() == 0; }
-    PackedGameBinDb() {}
+    bool Empty() { return fields.size()==0 && mapped_fields==NULL; }
+    PackedGameBinDb() { mapped_fields=NULL; }
 
     // Create a PackedGameBinDb from binary data read from a .tdb file
-    PackedGameBinDb( uint8_t cb_idx, std::string fields ) { this->cb_idx=cb_idx; this->fields=fields; }
+    PackedGameBinDb( uint8_t cb_idx, std::string fields ) { this->cb_idx=cb_idx; this->fields=fields; mapped_fields=NULL; }
+
+    // Create a PackedGameBinDb that points at binary data in a memory mapped .tdb file, the
+    //  mapping is kept alive by the control block (see PackedGameBinDbControlBlock::mapped_file)
+    PackedGameBinDb( uint8_t cb_idx, const char *mapped_fields ) { this->cb_idx=cb_idx; this->mapped_fields=mapped_fields; }
 
     // Create a PackedGameBinDb from game data
     PackedGameBinDb(
@@ -80,18 +98,18 @@ public:
     {
         PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
         int sz = cb->bb.FrozenSize();
-        return fields.c_str() + sz;
+        return Fields() + sz;
     }
-    int EventBin()    { return bin_db_control_blocks[cb_idx].bb.Read(0,&fields[0]); }
-    int SiteBin()     { return bin_db_control_blocks[cb_idx].bb.Read(1,&fields[0]); }
-    int WhiteBin()    { return bin_db_control_blocks[cb_idx].bb.Read(2,&fields[0]); }
-    int BlackBin()    { return bin_db_control_blocks[cb_idx].bb.Read(3,&fields[0]); }
-    int DateBin()     { return bin_db_control_blocks[cb_idx].bb.Read(4,&fields[0]); }
-    int RoundBin()    { return bin_db_control_blocks[cb_idx].bb.Read(5,&fields[0]); }
-    int EcoBin()      { return bin_db_control_blocks[cb_idx].bb.Read(6,&fields[0]); }
-    int ResultBin()   { return bin_db_control_blocks[cb_idx].bb.Read(7,&fields[0]); }
-    int WhiteEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(8,&fields[0]); }
-    int BlackEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(9,&fields[0]); }
+    int EventBin()    { return bin_db_control_blocks[cb_idx].bb.Read(0,Fields()); }
+    int SiteBin()     { return bin_db_control_blocks[cb_idx].bb.Read(1,Fields()); }
+    int WhiteBin()    { return bin_db_control_blocks[cb_idx].bb.Read(2,Fields()); }
+    int BlackBin()    { return bin_db_control_blocks[cb_idx].bb.Read(3,Fields()); }
+    int DateBin()     { return bin_db_control_blocks[cb_idx].bb.Read(4,Fields()); }
+    int RoundBin()    { return bin_db_control_blocks[cb_idx].bb.Read(5,Fields()); }
+    int EcoBin()      { return bin_db_control_blocks[cb_idx].bb.Read(6,Fields()); }
+    int ResultBin()   { return bin_db_control_blocks[cb_idx].bb.Read(7,Fields()); }
+    int WhiteEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(8,Fields()); }
+    int BlackEloBin() { return bin_db_control_blocks[cb_idx].bb.Read(9,Fields()); }
 };
 
 #endif // PACKED_GAME_BIN_DB_H
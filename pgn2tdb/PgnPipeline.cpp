@@ -0,0 +1,219 @@
+/****************************************************************************
+ * PgnPipeline - Read a .pgn file into the games array on all cores
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <thread>
+#include <system_error>
+#include "DebugPrintf.h"
+#include "PgnRead.h"
+#include "PgnPipeline.h"
+
+PgnPipeline::PgnPipeline( int nbr_threads, ProgressBar *pb )
+{
+    if( nbr_threads <= 0 )
+        nbr_threads = std::thread::hardware_concurrency();
+    if( nbr_threads <= 0 )
+        nbr_threads = 2;
+    this->nbr_threads = nbr_threads;
+    this->pb = pb;
+    max_in_flight = 0;
+    nbr_in_flight = 0;
+    nbr_chunks = 0;
+    reader_done = false;
+    abort = false;
+}
+
+// Returns true if aborted
+bool PgnPipeline::Process( FILE *infile )
+{
+    // Start the workers, then the reader. If we can't, do it the old way
+    std::vector<std::thread> threads;
+    for( int i=0; i<nbr_threads; i++ )
+    {
+        try
+        {
+            threads.push_back( std::thread(&PgnPipeline::Worker,this) );
+        }
+        catch( std::system_error & )
+        {
+            break;
+        }
+    }
+    max_in_flight = threads.size() * PGN_PIPELINE_CHUNKS_PER_THREAD;
+    bool started = false;
+    if( threads.size() > 0 )
+    {
+        try
+        {
+            threads.push_back( std::thread(&PgnPipeline::Reader,this,infile) );
+            started = true;
+        }
+        catch( std::system_error & )
+        {
+        }
+    }
+    if( !started )
+    {
+        Abort();
+        for( size_t i=0; i<threads.size(); i++ )
+            threads[i].join();
+        PgnRead pgn('B',pb);
+        return pgn.Process(infile);
+    }
+    cprintf( "Reading .pgn with %d worker threads\n", static_cast<int>(threads.size()-1) );
+
+    // Add the games to the games array in file order, as chunks become available
+    bool aborted = false;
+    uint32_t nbr_games = 0;
+    for( uint32_t next_seq=0; !aborted; next_seq++ )
+    {
+        std::unique_ptr<CHUNK> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            while( parsed.count(next_seq)==0 && !(reader_done && next_seq>=nbr_chunks) )
+                cv_parsed.wait(lock);
+            if( parsed.count(next_seq) == 0 )
+                break;  // all done
+            chunk = std::move( parsed[next_seq] );
+            parsed.erase( next_seq );
+            nbr_in_flight--;
+        }
+        cv_room.notify_one();
+        for( size_t i=0; i<chunk->prepared.size(); i++ )
+            BinDbAppendPrepared( chunk->prepared[i] );
+        for( uint32_t i=0; !aborted && i<chunk->nbr_games; i++ )
+            aborted = (pb && pb->ProgressFile());
+        nbr_games += chunk->nbr_games;
+    }
+    if( aborted )
+        Abort();
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+    cprintf( "Finished %u total games\n", nbr_games );
+    return aborted;
+}
+
+void PgnPipeline::Abort()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        abort = true;
+    }
+    cv_to_parse.notify_all();
+    cv_parsed.notify_all();
+    cv_room.notify_all();
+}
+
+// Split the file into games exactly as PgnRead::Process() does
+void PgnPipeline::Reader( FILE *infile )
+{
+    int typ;
+    char buf[2048];
+    uint32_t seq = 0;
+    std::unique_ptr<CHUNK> chunk( new CHUNK );
+    GAME_TEXT game;
+    bool ok = true;
+    bool done = PgnStateMachine( NULL, typ,  buf, sizeof(buf) );
+    while( ok && !done )
+    {
+        done = PgnStateMachine( infile, typ,  buf, sizeof(buf) );
+        switch( typ )
+        {
+            default:
+            {
+                break;
+            }
+            case 'T':
+            case 't':
+            {
+                game.tag_lines.push_back( std::string(buf) );
+                break;
+            }
+            case 'M':
+            case 'm':
+            {
+                game.moves += std::string(buf);
+                game.moves += '\n';
+                break;
+            }
+            case 'G':
+            {
+                chunk->games.push_back( std::move(game) );
+                game.tag_lines.clear();
+                game.moves.clear();
+                if( chunk->games.size() >= PGN_PIPELINE_CHUNK )
+                {
+                    chunk->seq = seq++;
+                    ok = HandOut( chunk );
+                    chunk.reset( new CHUNK );
+                }
+                break;
+            }
+        }
+    }
+    if( ok && chunk->games.size() > 0 )
+    {
+        chunk->seq = seq++;
+        ok = HandOut( chunk );
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        nbr_chunks = seq;
+        reader_done = true;
+    }
+    cv_to_parse.notify_all();
+    cv_parsed.notify_all();
+}
+
+// Pass a chunk from the reader to the workers, waiting for room if necessary. Returns
+//  false if aborted
+bool PgnPipeline::HandOut( std::unique_ptr<CHUNK> &chunk )
+{
+    chunk->nbr_games = chunk->games.size();
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while( nbr_in_flight>=max_in_flight && !abort )
+            cv_room.wait(lock);
+        if( abort )
+            return false;
+        nbr_in_flight++;
+        to_parse.push_back( std::move(chunk) );
+    }
+    cv_to_parse.notify_one();
+    return true;
+}
+
+// Parse and compress chunks of games, until there are no more
+void PgnPipeline::Worker()
+{
+    std::unique_ptr<PgnRead> pgn( new PgnRead('B') );  // big, so not on the thread's stack
+    for(;;)
+    {
+        std::unique_ptr<CHUNK> chunk;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            while( to_parse.empty() && !reader_done && !abort )
+                cv_to_parse.wait(lock);
+            if( abort || to_parse.empty() )
+                break;
+            chunk = std::move( to_parse.front() );
+            to_parse.pop_front();
+        }
+        for( size_t i=0; i<chunk->games.size(); i++ )
+        {
+            GAME_TEXT &game = chunk->games[i];
+            BinDbPendingGame pg;
+            if( pgn->ParseGame( game.tag_lines, game.moves, pg ) )
+                chunk->prepared.push_back( std::move(pg) );
+        }
+        std::vector<GAME_TEXT>().swap( chunk->games );
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            uint32_t seq = chunk->seq;
+            parsed[seq] = std::move(chunk);
+        }
+        cv_parsed.notify_one();
+    }
+}
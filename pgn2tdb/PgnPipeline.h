@@ -0,0 +1,77 @@
+/****************************************************************************
+ * PgnPipeline - Read a .pgn file into the games array on all cores
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGN_PIPELINE_H
+#define PGN_PIPELINE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "ProgressBar.h"
+#include "BinDb.h"
+
+// Does the same job as PgnRead('B').Process(), with exactly the same result, in four stages;
+//  1) A reader thread splits the file into games with PgnStateMachine(), and hands them out
+//     in chunks of PGN_PIPELINE_CHUNK games
+//  2) Worker threads, each with its own PgnRead, parse the games of a chunk (checking every
+//     move) and compress them, see PgnRead::ParseGame()
+//  3) Parsed chunks are put back into file order
+//  4) The calling thread adds the games to the games array, see BinDbAppendPrepared()
+//  No more than PGN_PIPELINE_CHUNKS_PER_THREAD chunks per worker are in the pipeline at
+//  once, so memory use doesn't depend on the size of the file
+#define PGN_PIPELINE_CHUNK 1000
+#define PGN_PIPELINE_CHUNKS_PER_THREAD 4
+
+class PgnPipeline
+{
+public:
+    PgnPipeline( int nbr_threads=0, ProgressBar *pb=0 );   // nbr_threads 0 means one per core
+
+    // Returns true if aborted
+    bool Process( FILE *infile );
+
+private:
+    int nbr_threads;
+    ProgressBar *pb;
+
+    struct GAME_TEXT
+    {
+        std::vector<std::string> tag_lines;
+        std::string moves;
+    };
+    struct CHUNK
+    {
+        uint32_t seq;                               // position in the file
+        uint32_t nbr_games;
+        std::vector<GAME_TEXT> games;               // from the reader
+        std::vector<BinDbPendingGame> prepared;     // from a worker, the games to add
+    };
+
+    // Shared by all stages, protected by mtx
+    std::mutex mtx;
+    std::condition_variable cv_to_parse;    // workers wait for chunks
+    std::condition_variable cv_parsed;      // the merge waits for the next chunk in order
+    std::condition_variable cv_room;        // the reader waits for room in the pipeline
+    std::deque< std::unique_ptr<CHUNK> > to_parse;
+    std::map< uint32_t, std::unique_ptr<CHUNK> > parsed;
+    uint32_t max_in_flight;
+    uint32_t nbr_in_flight;
+    uint32_t nbr_chunks;                    // valid when reader_done
+    bool     reader_done;
+    bool     abort;
+
+    void Reader( FILE *infile );
+    bool HandOut( std::unique_ptr<CHUNK> &chunk );
+    void Worker();
+    void Abort();
+};
+
+#endif // PGN_PIPELINE_H
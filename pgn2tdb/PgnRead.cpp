@@ -52,6 +52,8 @@ PgnRead::PgnRead( char callback_code, ProgressBar *pb )
     debug_ptr = 0;
     stack_idx = 0;
     memset( stack_array, 0, sizeof(stack_array) );
+    stack_array[0].position = chess_rules;  // as StackReset(), so the first game is like the others
+    nag_value = 0;
 }
 
 const char *PgnRead::ShowState( STATE state )
@@ -204,10 +206,8 @@ bool PgnRead::Process( FILE *infile )
 void PgnRead::GameParse( std::string &str )
 {
     char buf[FIELD_BUFLEN+10];
-    static char comment_buf[10000];
     int ch, comment_ch=0, previous_ch=0, push_back=0, len=0, move_number=0;
     STATE state=MOVE_NUMBER, old_state, save_state=MOVE_NUMBER;
-    static int nag_value;
     int input_len = str.length();
     int idx = 0;
     if( idx < input_len )
@@ -1105,15 +1105,41 @@ bool PgnRead::GameOver()
         s = &stack_array[0];
         const char *pfen = (fen_flag && fen[0]) ? fen : NULL;
         aborted = hook_gameover( callback_code, pfen, event, site, date, round, white, black, result, white_elo, black_elo, eco, s->nbr_moves, s->big_move_array, s->big_hash_array  );
-        stack_idx = 0;
-        thc::ChessRules temp;
-        chess_rules = temp;    // init
-        stack_array[0].nbr_moves = 0;
-        stack_array[0].position = chess_rules;
+        StackReset();
     }
     return aborted;
 }
 
+void PgnRead::StackReset()
+{
+    stack_idx = 0;
+    thc::ChessRules temp;
+    chess_rules = temp;    // init
+    stack_array[0].nbr_moves = 0;
+    stack_array[0].position = chess_rules;
+}
+
+// Parse one game, its tag lines and moves already split out of the file by PgnStateMachine()
+//  on another thread (see PgnPipeline). Rather than calling hook_gameover(), prepare the game
+//  with BinDbPrepareGame(). Returns true if the game should be added to the games array
+bool PgnRead::ParseGame( const std::vector<std::string> &tag_lines, std::string &moves, BinDbPendingGame &pg )
+{
+    char buf[2048];
+    GameBegin();
+    for( size_t i=0; i<tag_lines.size(); i++ )
+    {
+        strncpy( buf, tag_lines[i].c_str(), sizeof(buf)-1 );
+        buf[sizeof(buf)-1] = '\0';
+        Header( buf );
+    }
+    GameParse( moves );
+    STACK_ELEMENT *s = &stack_array[0];
+    const char *pfen = (fen_flag && fen[0]) ? fen : NULL;
+    bool add = BinDbPrepareGame( pfen, event, site, date, round, white, black, result, white_elo, black_elo, eco, s->nbr_moves, s->big_move_array, pg );
+    StackReset();
+    return add;
+}
+
 
 
 PgnRead::STATE PgnRead::Push( PgnRead::STATE in )
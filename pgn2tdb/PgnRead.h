@@ -7,9 +7,11 @@
 #ifndef PGN_READ_H
 #define PGN_READ_H
 #include <vector>
+#include <string>
 #include <algorithm>
 #include "thc.h"
 #include "ProgressBar.h"
+#include "BinDb.h"
 
 #define FIELD_BUFLEN 200
 
@@ -27,6 +29,7 @@ public:
     PgnRead( char callback_code, ProgressBar *pb=0 );
 
     bool Process( FILE *infile );
+    bool ParseGame( const std::vector<std::string> &tag_lines, std::string &moves, BinDbPendingGame &pg );
 
 private:
     char callback_code;
@@ -50,6 +53,8 @@ private:
     char round    [ FIELD_BUFLEN + 10];
 
     char move_order_type[FIELD_BUFLEN + 10];
+    char comment_buf[10000];
+    int  nag_value;
 
     // Misc
     bool fen_flag;
@@ -120,6 +125,7 @@ private:
     void GameBegin();
     void GameParse( std::string &str );
     bool GameOver();
+    void StackReset();
     void FileOver();
     void Error( const char *msg );
 
@@ -0,0 +1,215 @@
+/****************************************************************************
+ * PieceSquareMask - Rule out games quickly, before playing through them
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include "thc.h"
+#include "CompressMoves.h"
+#include "PieceSquareMask.h"
+
+// Pieces 'P','N','B','R','Q','K','p','n','b','r','q','k' are 0-11, -1 if not a piece
+static int PieceIdx( char c )
+{
+    switch( c )
+    {
+        case 'P':   return 0;
+        case 'N':   return 1;
+        case 'B':
+        case 'D':   return 2;   // dark squared bishop convention
+        case 'R':   return 3;
+        case 'Q':   return 4;
+        case 'K':   return 5;
+        case 'p':   return 6;
+        case 'n':   return 7;
+        case 'b':
+        case 'd':   return 8;
+        case 'r':   return 9;
+        case 'q':   return 10;
+        case 'k':   return 11;
+    }
+    return -1;
+}
+static const char *idx_to_piece = "PNBRQKpnbrqk";
+
+// After a move, the square the moved (or promoted) piece has landed on, plus the rook's
+//  square if castling
+static int LandedSquares( thc::Move mv, int &rook_sq )
+{
+    rook_sq = -1;
+    switch( mv.special )
+    {
+        default: break;
+        case thc::SPECIAL_WK_CASTLING:  rook_sq = thc::f1; break;
+        case thc::SPECIAL_WQ_CASTLING:  rook_sq = thc::d1; break;
+        case thc::SPECIAL_BK_CASTLING:  rook_sq = thc::f8; break;
+        case thc::SPECIAL_BQ_CASTLING:  rook_sq = thc::d8; break;
+    }
+    return static_cast<int>(mv.dst);
+}
+
+void PieceSquareMasks::Clear()
+{
+    nbr_combos = 0;
+    memset( piece, 0, sizeof(piece) );
+    memset( square, 0, sizeof(square) );
+    memset( bit, 0, sizeof(bit) );
+}
+
+// Sample about 50000 games
+size_t PieceSquareMasks::SampleStep( size_t nbr_games )
+{
+    const size_t SAMPLE = 50000;
+    return nbr_games>SAMPLE ? nbr_games/SAMPLE : 1;
+}
+
+void PieceSquareMasks::ChooseCombos( std::vector< smart_ptr<ListableGame> > &games, size_t nbr_games, size_t step )
+{
+    const int    PLY_MIN = 4;
+    const int    PLY_MAX = 30;
+    const int    NBR_PLY = PLY_MAX-PLY_MIN+1;
+    Clear();
+    if( step == 0 )
+        step = SampleStep( nbr_games );
+    std::vector<uint32_t> game_count( 12*64, 0 );           // games with the combo
+    std::vector<uint32_t> ply_count( NBR_PLY*12*64, 0 );     // positions with the combo, at each ply
+    uint32_t nbr_games_this_long[NBR_PLY];
+    memset( nbr_games_this_long, 0, sizeof(nbr_games_this_long) );
+    uint32_t nbr_sampled = 0;
+    for( size_t i=0; i<nbr_games; i+=step )
+    {
+        nbr_sampled++;
+        uint64_t hit[12];
+        memset( hit, 0, sizeof(hit) );
+        CompressMoves press;
+        for( int sq=0; sq<64; sq++ )
+        {
+            int idx = PieceIdx( press.cr.squares[sq] );
+            if( idx >= 0 )
+                hit[idx] |= (1ULL<<sq);
+        }
+        const char *blob = games[i]->CompressedMoves();
+        for( int ply=0; *blob; ply++ )
+        {
+            thc::Move mv = press.UncompressMove( *blob++ );
+            int rook_sq;
+            int sq = LandedSquares( mv, rook_sq );
+            int idx = PieceIdx( press.cr.squares[sq] );
+            if( idx >= 0 )
+                hit[idx] |= (1ULL<<sq);
+            if( rook_sq >= 0 )
+                hit[ PieceIdx(press.cr.squares[rook_sq]) ] |= (1ULL<<rook_sq);
+            if( PLY_MIN<=ply && ply<=PLY_MAX )
+            {
+                nbr_games_this_long[ply-PLY_MIN]++;
+                uint32_t *count = &ply_count[ (ply-PLY_MIN)*12*64 ];
+                for( int sq=0; sq<64; sq++ )
+                {
+                    int idx = PieceIdx( press.cr.squares[sq] );
+                    if( idx >= 0 )
+                        count[idx*64+sq]++;
+                }
+            }
+        }
+        for( int idx=0; idx<12; idx++ )
+        {
+            for( int sq=0; sq<64; sq++ )
+            {
+                if( hit[idx] & (1ULL<<sq) )
+                    game_count[idx*64+sq]++;
+            }
+        }
+    }
+
+    // Calculate effectiveness E = S*(1-H) of each combo and keep the best
+    std::vector< std::pair<double,int> > effectiveness;
+    for( int combo=0; nbr_sampled>0 && combo<12*64; combo++ )
+    {
+        double h = static_cast<double>(game_count[combo]) / static_cast<double>(nbr_sampled);
+        double s = 0.0;
+        for( int ply=0; ply<NBR_PLY; ply++ )
+        {
+            if( nbr_games_this_long[ply] > 0 )
+                s += static_cast<double>(ply_count[ply*12*64+combo]) / static_cast<double>(nbr_games_this_long[ply]);
+        }
+        s /= NBR_PLY;
+        double e = s * (1.0-h);
+        if( e > 0.0 )
+            effectiveness.push_back( std::pair<double,int>(-e,combo) );   // sorts best first
+    }
+    std::sort( effectiveness.begin(), effectiveness.end() );
+    uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2];
+    memset( combos, 0, sizeof(combos) );
+    for( size_t i=0; i<effectiveness.size() && i<PIECE_SQUARE_NBR_COMBOS; i++ )
+    {
+        int combo = effectiveness[i].second;
+        combos[i*2]   = idx_to_piece[combo/64];
+        combos[i*2+1] = static_cast<uint8_t>(combo%64);
+    }
+    SetCombos( combos );
+}
+
+void PieceSquareMasks::GetCombos( uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2] ) const
+{
+    for( int i=0; i<PIECE_SQUARE_NBR_COMBOS; i++ )
+    {
+        combos[i*2]   = static_cast<uint8_t>(piece[i]);
+        combos[i*2+1] = square[i];
+    }
+}
+
+void PieceSquareMasks::SetCombos( const uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2] )
+{
+    Clear();
+    for( int i=0; i<PIECE_SQUARE_NBR_COMBOS; i++ )
+    {
+        char c     = static_cast<char>(combos[i*2]);
+        uint8_t sq = combos[i*2+1];
+        int idx = PieceIdx(c);
+        if( c=='\0' || idx<0 || c=='D' || c=='d' || sq>=64 || bit[idx][sq]!=0 )
+            break;  // unused, or not a valid combo
+        piece[i]  = c;
+        square[i] = sq;
+        bit[idx][sq] = (1ULL<<i);
+        nbr_combos++;
+    }
+}
+
+uint64_t PieceSquareMasks::GameMask( const char *blob ) const
+{
+    if( nbr_combos == 0 )
+        return 0;
+    CompressMoves press;
+    uint64_t mask = PositionMask( press.cr.squares );
+    while( *blob )
+    {
+        thc::Move mv = press.UncompressMove( *blob++ );
+        int rook_sq;
+        int sq = LandedSquares( mv, rook_sq );
+        int idx = PieceIdx( press.cr.squares[sq] );
+        if( idx >= 0 )
+            mask |= bit[idx][sq];
+        if( rook_sq >= 0 )
+        {
+            idx = PieceIdx( press.cr.squares[rook_sq] );
+            if( idx >= 0 )
+                mask |= bit[idx][rook_sq];
+        }
+    }
+    return mask;
+}
+
+uint64_t PieceSquareMasks::PositionMask( const char *squares ) const
+{
+    uint64_t mask = 0;
+    for( int sq=0; nbr_combos>0 && sq<64; sq++ )
+    {
+        int idx = PieceIdx( squares[sq] );
+        if( idx >= 0 )
+            mask |= bit[idx][sq];
+    }
+    return mask;
+}
@@ -0,0 +1,67 @@
+/****************************************************************************
+ * PositionIndex - Optional persistent index of the positions in a .tdb file
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITION_INDEX_H
+#define POSITION_INDEX_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ProgressBar.h"
+#include "ListableGame.h"
+
+// The index lives in a .tdi file next to the .tdb file. It maps the 64 bit hash of a
+//  position (thc::ChessPosition::Hash64Calculate()) to a sorted list of the games that
+//  reach the position and the ply at which they first do so. Not every position is indexed,
+//  only positions reached early (within POSITION_INDEX_MAX_PLY ply) by at least
+//  POSITION_INDEX_MIN_GAMES games, the opening positions that the database dialog
+//  spends most of its time on. For an indexed position though the list is complete, it
+//  includes games that reach the position by transposition at any ply. A hit is only as
+//  good as the hash though, so searches confirm it against the game itself. Every game is
+//  assumed to start from the initial position, which is true of .tdb files (games with a
+//  FEN are never written to them). Games with a FEN from any other source always get the
+//  full search
+#define POSITION_INDEX_MAX_PLY   20
+#define POSITION_INDEX_MIN_GAMES 2
+
+class BinDbMappedFile;
+struct PositionIndexKey;
+
+// One game that reaches an indexed position
+struct PositionIndexPosting
+{
+    uint32_t game_idx;          // 0 for the first game in the .tdb file, 1 for the second etc.
+    unsigned short ply;         // the ply the position is first reached, same as DoSearchFoundGame offset_first
+};
+
+class PositionIndex
+{
+public:
+    PositionIndex() { keys=NULL; postings=NULL; nbr_keys=0; nbr_postings=0; nbr_games=0; }
+    static std::string Filename( const std::string &db_filename );
+    bool Open( const std::string &db_filename );
+    void Close();
+    bool IsOpen()  { return keys != NULL; }
+
+    // The index covers the first NbrGamesCovered() games in the .tdb file
+    uint32_t NbrGamesCovered() { return nbr_games; }
+
+    // Return false if the position isn't indexed, otherwise return true with the games (if any)
+    //  that reach the position with the given side to move
+    bool Lookup( uint64_t hash, bool white, std::vector<PositionIndexPosting> &found );
+
+private:
+    smart_ptr<BinDbMappedFile> mapped_file;
+    const PositionIndexKey *keys;
+    const uint64_t *postings;
+    uint64_t nbr_keys;
+    uint64_t nbr_postings;
+    uint32_t nbr_games;
+};
+
+// Build the index for a .tdb file just written from games (which must be in .tdb file order)
+bool PositionIndexBuild( const std::string &db_filename, std::vector< smart_ptr<ListableGame> > &games, ProgressBar *pb=NULL );
+
+#endif  // POSITION_INDEX_H
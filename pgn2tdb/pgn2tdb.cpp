@@ -34,6 +34,9 @@ int main( int argc, const char *argv[] )
     bool elo_cutoff_pass_before = false;
     int  elo_cutoff_before_year = 1990;
     bool generate_dup_pgn_file = false;
+    bool build_position_index = false;
+    int  nbr_threads = 0;
+    int  memory_cap_mb = 0;
 #ifdef _DEBUG
     const char *test_args[] =
     {
@@ -62,7 +65,9 @@ int main( int argc, const char *argv[] )
             }
             //if( arg == "-g" )
             //    generate_dup_pgn_file = true;
-            if( arg == "-ufail" )
+            if( arg == "-i" )
+                build_position_index = true;
+            else if( arg == "-ufail" )
                 elo_cutoff_fail = true;
             else if( arg == "-upass" )
                 elo_cutoff_pass = true;
@@ -80,6 +85,16 @@ int main( int argc, const char *argv[] )
                     }
                 }
             }
+            else if( util::prefix(arg,"-j") )
+            {
+                nbr_threads = atoi( arg.substr(2).c_str() );
+                ok = (nbr_threads > 0);
+            }
+            else if( util::prefix(arg,"-m") )
+            {
+                memory_cap_mb = atoi( arg.substr(2).c_str() );
+                ok = (memory_cap_mb > 0);
+            }
             else if( util::prefix(arg,"-e") )
             {
                 ok = false;
@@ -125,6 +140,11 @@ int main( int argc, const char *argv[] )
             printf( "Unrated year cutoff specified, without specifying a Elo cutoff\n" );
             ok = false;
         }
+        else if( memory_cap_mb>0 && build_position_index )
+        {
+            printf( "A position index needs all games in memory, so -i can't be used with -m\n" );
+            ok = false;
+        }
     }
     if( ok )
     {
@@ -152,7 +172,11 @@ int main( int argc, const char *argv[] )
     {
         printf( "pgn2tdb V1.00 - Generate Tarrash database files from the command line\n" );
         printf( " Published by Bill Forster, https://github.com/billforsternz/tarrasch-chess-gui\n" );
-        printf( "Usage: pgn2tdb [-g] [-e2000] [-ufail|-upass|u1990] pgnfiles tdbfile\n" );
+        printf( "Usage: pgn2tdb [-g] [-i] [-j4] [-m1024] [-e2000] [-ufail|-upass|u1990] pgnfiles tdbfile\n" );
+        printf( " -i       Also generate a position index (.tdi file) for fast position searches\n" );
+        printf( " -j4      Read the pgnfiles with 4 threads (for example), the default is one per core\n" );
+        printf( " -m1024   Keep no more than 1024 megabytes (for example) of games in memory, spilling the\n" );
+        printf( "          rest to temporary files alongside tdbfile, for very large databases\n" );
         printf( " -e2000   Set Elo rating cutoff (at least one player) to 2000 (for example)\n" );
         printf( " -b2000   Set Elo rating cutoff (both players) to 2000 (for example)\n" );
         printf( " -upass   Unrated players pass cutoff (the default)\n" );
@@ -174,7 +198,7 @@ int main( int argc, const char *argv[] )
     shim_app_begin();
     extern void compress_temp_lookup_gen_function();
     compress_temp_lookup_gen_function();
-    Pgn2Tdb( fin, fout, generate_dup_pgn_file );
+    Pgn2Tdb( fin, fout, generate_dup_pgn_file, build_position_index, nbr_threads, memory_cap_mb );
     if( objs.repository ) delete objs.repository;
     shim_app_end();
     return 0;
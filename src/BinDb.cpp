@@ -8,9 +8,14 @@
 #include <set>
 #include <map>
 #include <time.h> // time_t
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <system_error>
 #include <stdio.h>
 #include <stdarg.h>
 #include <wx/filename.h>
+#include "BinDbMappedFile.h"
 #include "Objects.h"
 #include "Repository.h"
 #include "CompressMoves.h"
@@ -18,7 +23,14 @@
 #include "CompactGame.h"
 #include "PackedGameBinDb.h"
 #include "ListableGameBinDb.h"
+#include "PieceSquareMask.h"
+#include "HeaderQuery.h"
 #include "BinDb.h"
+#ifdef THC_WINDOWS
+#include <io.h>         // for _chsize_s()
+#else
+#include <unistd.h>     // for ftruncate()
+#endif
 
 /*
 
@@ -32,6 +44,7 @@ Modes of operation
 A) Read a database into the games array (in-memory database) within a Database object
 B) Read a database [for append] and pgn games [create or append] into the local games array
 C) After B) write the local games array out to a new database file
+D) Append pgn games to a database in place, without rewriting it (falls back to B) and C))
 
 Main Functions
 1) bool    BinDbOpen( const char *db_file, std::string &error_msg )
@@ -47,6 +60,9 @@ Main Functions
     In case B) we don't reverse - because we are going to append more older to newer games from pgn (game_id isn't actually important we
     now establish a contiguous range of game_ids in BinDbRemoveDuplicatesAndWrite() because it improves ordering before write)
     Returns bool killed, if killed array is not fully loaded
+    The file is memory mapped, the game records are found (using the FileFooter offset table
+    if there is one, otherwise with a quick first pass) and then they are decoded on all cores. In case A) the games point into the mapping (no copying), in case B)
+    each game is translated into its own std::string. If the mapping fails, read the file instead
 4) void BinDbClose()
     Closes database file after reading in 3)
 
@@ -64,6 +80,9 @@ The following are not needed for A) only for B) and C)
     Now only called by BinDbRemoveDuplicatesAndWrite()
 9) void BinDbCreationEnd()
     clears internal games vector
+10) bool BinDbAppendInPlace( const char *db_file, const std::string *pgn_files, int nbr_pgn_files, const std::string &title,
+                            bool &in_place, std::string &error_msg, wxWindow *window )
+    Case D), the new games are written as an extension after the end of the file, which A) and B) merge transparently
 */
 
 static uint32_t game_id_bottom = 1; // reserve 0 as a special value
@@ -97,6 +116,10 @@ uint32_t GameIdAllocateBottom(uint32_t count)
 
 static FILE         *bin_file;      //temp
 
+// The piece square masks of the database most recently loaded for searching, from its FileFooter
+static PieceSquareMasks      piece_square_masks;
+static std::vector<uint64_t> piece_square_game_masks;
+
 // The 1200 byte compatibility header - Prepended to a BinDb formatted database file
 //  It makes such a file partially compatible to the original versions of TarraschDb
 //  which expect a sqlite file - well compatible enough to read the version number and
@@ -277,6 +300,7 @@ void BinDbClose()
 void Test()
 {
     TestBinaryBlock();
+    TestHeaderQuery();
     //Pgn2Tdb( "test.pgn", "test.tdb" );
     //Tdb2Pgn( "test.tdb", "test-reconstituted.pgn" );
     Pgn2Tdb( "extract.pgn", "extract.tdb" );
@@ -730,8 +754,102 @@ struct FileHeader
     int nbr_sites;
     int nbr_games;
     int locked;         // added with DATABASE_VERSION_NUMBER_LOCKABLE
+    int footer_len;     // added with the FileFooter, sizeof(FileFooter)
+};
+
+// The FileFooter is the last thing in the file. It follows the games and three tables, a
+//  fixed width offset table (allows random access to games and lets the load be split
+//  across threads without first scanning the games), a table of checksums, one for each
+//  GAMES_PER_CHECKSUM games and a piece square table (the PieceSquareMasks combos then a
+//  uint64_t mask for each game, lets searches skip games without playing through them).
+//  Versions that predate the footer read nbr_games games and never look any further, so
+//  they can still read files that have one. Files without a footer have a shorter
+//  FileHeader (see hdr_len) and are read by scanning the games. The footer grows by adding
+//  fields before footer_len and signature, fields missing from a shorter (older) footer
+//  read as zero.
+#define GAMES_PER_CHECKSUM 4096
+#define FILE_FOOTER_MIN_LEN 96  // the original FileFooter, without the piece square table
+#define FILE_FOOTER_MAX_LEN 4096
+
+// Games appended in place (see BinDbAppendInPlace()) go in an extension after the footer,
+//  laid out like the file itself; new players, events and sites strings, the new games,
+//  the tables and a FileFooter with FOOTER_FLAG_EXTENSION. The extension's games use
+//  the file's game header layout, its strings are numbered after the strings before it.
+//  There can be any number of extensions, each footer's prev_len leads back to the one
+//  before, and finally to the file's own footer. Versions that predate extensions find an
+//  extension footer in place of the file's footer, it doesn't check out (eg games_offset is
+//  wrong), so they read the original games by scanning and ignore the extensions
+
+// The file and each extension also have a fingerprint table, the DupFingerprint (see below)
+//  of each of its games, sorted. Appending in place looks up the new games' fingerprints, so
+//  only existing games that might be duplicates of new games are read, rather than all of them
+
+// The players, events and sites strings are each written in strcmp() order, so the string
+//  ids in the game headers are also sort keys. Column sorts in the games dialogs use them
+//  directly, with no string compares (older files are checked when they are loaded instead)
+#define FOOTER_FLAG_STRINGS_SORTED 1
+#define FOOTER_FLAG_EXTENSION      2
+struct FileFooter
+{
+    uint64_t strings_offset;            // file offset and size of the players, events, sites strings
+    uint64_t strings_size;
+    uint64_t games_offset;              // file offset and size of the games
+    uint64_t games_size;
+    uint64_t offset_table_offset;       // nbr_games+1 offsets, relative to games_offset, the last
+    uint64_t offset_table_size;         //  one is games_size
+    uint64_t checksum_table_offset;     // CRC-32 of each GAMES_PER_CHECKSUM games
+    uint64_t checksum_table_size;
+    uint32_t nbr_games;
+    uint32_t offset_width;              // 4 or 8 bytes (8 only if games_size needs it)
+    uint32_t games_per_checksum;
+    uint32_t strings_checksum;          // CRC-32 of the strings
+    uint32_t offset_table_checksum;     // CRC-32 of the offset table
+    uint32_t checksum_table_checksum;   // CRC-32 of the checksum table
+    uint64_t piece_square_table_offset; // PIECE_SQUARE_NBR_COMBOS (piece,square) pairs, then
+    uint64_t piece_square_table_size;   //  nbr_games uint64_t masks
+    uint32_t piece_square_table_checksum;   // CRC-32 of the piece square table
+    uint32_t nbr_piece_square_combos;
+    uint32_t flags;                     // FOOTER_FLAG_xxx
+    uint32_t reserved;
+    uint64_t prev_len;                  // FOOTER_FLAG_EXTENSION only, the file length before
+    uint32_t nbr_players;               //  the extension, and the number of players, events
+    uint32_t nbr_events;                //  and sites strings it adds
+    uint32_t nbr_sites;
+    uint32_t reserved2;
+    uint64_t fingerprint_table_offset;  // nbr_games uint64_t fingerprints in ascending order, then
+    uint64_t fingerprint_table_size;    //  the uint32_t game number (from 0) of each
+    uint32_t fingerprint_table_checksum;    // CRC-32 of the fingerprint table
+    uint32_t fingerprint_version;       // DUP_FINGERPRINT_VERSION, tables of other versions are ignored
+    uint32_t footer_len;                // sizeof(FileFooter), a future compatibility feature
+    char     signature[4];              // "TDBF"
+};
+
+// CRC-32 (the zlib/ethernet polynomial) for the FileFooter checksums, also used by PositionIndex
+struct Crc32Table
+{
+    uint32_t entry[256];
+    Crc32Table()
+    {
+        for( uint32_t i=0; i<256; i++ )
+        {
+            uint32_t c = i;
+            for( int j=0; j<8; j++ )
+                c = (c&1) ? (0xedb88320 ^ (c>>1)) : (c>>1);
+            entry[i] = c;
+        }
+    }
 };
 
+uint32_t Crc32( uint32_t crc, const void *buf, size_t len )
+{
+    static const Crc32Table table;
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    crc = ~crc;
+    while( len-- )
+        crc = table.entry[(crc^*p++) & 0xff] ^ (crc>>8);
+    return ~crc;
+}
+
 bool TestBinaryBlock()
 {
     bool ok;
@@ -1173,15 +1291,6 @@ static bool predicate_sorts_by_id( const smart_ptr<ListableGame> &e1, const smar
     return ret;
 }
 
-static bool predicate_sorts_by_game_moves( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
-{
-    bool ret = std::string(e1->CompressedMoves()) < std::string(e2->CompressedMoves());
-    predicate_count++;
-    if( (predicate_count & 0xffff) == 0 )
-        sort_progress_probe();
-    return ret;
-}
-
 static bool predicate_sorts_by_player( const smart_ptr<ListableGame> &e1, const smart_ptr<ListableGame> &e2 )
 {
     bool ret;
@@ -1225,7 +1334,8 @@ void BinDbShowDebugOrder( const std::vector< smart_ptr<ListableGame> > &gms, con
     }
 }
 
-void BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games_, bool sort_by_player_name )
+// Returns true if the games weren't already sorted (so have been re-ordered)
+bool BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games_, bool sort_by_player_name )
 {
 
     // Usually the database is sorted according to game_id - bail out quickly if no need to sort
@@ -1263,7 +1373,7 @@ void BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games_, b
     }
     cprintf( "%s sorted by %s\n", sorted?"Already":"Not already", sort_by_player_name?"player name":"id" );
     if( sorted )
-        return;
+        return false;
     std::string desc(sort_by_player_name?"Sorting by player name":"Initial sort");
     ProgressBar progress_bar( "Sorting", desc, true );
     //progress_bar.DrawNow();
@@ -1272,6 +1382,7 @@ void BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games_, b
     std::sort( games_.begin(), games_.end(), sort_by_player_name ? predicate_sorts_by_player : predicate_sorts_by_id );
     sort_after();
     BinDbShowDebugOrder( games_, "Initial sort after");
+    return true;
 }
 
 #ifdef DURING_DEVELOPMENT
@@ -1287,8 +1398,63 @@ static void replace_once( std::string &s, const std::string from, const std::str
 #endif
 
 
-// New in V3.01a - incorporate write file so can do that before writing dups to TarraschDbDuplicate.pgn
-bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, bool locked, wxWindow *window )
+// Two games can only be duplicates if they have the same moves, result and year (see
+//  DupDetect()), a 128 bit fingerprint of those three things groups potential duplicates
+//  together without sorting. The players needn't match exactly, so they are left out of
+//  the fingerprint and compared within each group. The low 64 bits are stored in the
+//  FileFooter fingerprint table, so if DupFingerprintCalc() changes, so must the version
+#define DUP_NONE 0xffffffff
+#define DUP_FINGERPRINT_VERSION 1
+struct DupFingerprint
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+static uint64_t DupMix( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void DupFingerprintCalc( const smart_ptr<ListableGame> &p, DupFingerprint &fp )
+{
+    uint64_t lo = 0xcbf29ce484222325ULL;    // FNV-1a
+    uint64_t hi = 0x9e3779b97f4a7c15ULL;    // multiply and rotate
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(p->CompressedMoves());
+    uint64_t len = 0;
+    while( *s )
+    {
+        lo = (lo ^ *s) * 0x100000001b3ULL;
+        hi = (hi ^ *s) * 0x87c37b91114253d5ULL;
+        hi = (hi << 31) | (hi >> 33);
+        s++;
+        len++;
+    }
+    uint64_t year = (p->DateBin()>>9) & 0x3ff;
+    uint64_t extra = (len<<16) | (year<<2) | (p->ResultBin()&3);
+    fp.lo = DupMix( lo ^ extra );
+    fp.hi = DupMix( hi + extra*0x9e3779b97f4a7c15ULL );
+}
+
+static bool predicate_is_not_dup( const smart_ptr<ListableGame> &p )
+{
+    return p->game_id != GAME_ID_SENTINEL;
+}
+
+static bool predicate_sorts_by_fingerprint( const DupFingerprint &fp1, const DupFingerprint &fp2 )
+{
+    return fp1.lo<fp2.lo || (fp1.lo==fp2.lo && fp1.hi<fp2.hi);
+}
+
+// Mark the duplicates in gms (in id order) with id GAME_ID_SENTINEL. Games before first_new
+//  are already in the database, they are never marked, but new games can be duplicates of
+//  them. Return bool ok (false if aborted)
+static bool MarkDuplicates( std::vector< smart_ptr<ListableGame> > &gms, size_t first_new, const std::string &dup_title, wxWindow *window )
 {
 #ifdef  EXTRA_DEDUP_DIAGNOSTIC_FILE
     wxFileName wfn2(objs.repository->log.m_file.c_str());
@@ -1299,186 +1465,204 @@ bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, b
     wxString dups_filename2 = wfn2.GetFullPath();
     FILE *pgn_dup2 = fopen(dups_filename2.c_str(),"wb");
 #endif
-    bool ok=true;
-
-    // Bug fix: V3.01 Establish contiguous id range - if we have assembled multiple files it won't have happened
-    size_t nbr = games.size();
-    uint32_t id = GameIdAllocateTop(nbr);
-    for( size_t i=0; i<nbr; i++ )
-        games[i]->game_id = id++;
-
-    // Last three steps - remove duplicates, write to file, write duplicates to TarraschDbDuplicates.pgn
-    char buf[200];
-    sprintf( buf, "%s, step %d of %d", title.c_str(), step, step+2 );
-    std::string dup_title(buf);
-    sprintf( buf, "%s, step %d of %d", title.c_str(), step+1, step+2 );
-    std::string write_title(buf);
-    sprintf( buf, "%s, step %d of %d", title.c_str(), step+2, step+2 );
-    std::string optional_title(buf);
+    int nbr_games = gms.size();
+    std::vector<uint32_t> next_in_group( nbr_games, DUP_NONE );  // games with the same fingerprint, in id order
+    std::vector<uint32_t> last_in_group( nbr_games, DUP_NONE );  // set for the first game of each group only
     {
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 before");
+        BinDbShowDebugOrder( gms, "Duplicate Removal - phase 1 before");
         std::string desc("Duplicate Removal - phase 1");
         ProgressBar progress_bar( dup_title, desc, true, window );
         progress_bar.DrawNow();
-        sort_before( games.begin(), games.end(), predicate_sorts_by_game_moves, &progress_bar );
-        std::sort( games.begin(), games.end(), predicate_sorts_by_game_moves );
-        sort_after();
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 1 after");
-    }
-    {
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 before");
-        std::string desc("Duplicate Removal - phase 2");
-        ProgressBar progress_bar( dup_title, desc, true, window );
-        progress_bar.DrawNow();
         ProgressBar *pb = &progress_bar;
-        int nbr_games = games.size();
-
-        // State variable - true when traversing duplicates
-        bool in_dups=false;
 
-        // State variable - points to first of group of duplicates
-        int start=0;
-        for( int i=0; i<nbr_games-1; i++ )    // note we stop at second last element
+        // Group games by fingerprint with a hash table, open addressing, at most half full
+        std::vector<DupFingerprint> fingerprints( nbr_games );
+        uint32_t table_size = 1024;
+        while( table_size < 2*static_cast<uint32_t>(nbr_games) )
+            table_size *= 2;
+        std::vector<uint32_t> table( table_size, DUP_NONE );
+        for( int i=0; i<nbr_games; i++ )
         {
             if( pb->Perfraction( i,nbr_games) )
                 return false;   // abort
-
-            // Does this element match the next element? (there's always another element because
-            //  remember we stop at second to last element not last element)
-            bool next_matches = (0 == strcmp(games[i]->CompressedMoves(),games[i+1]->CompressedMoves()) );
-
-            // end will point beyond end of a group of duplicates if we identify such a group this time
-            //  through the loop
-            int end = i;
-
-            // State machine to maintain in_dups and start state variables
-            if( in_dups )
+            DupFingerprint &fp = fingerprints[i];
+            DupFingerprintCalc( gms[i], fp );
+            uint32_t slot = static_cast<uint32_t>(fp.lo) & (table_size-1);
+            for(;;)
             {
-                if( !next_matches )
+                uint32_t first = table[slot];
+                if( first == DUP_NONE )
                 {
-                    in_dups = false;
-                    end = i+1;  // Leaving a group of duplicates, evaluate them
+                    table[slot] = i;
+                    last_in_group[i] = i;
+                    break;
                 }
-            }
-            else
-            {
-                if( next_matches )
+                if( fingerprints[first].lo==fp.lo && fingerprints[first].hi==fp.hi )
                 {
-                    in_dups = true;
-                    start = i;
+                    next_in_group[ last_in_group[first] ] = i;
+                    last_in_group[first] = i;
+                    break;
                 }
+                slot = (slot+1) & (table_size-1);
             }
+        }
+        BinDbShowDebugOrder( gms, "Duplicate Removal - phase 1 after");
+    }
+    {
+        BinDbShowDebugOrder( gms, "Duplicate Removal - phase 2 before");
+        std::string desc("Duplicate Removal - phase 2");
+        ProgressBar progress_bar( dup_title, desc, true, window );
+        progress_bar.DrawNow();
+        ProgressBar *pb = &progress_bar;
+        std::vector<uint32_t> group;
+        for( int i=0; i<nbr_games; i++ )
+        {
+            if( pb->Perfraction( i,nbr_games) )
+                return false;   // abort
 
-            // One special case - a group of duplicates at the end
-            bool last = (i+1 >= nbr_games-1);  // is this the last time thru loop?
-            if( last && in_dups )
-                end = i+2;  // i points at second last element, end should point beyond last element
-
-            // Found a group of (potential) duplicates. So far we only know that the moves are
-            //  identical. We have more work to do to identify the real duplicates. Real duplicates
-            //  are marked with id = GAME_ID_SENTINEL so that they group together when we do a final
-            //  sort by id.
-            if( end > i )
+            // Found a group of (potential) duplicates, the first game of a group with more than
+            //  one game. So far we only know that the moves, result and year are the same. We
+            //  have more work to do to identify the real duplicates. Real duplicates are marked
+            //  with id = GAME_ID_SENTINEL so that they can be moved to the end
+            if( last_in_group[i]==DUP_NONE || next_in_group[i]==DUP_NONE )
+                continue;
+            group.clear();
+            for( uint32_t idx=i; idx!=DUP_NONE; idx=next_in_group[idx] )
+                group.push_back( idx );
+            int end = group.size();
+
+            // For each game in group of duplicates
+            for( int idx=0; idx<end; idx++ )
             {
+                smart_ptr<ListableGame> p = gms[group[idx]];
 
-                // First reorder the group by id
-                std::sort( games.begin()+start, games.begin()+end, predicate_sorts_by_id );
-#if 0
+                // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
+                if( p->game_id != GAME_ID_SENTINEL )
                 {
-                    cprintf( "Eval Dups in\n" );
-                    for( int idx=start; idx<end; idx++ )
-                    {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
-                    }
-                }
-#endif
-
-                // For each game in group of duplicates
-                for( int idx=start; idx<end; idx++ )
-                {
-                    smart_ptr<ListableGame> p = games[idx];
-
-                    // If the game hasn't already been marked as a dup (note first of the group is never marked as a dup)
-                    if( p->game_id != GAME_ID_SENTINEL )
-                    {
 
-                        // Sweep through the rest of the group and mark each game in turn a dup if it matches
-                        std::vector<std::string> white_tokens;
-                        Split(p->White(),white_tokens);
-                        std::vector<std::string> black_tokens;
-                        Split(p->Black(),black_tokens);
+                    // Sweep through the rest of the group and mark each game in turn a dup if it matches
+                    std::vector<std::string> white_tokens;
+                    Split(p->White(),white_tokens);
+                    std::vector<std::string> black_tokens;
+                    Split(p->Black(),black_tokens);
 
-                        // Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
-                        //  game in main loop
+                    // Note that this is a O(2) type algorithm sadly, we loop through a group of games for each
+                    //  game in main loop
 #ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        int nbr_dups=0;
+                    int nbr_dups=0;
 #endif
-                        std::string str_dup_games;
-                        for( int j=idx+1; j<end; j++ )
+                    std::string str_dup_games;
+                    for( int j=idx+1; j<end; j++ )
+                    {
+                        smart_ptr<ListableGame> q = gms[group[j]];
+                        if( group[j]>=first_new && q->game_id!=GAME_ID_SENTINEL && 0==strcmp(p->CompressedMoves(),q->CompressedMoves())
+                                                         && DupDetect(p,white_tokens,black_tokens,q) )
                         {
-                            smart_ptr<ListableGame> q = games[j];
-                            if( q->game_id!=GAME_ID_SENTINEL && DupDetect(p,white_tokens,black_tokens,q) )
-                            {
-                                q->game_id = GAME_ID_SENTINEL;
+                            q->game_id = GAME_ID_SENTINEL;
 #ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                                GameDocument the_game;
-                                CompactGame pact;
-                                std::string str;
-                                if( nbr_dups == 0 )
-                                {
-                                    p->GetCompactGame( pact );
-                                    pact.Upscale(the_game);
-                                    the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
-                                    the_game.ToFileTxtGameBody( str );
-                                    str_dup_games += str;
-                                }
-                                nbr_dups++;
-                                q->GetCompactGame( pact );
+                            GameDocument the_game;
+                            CompactGame pact;
+                            std::string str;
+                            if( nbr_dups == 0 )
+                            {
+                                p->GetCompactGame( pact );
                                 pact.Upscale(the_game);
                                 the_game.ToFileTxtGameDetails( str );
-                                    str_dup_games += str;
+                                str_dup_games += str;
                                 the_game.ToFileTxtGameBody( str );
                                 str_dup_games += str;
-#endif
                             }
-                        }
-#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-                        if( pgn_dup2 && nbr_dups>0 )
-                        {
-                            if( nbr_dups > 1 )
-                                replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
-                            fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
-                        }
+                            nbr_dups++;
+                            q->GetCompactGame( pact );
+                            pact.Upscale(the_game);
+                            the_game.ToFileTxtGameDetails( str );
+                            str_dup_games += str;
+                            the_game.ToFileTxtGameBody( str );
+                            str_dup_games += str;
 #endif
+                        }
                     }
-                }
-#if 0
-                {
-                    cprintf( "Eval Dups out\n" );
-                    for( int idx=start; idx<end; idx++ )
+#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
+                    if( pgn_dup2 && nbr_dups>0 )
                     {
-                        smart_ptr<ListableGame> p = games[idx];
-                        cprintf( "%d: %s-%s, %s %d ply\n", p->game_id, p->White(), p->Black(), p->Event(), strlen(p->CompressedMoves()) );
+                        if( nbr_dups > 1 )
+                            replace_once( str_dup_games, "[White \"", "[White \"MORE-THAN-2- " );
+                        fwrite(str_dup_games.c_str(),1,str_dup_games.length(),pgn_dup2);
                     }
-                }
 #endif
+                }
             }
         }
-        BinDbShowDebugOrder( games, "Duplicate Removal - phase 2 after");
+        BinDbShowDebugOrder( gms, "Duplicate Removal - phase 2 after");
     }
+#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
+    if( pgn_dup2 )
+        fclose(pgn_dup2);
+#endif
+    return true;
+}
+
+// Write the duplicates that have been removed to TarraschDbDuplicatesFile.pgn, last first
+static void SaveDuplicates( const std::vector< smart_ptr<ListableGame> > &dups, const std::string &optional_title, wxWindow *window )
+{
+    wxFileName wfn(objs.repository->log.m_file.c_str());
+    if( !wfn.IsOk() )
+        wfn.SetFullName("TarraschDbDuplicatesFile.pgn");
+    wfn.SetExt("pgn");
+    wfn.SetName("TarraschDbDuplicatesFile");
+    wxString dups_filename = wfn.GetFullPath();
+    FILE *pgn_dup = fopen(dups_filename.c_str(),"wb");
+    if( pgn_dup )
+    {
+        std::string desc("Saving duplicates to TarraschDbDuplicatesFile.pgn, cancel if not needed");
+        ProgressBar progress_bar(optional_title, desc, true, window);
+        int nbr_dups = dups.size();
+        for( int i=nbr_dups-1; i>=0; i-- )
+        {
+            GameDocument  the_game;
+            CompactGame pact;
+            dups[i]->GetCompactGame( pact );
+            pact.Upscale(the_game);
+            std::string str;
+            the_game.ToFileTxtGameDetails( str );
+            fwrite(str.c_str(),1,str.length(),pgn_dup);
+            the_game.ToFileTxtGameBody( str );
+            fwrite(str.c_str(),1,str.length(),pgn_dup);
+            if( progress_bar.Perfraction( nbr_dups-i, nbr_dups ) )
+                break;
+        }
+        fclose(pgn_dup);
+    }
+}
+
+// New in V3.01a - incorporate write file so can do that before writing dups to TarraschDbDuplicate.pgn
+bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, bool locked, wxWindow *window )
+{
+    bool ok=true;
+
+    // Bug fix: V3.01 Establish contiguous id range - if we have assembled multiple files it won't have happened
+    size_t nbr = games.size();
+    uint32_t id = GameIdAllocateTop(nbr);
+    for( size_t i=0; i<nbr; i++ )
+        games[i]->game_id = id++;
+
+    // Last three steps - remove duplicates, write to file, write duplicates to TarraschDbDuplicates.pgn
+    char buf[200];
+    sprintf( buf, "%s, step %d of %d", title.c_str(), step, step+2 );
+    std::string dup_title(buf);
+    sprintf( buf, "%s, step %d of %d", title.c_str(), step+1, step+2 );
+    std::string write_title(buf);
+    sprintf( buf, "%s, step %d of %d", title.c_str(), step+2, step+2 );
+    std::string optional_title(buf);
+    if( !MarkDuplicates( games, 0, dup_title, window ) )
+        return false;   // abort
     int nbr_deleted=0;
     {
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 3 before");
-        std::string desc("Duplicate Removal - phase 3");
-        ProgressBar progress_bar( dup_title, desc, true, window );
-        //progress_bar.DrawNow();
-        sort_before( games.begin(), games.end(), predicate_sorts_by_id, &progress_bar );
-        std::sort( games.begin(), games.end(), predicate_sorts_by_id );
-        sort_after();
 
-        // Games to be deleted are at the end - with id GAME_ID_SENTINEL, count them
+        // The games are still in id order, move the games to be deleted (with id GAME_ID_SENTINEL)
+        //  to the end, keeping the order of the rest, and count them
+        std::stable_partition( games.begin(), games.end(), predicate_is_not_dup );
         for( int i=games.size()-1; i>=0; i-- )
         {
             if( games[i]->game_id != GAME_ID_SENTINEL )
@@ -1499,52 +1683,130 @@ bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, b
 
     if( nbr_deleted )
     {
-        wxFileName wfn(objs.repository->log.m_file.c_str());
-        if( !wfn.IsOk() )
-            wfn.SetFullName("TarraschDbDuplicatesFile.pgn");
-        wfn.SetExt("pgn");
-        wfn.SetName("TarraschDbDuplicatesFile");
-        wxString dups_filename = wfn.GetFullPath();
-        FILE *pgn_dup = fopen(dups_filename.c_str(),"wb");
-        if( pgn_dup )
-        {
-            BinDbShowDebugOrder(games, "Duplicate Removal - phase 4 before");
-            std::string desc("Saving duplicates to TarraschDbDuplicatesFile.pgn, cancel if not needed");
-            ProgressBar progress_bar(optional_title, desc, true, window);
-            for( int i=games.size()-1; i>=0; i-- )
-            {
-                if( games[i]->game_id != GAME_ID_SENTINEL )
-                    break;
-                else
-                {
-                    GameDocument  the_game;
-                    CompactGame pact;
-                    games[i]->GetCompactGame( pact );
-                    pact.Upscale(the_game);
-                    std::string str;
-                    the_game.ToFileTxtGameDetails( str );
-                    if( pgn_dup )
-                        fwrite(str.c_str(),1,str.length(),pgn_dup);
-                    the_game.ToFileTxtGameBody( str );
-                    if( pgn_dup )
-                        fwrite(str.c_str(),1,str.length(),pgn_dup);
-                    if( progress_bar.Perfraction( games.size()-i, nbr_deleted ) )
-                        break;
-                }
-            }
-            fclose(pgn_dup);
-        }
+        BinDbShowDebugOrder(games, "Duplicate Removal - phase 4 before");
+        std::vector< smart_ptr<ListableGame> > dups( games.end()-nbr_deleted, games.end() );
+        SaveDuplicates( dups, optional_title, window );
         games.erase( games.end()-nbr_deleted, games.end() );
         cprintf( "Number of duplicates deleted: %d\n", nbr_deleted );
         BinDbShowDebugOrder( games, "Duplicate Removal - phase 4 after");
     }
-#ifdef EXTRA_DEDUP_DIAGNOSTIC_FILE
-    if( pgn_dup2 )
-        fclose(pgn_dup2);
-#endif
     return true;
 }
 
+// The game header layout for a file with the given numbers of players, events and sites
+static void GameHeaderLayout( BinaryBlock &bb, int nbr_players, int nbr_events, int nbr_sites )
+{
+    bb.Next(BitsRequired(nbr_events));  // Event
+    bb.Next(BitsRequired(nbr_sites));   // Site
+    bb.Next(BitsRequired(nbr_players)); // White
+    bb.Next(BitsRequired(nbr_players)); // Black
+    bb.Next(19);                // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    bb.Next(16);                // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+    bb.Next(9);                 // ECO For now 500 codes (9 bits) (A..E)(00..99)
+    bb.Next(2);                 // Result (2 bits)
+    bb.Next(12);                // WhiteElo 12 bits (range 0..4095)
+    bb.Next(12);                // BlackElo
+}
+
+// Write one game record, a header with the given string ids then the moves. Returns the
+//  number of bytes written
+static int WriteGameRecord( FILE *ofile, BinaryBlock &bb, const smart_ptr<ListableGame> &ptr, int event_offset, int site_offset,
+                            int white_offset, int black_offset, uint32_t &checksum )
+{
+    int bb_sz = bb.Size();
+    bb.Write(0,event_offset);           // Event
+    bb.Write(1,site_offset);            // Site
+    bb.Write(2,white_offset);           // White
+    bb.Write(3,black_offset);           // Black
+    bb.Write(4,ptr->DateBin());         // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    bb.Write(5,ptr->RoundBin());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+    uint16_t eco_bin = ptr->EcoBin();   // ECO 500 codes (9 bits) 0-499 is (A..E)(00..99), 500 is empty
+    if( eco_bin >= 500 )                // Sadly older versions cannot cope with 500 = empty
+        eco_bin = 0;
+    bb.Write(6,eco_bin);                // ECO For now 500 codes (9 bits) 0-499 is (A..E)(00..99), sadly A00 indistinguishable from empty
+    bb.Write(7,ptr->ResultBin());       // Result (2 bits)
+    bb.Write(8,ptr->WhiteEloBin());     // WhiteElo 12 bits (range 0..4095)
+    bb.Write(9,ptr->BlackEloBin());     // BlackElo
+    fwrite( bb.GetPtr(), bb_sz, 1, ofile );
+    checksum = Crc32( checksum, bb.GetPtr(), bb_sz );
+    int n = strlen(ptr->CompressedMoves()) + 1;
+    const char *cstr = ptr->CompressedMoves();
+    fwrite( cstr, n, 1, ofile );
+    checksum = Crc32( checksum, cstr, n );
+    return bb_sz + n;
+}
+
+// Write the offset table, checksum table, piece square table (unless psm is NULL), fingerprint
+//  table and finally the footer. The games end at posn, offsets has an entry for each game plus
+//  the end of the last game, fingerprints has the DupFingerprint lo of each game
+static void WriteTablesAndFooter( FILE *ofile, uint64_t posn, FileFooter &ff, const std::vector<uint64_t> &offsets,
+                                  const std::vector<uint32_t> &checksums, const PieceSquareMasks *psm, const std::vector<uint64_t> &masks,
+                                  const std::vector<uint64_t> &fingerprints )
+{
+    ff.games_size = posn - ff.games_offset;
+    ff.nbr_games  = offsets.size() - 1;
+    ff.offset_width = (ff.games_size > 0xffffffff ? 8 : 4);
+    ff.offset_table_offset = posn;
+    for( size_t i=0; i<offsets.size(); i++ )
+    {
+        uint32_t offset32 = static_cast<uint32_t>(offsets[i]);
+        const void *offset = (ff.offset_width==8 ? static_cast<const void *>(&offsets[i]) : static_cast<const void *>(&offset32));
+        fwrite( offset, ff.offset_width, 1, ofile );
+        ff.offset_table_checksum = Crc32( ff.offset_table_checksum, offset, ff.offset_width );
+    }
+    ff.offset_table_size = offsets.size() * ff.offset_width;
+    posn += ff.offset_table_size;
+    ff.checksum_table_offset = posn;
+    ff.checksum_table_size = checksums.size() * sizeof(uint32_t);
+    if( checksums.size() > 0 )
+    {
+        fwrite( &checksums[0], sizeof(uint32_t), checksums.size(), ofile );
+        ff.checksum_table_checksum = Crc32( 0, &checksums[0], ff.checksum_table_size );
+    }
+    posn += ff.checksum_table_size;
+    ff.piece_square_table_offset = posn;
+    if( psm )
+    {
+        uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2];
+        psm->GetCombos( combos );
+        fwrite( combos, sizeof(combos), 1, ofile );
+        ff.piece_square_table_checksum = Crc32( 0, combos, sizeof(combos) );
+        if( masks.size() > 0 )
+        {
+            fwrite( &masks[0], sizeof(uint64_t), masks.size(), ofile );
+            ff.piece_square_table_checksum = Crc32( ff.piece_square_table_checksum, &masks[0], masks.size()*sizeof(uint64_t) );
+        }
+        ff.piece_square_table_size = sizeof(combos) + masks.size()*sizeof(uint64_t);
+        ff.nbr_piece_square_combos = psm->NbrCombos();
+    }
+    posn += ff.piece_square_table_size;
+    std::vector< std::pair<uint64_t,uint32_t> > sorted( fingerprints.size() );
+    for( size_t i=0; i<fingerprints.size(); i++ )
+        sorted[i] = std::pair<uint64_t,uint32_t>( fingerprints[i], static_cast<uint32_t>(i) );
+    std::sort( sorted.begin(), sorted.end() );
+    std::vector<uint64_t> keys( sorted.size() );
+    std::vector<uint32_t> game_nbrs( sorted.size() );
+    for( size_t i=0; i<sorted.size(); i++ )
+    {
+        keys[i] = sorted[i].first;
+        game_nbrs[i] = sorted[i].second;
+    }
+    ff.fingerprint_table_offset = posn;
+    if( sorted.size() > 0 )
+    {
+        fwrite( &keys[0], sizeof(uint64_t), keys.size(), ofile );
+        fwrite( &game_nbrs[0], sizeof(uint32_t), game_nbrs.size(), ofile );
+        ff.fingerprint_table_checksum = Crc32( 0, &keys[0], keys.size()*sizeof(uint64_t) );
+        ff.fingerprint_table_checksum = Crc32( ff.fingerprint_table_checksum, &game_nbrs[0], game_nbrs.size()*sizeof(uint32_t) );
+    }
+    ff.fingerprint_table_size = sorted.size() * (sizeof(uint64_t)+sizeof(uint32_t));
+    ff.fingerprint_version = DUP_FINGERPRINT_VERSION;
+    ff.games_per_checksum = GAMES_PER_CHECKSUM;
+    ff.footer_len = sizeof(FileFooter);
+    memcpy( ff.signature, "TDBF", 4 );
+    fwrite( &ff, sizeof(ff), 1, ofile );
+}
+
 // Return bool okay
 bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, ProgressBar *pb )
 {
@@ -1578,6 +1840,10 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         fwrite( &ver, 1, 1, ofile );
     }
     std::set<std::string>::iterator it = set_player.begin();
+    FileFooter ff;
+    memset( &ff, 0, sizeof(ff) );
+    uint64_t posn = sizeof(compatibility_header) + sizeof(FileHeader);    // track file position ourselves, ftell() is
+                                                                        //  only 32 bits on some platforms
     FileHeader fh;
     fh.hdr_len     = sizeof(FileHeader);
     fh.nbr_players = std::distance( set_player.begin(), set_player.end() );
@@ -1585,12 +1851,14 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     fh.nbr_sites   = std::distance( set_site.begin(),   set_site.end() );
     fh.nbr_games   = games.size() - nbr_to_omit_from_end;
     fh.locked      = locked;
+    fh.footer_len  = sizeof(FileFooter);
     cprintf( "%d games, %d players, %d events, %d sites\n", fh.nbr_games, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
     int nbr_bits_player = BitsRequired(fh.nbr_players);
     int nbr_bits_event  = BitsRequired(fh.nbr_events);
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
     fwrite( &fh, sizeof(fh), 1, ofile );
+    ff.strings_offset = posn;
     int idx=0;
     int total_strings = fh.nbr_players + fh.nbr_events + fh.nbr_sites + fh.nbr_games;
     int nbr_strings_so_far = 0;
@@ -1600,6 +1868,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_player[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1614,6 +1884,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_event[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1628,6 +1900,8 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
         map_site[str] = idx++;
         const char *s = str.c_str();
         fwrite( s, strlen(s)+1, 1, ofile );
+        ff.strings_checksum = Crc32( ff.strings_checksum, s, strlen(s)+1 );
+        posn += strlen(s)+1;
         it++;
         nbr_strings_so_far++;
         if( pb )
@@ -1641,42 +1915,38 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
     std::set<std::string>::iterator site_begin   = set_site.begin();
     std::set<std::string>::iterator site_end     = set_site.end();
     BinaryBlock bb;
-    bb.Next(nbr_bits_event);    // Event
-    bb.Next(nbr_bits_site);     // Site
-    bb.Next(nbr_bits_player);   // White
-    bb.Next(nbr_bits_player);   // Black
-    bb.Next(19);                // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-    bb.Next(16);                // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
-    bb.Next(9);                 // ECO For now 500 codes (9 bits) (A..E)(00..99)
-    bb.Next(2);                 // Result (2 bits)
-    bb.Next(12);                // WhiteElo 12 bits (range 0..4095)
-    bb.Next(12);                // BlackElo
+    GameHeaderLayout( bb, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
     int bb_sz = bb.Size();
     cprintf( "bb_sz=%d\n", bb_sz );
+    ff.strings_size = posn - ff.strings_offset;
+    ff.games_offset = posn;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> checksums;
+    uint32_t checksum = 0;
+    PieceSquareMasks psm;
+    psm.ChooseCombos( games, fh.nbr_games );
+    std::vector<uint64_t> masks;
+    masks.reserve( fh.nbr_games );
+    std::vector<uint64_t> fingerprints;
+    fingerprints.reserve( fh.nbr_games );
     for( int i=0; i<fh.nbr_games; i++ )
     {
+        offsets.push_back( posn - ff.games_offset );
         smart_ptr<ListableGame> ptr = games[i];
         int white_offset = map_player[std::string(ptr->White())];
         int black_offset = map_player[std::string(ptr->Black())];
         int event_offset = map_event[std::string(ptr->Event())];
         int site_offset = map_site[std::string(ptr->Site())];
-        bb.Write(0,event_offset);           // Event
-        bb.Write(1,site_offset);            // Site
-        bb.Write(2,white_offset);           // White
-        bb.Write(3,black_offset);           // Black
-        bb.Write(4,ptr->DateBin());         // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-        bb.Write(5,ptr->RoundBin());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
-        uint16_t eco_bin = ptr->EcoBin();   // ECO 500 codes (9 bits) 0-499 is (A..E)(00..99), 500 is empty
-        if( eco_bin >= 500 )                // Sadly older versions cannot cope with 500 = empty
-            eco_bin = 0;
-        bb.Write(6,eco_bin);                // ECO For now 500 codes (9 bits) 0-499 is (A..E)(00..99), sadly A00 indistinguishable from empty
-        bb.Write(7,ptr->ResultBin());       // Result (2 bits)
-        bb.Write(8,ptr->WhiteEloBin());     // WhiteElo 12 bits (range 0..4095)
-        bb.Write(9,ptr->BlackEloBin());     // BlackElo
-        fwrite( bb.GetPtr(), bb_sz, 1, ofile );
-        int n = strlen(ptr->CompressedMoves()) + 1;
-        const char *cstr = ptr->CompressedMoves();
-        fwrite( cstr, n, 1, ofile );
+        posn += WriteGameRecord( ofile, bb, ptr, event_offset, site_offset, white_offset, black_offset, checksum );
+        masks.push_back( psm.GameMask(ptr->CompressedMoves()) );
+        DupFingerprint fp;
+        DupFingerprintCalc( ptr, fp );
+        fingerprints.push_back( fp.lo );
+        if( (i+1)%GAMES_PER_CHECKSUM==0 || i+1==fh.nbr_games )
+        {
+            checksums.push_back( checksum );
+            checksum = 0;
+        }
         if( (i % 10000) == 0 )
             cprintf( "%d games written to compressed file so far\n", i );
         nbr_strings_so_far++;
@@ -1684,6 +1954,11 @@ bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, Pr
             if( pb->Perfraction( nbr_strings_so_far, total_strings ) )
                 return false;   // abort
     }
+
+    // Offset table, checksum table, piece square table and finally the footer
+    offsets.push_back( posn - ff.games_offset );
+    ff.flags = FOOTER_FLAG_STRINGS_SORTED;     // std::set order is strcmp() order
+    WriteTablesAndFooter( ofile, posn, ff, offsets, checksums, &psm, masks, fingerprints );
     cprintf( "%d games written to compressed file\n", fh.nbr_games );
     return true;
 }
@@ -1705,11 +1980,406 @@ void ReadStrings( FILE *fin, int nbr_strings, std::vector<std::string> &strings
     }
 }
 
+// Everything the load workers need to decode games from a memory mapped file
+struct LoadJob
+{
+    uint8_t     cb_idx;
+    bool        locked;
+    bool        do_reverse;
+    bool        translate_to_24_bit;
+    BinaryBlock bb;                     // game header layout in the file
+    int         bb_sz;
+    BinaryBlock cb_bb;                  // game header layout in memory, if translating
+    int         cb_sz;
+    uint32_t    base;                   // game_id base
+    uint32_t    game_count;
+    uint32_t    first;                  // records[0] is game number first in the file (there may be extensions)
+    const char  *mapped_end;
+    std::vector<const char *> records;  // game i is at records[i], records.back() is end of last game
+    uint32_t    chunk_size;             // nbr of games each worker grabs at a time
+    const char  *checksums;             // if not NULL, the FileFooter checksum table, one per chunk
+    const char  *piece_square_table;    // if not NULL, the FileFooter piece square table
+    bool        strings_sorted;         // the FileFooter has FOOTER_FLAG_STRINGS_SORTED
+    smart_ptr<ListableGame> *slots;     // a preallocated slot for each game, in file order
+    std::atomic<uint32_t> next_chunk;
+    std::atomic<uint32_t> nbr_done;
+    std::atomic<uint32_t> nbr_promotion_games;
+    std::atomic<int>      nbr_running;
+    std::atomic<bool>     abort;
+    std::atomic<bool>     corrupt;
+};
+
+// Each worker grabs chunks of games until there are none left
+static void LoadWorker( LoadJob *job )
+{
+    BinaryBlock cb_bb = job->cb_bb;     // each worker translates into its own copy
+    uint32_t nbr_records = job->records.size() - 1;
+    while( !job->abort )
+    {
+        uint32_t begin = job->next_chunk.fetch_add(job->chunk_size);
+        if( begin >= nbr_records )
+            break;
+        uint32_t end = begin+job->chunk_size < nbr_records ? begin+job->chunk_size : nbr_records;
+        uint32_t nbr_promotion_games = 0;
+        if( job->checksums )
+        {
+            uint32_t checksum;
+            memcpy( &checksum, job->checksums + (begin/job->chunk_size)*sizeof(uint32_t), sizeof(uint32_t) );
+            if( checksum != Crc32( 0, job->records[begin], job->records[end]-job->records[begin] ) )
+            {
+                cprintf( "Checksum error, games %u to %u\n", begin, end-1 );
+                job->corrupt = true;
+                job->abort = true;
+                break;
+            }
+        }
+
+        // The chunk's games live together in one arena, each game's smart_ptr shares ownership
+        //  of the whole arena. This saves a heap allocation and a reference count per game and
+        //  keeps games that are scanned together adjacent in memory
+        smart_ptr< std::vector<ListableGameBinDb> > arena( new std::vector<ListableGameBinDb> );
+        arena->reserve( end-begin );    // so no reallocation; pointers into the arena stay valid
+        uint32_t i;
+        for( i=begin; i<end && !job->abort; i++ )
+        {
+            const char *game_header_ptr = job->records[i];
+            const char *terminator = job->records[i+1] - 1;    // moves are a '\0' terminated string
+
+            // Games near the end of the file are copied so BinaryBlock::Read() (which reads 4
+            //  bytes at a time) can't stray past the end of the mapping
+            std::string near_end;
+            if( job->mapped_end-game_header_ptr < job->bb_sz+8 )
+            {
+                near_end = std::string( game_header_ptr, terminator );
+                game_header_ptr = near_end.c_str();
+                terminator = game_header_ptr + near_end.length();
+            }
+            uint32_t game_id = job->base;
+            game_id += (job->do_reverse ? job->game_count-1-(job->first+i) : job->first+i);
+
+            // If reading to append, need to translate header from logN bits to 24 bits
+            if( job->translate_to_24_bit )
+            {
+                for( int j=0; j<10; j++ )
+                    cb_bb.Write( j, job->bb.Read(j,game_header_ptr) );
+                std::string blob = std::string( cb_bb.GetPtr(), job->cb_sz ) + std::string( game_header_ptr+job->bb_sz, terminator );
+                arena->push_back( ListableGameBinDb( job->cb_idx, game_id, blob ) );
+            }
+            else if( near_end.length() > 0 )
+                arena->push_back( ListableGameBinDb( job->cb_idx, game_id, near_end ) );
+            else
+                arena->push_back( ListableGameBinDb( job->cb_idx, game_id, game_header_ptr ) );
+            ListableGameBinDb *info = &arena->back();
+            info->SetLocked( job->locked );
+            if( info->TestPromotion() )
+                nbr_promotion_games++;
+            job->slots[i] = smart_ptr<ListableGame>( arena, info );
+        }
+        job->nbr_done += (i-begin);
+        job->nbr_promotion_games += nbr_promotion_games;
+    }
+    job->nbr_running--;
+}
+
+// 64 bit file positioning, ftell() and fseek() are only 32 bits on some platforms. Return bool ok
+static bool Seek64( FILE *f, uint64_t offset )
+{
+#ifdef THC_WINDOWS
+    return 0 == _fseeki64( f, static_cast<__int64>(offset), SEEK_SET );
+#else
+    return 0 == fseeko( f, static_cast<off_t>(offset), SEEK_SET );
+#endif
+}
+
+// Returns the length of the file, and leaves the file position at the end
+static uint64_t FileLength64( FILE *f )
+{
+#ifdef THC_WINDOWS
+    _fseeki64( f, 0, SEEK_END );
+    __int64 len = _ftelli64( f );
+#else
+    fseeko( f, 0, SEEK_END );
+    off_t len = ftello( f );
+#endif
+    return len>0 ? static_cast<uint64_t>(len) : 0;
+}
+
+// Read the FileFooter that ends at file offset end, it may be shorter (older) or longer
+//  (newer) than ours. Return bool ok
+static bool ReadFileFooter( FILE *fin, uint64_t end, FileFooter &ff )
+{
+    memset( &ff, 0, sizeof(ff) );
+    uint32_t footer_len=0;
+    bool ok = ( end>=8 && Seek64(fin,end-8) && 1==fread(&footer_len,4,1,fin) && 1==fread(ff.signature,4,1,fin) &&
+                0==memcmp(ff.signature,"TDBF",4) && footer_len>=FILE_FOOTER_MIN_LEN && footer_len<=FILE_FOOTER_MAX_LEN &&
+                footer_len<=end );
+    if( ok )
+    {
+        size_t fields_len = (footer_len<sizeof(ff) ? footer_len : sizeof(ff)) - 8;
+        ok = Seek64(fin,end-footer_len) && 1==fread(&ff,fields_len,1,fin);
+        ff.footer_len = footer_len;
+    }
+    return ok;
+}
+
+// Read the file's FileFooter and the footers of any extensions (see BinDbAppendInPlace()),
+//  in file order. Return bool ok, if not the file has no usable footer
+static bool ReadFileFooters( FILE *fin, const FileHeader &fh, FileFooter &ff, std::vector<FileFooter> &extensions )
+{
+    extensions.clear();
+    if( fh.footer_len == 0 )
+        return false;   // predates the FileFooter
+    uint64_t end = FileLength64(fin);
+    bool ok = ReadFileFooter(fin,end,ff);
+    while( ok && (ff.flags&FOOTER_FLAG_EXTENSION) )
+    {
+        ok = (ff.prev_len < end);
+        extensions.push_back( ff );
+        end = ff.prev_len;
+        if( ok )
+            ok = ReadFileFooter(fin,end,ff);
+    }
+    ok = ok && ff.footer_len==static_cast<uint32_t>(fh.footer_len);
+    if( !ok )
+    {
+        cprintf( "FileFooter not used\n" );
+        extensions.clear();
+    }
+    std::reverse( extensions.begin(), extensions.end() );
+    return ok;
+}
+
+// Offset table entry i, relative to games_offset
+static uint64_t OffsetTableEntry( const char *table, uint32_t offset_width, uint32_t i )
+{
+    uint64_t offset = 0;
+    if( offset_width == 8 )
+        memcpy( &offset, table + static_cast<uint64_t>(i)*8, 8 );
+    else
+    {
+        uint32_t offset32;
+        memcpy( &offset32, table + static_cast<uint64_t>(i)*4, 4 );
+        offset = offset32;
+    }
+    return offset;
+}
+
+// If the file (or extension) has a FileFooter, and it checks out, use its offset table to
+//  find the nbr_games game records. Return bool ok
+static bool FindRecordsWithFooter( LoadJob &job, const BinDbMappedFile &mf, const FileFooter &ff, uint64_t games_offset, uint32_t nbr_games )
+{
+    job.piece_square_table = NULL;
+    job.strings_sorted = false;
+    uint64_t len = mf.len - ff.footer_len;
+    uint64_t nbr_chunks = ff.games_per_checksum ? (ff.nbr_games + ff.games_per_checksum-1) / ff.games_per_checksum : 0;
+    bool ok = ( mf.len>=ff.footer_len && ff.nbr_games==nbr_games && ff.games_offset==games_offset &&
+                (ff.offset_width==4 || ff.offset_width==8) && ff.games_per_checksum>0 &&
+                ff.offset_table_size == (static_cast<uint64_t>(ff.nbr_games)+1) * ff.offset_width &&
+                ff.checksum_table_size == nbr_chunks * sizeof(uint32_t) &&
+                ff.strings_size<=len         && ff.strings_offset<=len-ff.strings_size &&
+                ff.games_size<=len           && ff.games_offset<=len-ff.games_size &&
+                ff.offset_table_size<=len    && ff.offset_table_offset<=len-ff.offset_table_size &&
+                ff.checksum_table_size<=len  && ff.checksum_table_offset<=len-ff.checksum_table_size );
+    if( ok )
+        ok = ( ff.strings_checksum        == Crc32( 0, mf.base+ff.strings_offset,        static_cast<size_t>(ff.strings_size) ) &&
+               ff.offset_table_checksum   == Crc32( 0, mf.base+ff.offset_table_offset,   static_cast<size_t>(ff.offset_table_size) ) &&
+               ff.checksum_table_checksum == Crc32( 0, mf.base+ff.checksum_table_offset, static_cast<size_t>(ff.checksum_table_size) ) );
+    if( !ok )
+    {
+        cprintf( "FileFooter not used\n" );
+        return false;
+    }
+
+    // Each record must be a header followed by a '\0' terminated string of moves
+    const char *games = mf.base + ff.games_offset;
+    const char *table = mf.base + ff.offset_table_offset;
+    uint64_t previous = 0;
+    job.records.clear();
+    job.records.reserve( ff.nbr_games+1 );
+    for( uint32_t i=0; ok && i<=ff.nbr_games; i++ )
+    {
+        uint64_t offset = OffsetTableEntry( table, ff.offset_width, i );
+        if( i > 0 )
+            ok = ( offset>previous+job.bb_sz && offset<=ff.games_size && games[offset-1]=='\0' );
+        else
+            ok = (offset == 0);
+        job.records.push_back( games+offset );
+        previous = offset;
+    }
+    if( ok )
+        ok = (previous == ff.games_size);
+    if( !ok )
+    {
+        cprintf( "FileFooter offset table is bad\n" );
+        job.records.clear();
+        return false;
+    }
+    job.chunk_size = ff.games_per_checksum;
+    job.checksums = mf.base + ff.checksum_table_offset;
+    job.strings_sorted = ((ff.flags & FOOTER_FLAG_STRINGS_SORTED) != 0);
+
+    // The piece square table is optional, without it searches play through every game
+    if( ff.piece_square_table_size > 0 )
+    {
+        ok = ( ff.nbr_piece_square_combos <= PIECE_SQUARE_NBR_COMBOS &&
+               ff.piece_square_table_size == PIECE_SQUARE_NBR_COMBOS*2 + static_cast<uint64_t>(ff.nbr_games)*sizeof(uint64_t) &&
+               ff.piece_square_table_size<=len && ff.piece_square_table_offset<=len-ff.piece_square_table_size &&
+               ff.piece_square_table_checksum == Crc32( 0, mf.base+ff.piece_square_table_offset, static_cast<size_t>(ff.piece_square_table_size) ) );
+        if( ok )
+            job.piece_square_table = mf.base + ff.piece_square_table_offset;
+        else
+            cprintf( "FileFooter piece square table not used\n" );
+    }
+    return true;
+}
+
+// Find the nbr_games game records at games_offset in a memory mapped file (using the footer
+//  if not NULL), then decode them on all cores into preallocated slots at the end of
+//  mega_cache. Returns bool killed
+static bool LoadMappedGames( LoadJob &job, const BinDbMappedFile &mf, const FileFooter *ff, uint64_t games_offset, uint32_t nbr_games,
+                                std::vector< smart_ptr<ListableGame> > &mega_cache,
+                                int &background_load_permill, bool &kill_background_load, ProgressBar *pb )
+{
+    bool killed = false;
+    job.next_chunk = 0;
+    job.nbr_done = 0;
+    job.nbr_promotion_games = 0;
+    job.nbr_running = 0;
+    job.abort = false;
+    job.corrupt = false;
+    job.chunk_size = GAMES_PER_CHECKSUM;
+    job.checksums = NULL;
+
+    // If there's no usable footer, a quick first pass finds the record boundaries, each record
+    //  is a fixed size header followed by a '\0' terminated string of moves
+    bool have_footer = ff && FindRecordsWithFooter( job, mf, *ff, games_offset, nbr_games );
+    const char *mapped_ptr = mf.base + games_offset;
+    if( !have_footer )
+    {
+        job.records.clear();
+        job.records.reserve( nbr_games+1 );
+    }
+    for( uint32_t i=0; !have_footer && i<nbr_games; i++ )
+    {
+        if( (i&0xffff)==0 && kill_background_load )
+        {
+            killed = true;
+            break;
+        }
+        const char *terminator = NULL;
+        if( job.mapped_end-mapped_ptr > job.bb_sz )
+            terminator = static_cast<const char *>( memchr( mapped_ptr+job.bb_sz, '\0', job.mapped_end-mapped_ptr-job.bb_sz ) );
+        if( !terminator )
+        {
+            cprintf( "Whoops\n" );
+            break;
+        }
+        job.records.push_back( mapped_ptr );
+        mapped_ptr = terminator+1;
+    }
+    if( !have_footer )
+        job.records.push_back( mapped_ptr );
+    uint32_t nbr_records = job.records.size() - 1;
+    if( killed )
+        nbr_records = 0;
+    size_t first = mega_cache.size();
+    mega_cache.resize( first + nbr_records );
+    job.slots = nbr_records>0 ? &mega_cache[first] : NULL;
+
+    // Start the workers
+    unsigned int nbr_threads = std::thread::hardware_concurrency();
+    unsigned int nbr_chunks = (nbr_records + job.chunk_size-1) / job.chunk_size;
+    if( nbr_threads > nbr_chunks )
+        nbr_threads = nbr_chunks;
+    std::vector<std::thread> workers;
+    for( unsigned int i=0; i<nbr_threads; i++ )
+    {
+        job.nbr_running++;
+        try
+        {
+            workers.push_back( std::thread(LoadWorker,&job) );
+        }
+        catch( std::system_error & )
+        {
+            job.nbr_running--;
+            break;
+        }
+    }
+    if( workers.size()==0 && nbr_records>0 )
+    {
+        job.nbr_running++;
+        LoadWorker( &job );  // no threads available, do it ourselves (no progress reports)
+    }
+    cprintf( "Decoding %u games with %u threads%s\n", nbr_records, static_cast<unsigned int>(workers.size()), have_footer?", using FileFooter":"" );
+
+    // Meanwhile, report progress and watch for cancellation
+    uint32_t den = job.game_count?job.game_count:1;
+    for(;;)
+    {
+        uint32_t num = job.first + job.nbr_done;
+        if( den > 1000000 )
+            background_load_permill = num / (den/1000);
+        else
+            background_load_permill = (num*1000) / den;
+        if( job.nbr_running == 0 )
+            break;
+        if( kill_background_load || (pb && pb->Perfraction(num,den)) )
+        {
+            job.abort = true;
+            killed = true;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+    for( size_t i=0; i<workers.size(); i++ )
+        workers[i].join();
+
+    // A checksum error is treated like a kill, the games before the error are still usable
+    if( job.corrupt )
+        killed = true;
+
+    // If killed, keep only the contiguous run of games loaded from the start of the file
+    if( killed )
+    {
+        uint32_t nbr_loaded = 0;
+        while( nbr_loaded<nbr_records && job.slots[nbr_loaded] )
+            nbr_loaded++;
+        mega_cache.resize( first + nbr_loaded );
+        job.nbr_done = nbr_loaded;
+    }
+    return killed;
+}
+
+// Check the strings are in strcmp() order, for files without FOOTER_FLAG_STRINGS_SORTED
+static bool StringsSorted( const std::vector<std::string> &strings )
+{
+    for( size_t i=1; i<strings.size(); i++ )
+    {
+        if( strcmp(strings[i-1].c_str(),strings[i].c_str()) >= 0 )
+            return false;
+    }
+    return true;
+}
+
+// Hand over the piece square masks of the database just loaded for searching, masks[i] is
+//  the mask of game i in the file (if there are no masks, masks is empty)
+void BinDbGetPieceSquareMasks( PieceSquareMasks &psm, std::vector<uint64_t> &masks )
+{
+    psm = piece_square_masks;
+    masks.clear();
+    masks.swap( piece_square_game_masks );
+    piece_square_masks.Clear();
+}
+
 // Returns bool killed;
 bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<ListableGame> > &mega_cache, int &background_load_permill, bool &kill_background_load, ProgressBar *pb )
 {
     bool killed=false;
     locked = false;
+    if( !for_append )
+    {
+        piece_square_masks.Clear();
+        std::vector<uint64_t>().swap( piece_square_game_masks );
+    }
 
     // When loading the system database for searches, reverse order so most recent games come first
     bool do_reverse = !for_append;
@@ -1730,15 +2400,19 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     int nbr_bits_site   = BitsRequired(fh.nbr_sites);
     cprintf( "%d player bits, %d event bits, %d site bits\n", nbr_bits_player, nbr_bits_event, nbr_bits_site );
     int hdr_len = fh.hdr_len;   // future compatibility feature - if FileHeader gets longer so will fh.hdr_len
-    if( hdr_len >= sizeof(FileHeader) )  // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
-    {                                    //  databases of that version have a smaller header without lockable
-        locked = static_cast<bool>(fh.locked);
-    }
-    if( hdr_len != sizeof(FileHeader) )
-    {
-        fseek(fin,compatibility_header_size+hdr_len,SEEK_SET);  // if necessary skip to a different point than
-                                                                //  beyond header
+    if( 0<=hdr_len && hdr_len<sizeof(FileHeader) )  // we support VERSION_NUMBER_BIN_DB which predates VERSION_NUMBER_BIN_LOCKABLE
+    {                                               //  databases of that version have a smaller header without lockable, and
+                                                    //  databases that predate the FileFooter don't have footer_len
+        memset( reinterpret_cast<char *>(&fh)+hdr_len, 0, sizeof(FileHeader)-hdr_len );
     }
+    locked = static_cast<bool>(fh.locked);
+
+    // A database that has been appended to in place has extensions, each with more strings and games
+    FileFooter ff;
+    std::vector<FileFooter> extensions;
+    bool have_footer = ReadFileFooters( fin, fh, ff, extensions );
+    fseek(fin,compatibility_header_size+hdr_len,SEEK_SET);  // skip to beyond header, hdr_len not necessarily
+                                                            //  sizeof(FileHeader)
     ReadStrings( fin, fh.nbr_players, cb.players );
     cprintf( "Players ReadStrings() complete\n" );
     ReadStrings( fin, fh.nbr_events, cb.events );
@@ -1775,87 +2449,182 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     const char *cb_ptr = cb.bb.GetPtr();
     int cb_sz = cb.bb.FrozenSize();
     uint32_t game_count = fh.nbr_games;
+    for( size_t i=0; i<extensions.size(); i++ )
+        game_count += extensions[i].nbr_games;
     uint32_t nbr_games=0;
     uint32_t nbr_promotion_games=0;
     uint32_t base = GameIdAllocateTop(game_count);
-    for( uint32_t i=0; i<game_count; i++ )
+    bool strings_sorted = false;
+
+    // Map the file into memory and decode the games in parallel. Unless we need to translate
+    //  headers the games point straight into the mapping. If the mapping fails for any reason
+    //  (eg no contiguous address space for a huge file in a 32 bit build) fall back to reading
+    //  the file
+    smart_ptr<BinDbMappedFile> mf( new BinDbMappedFile );
+    long offset = ftell(fin);
+    if( offset>0 && mf->Map(fin) && static_cast<uint64_t>(offset)<=mf->len )
     {
-        if( kill_background_load )
+        cprintf( "Memory mapped %lu bytes\n", static_cast<unsigned long>(mf->len) );
+        if( !translate_to_24_bit )
+            cb.mapped_file = mf;
+        LoadJob job;
+        job.cb_idx = cb_idx;
+        job.locked = locked;
+        job.do_reverse = do_reverse;
+        job.translate_to_24_bit = translate_to_24_bit;
+        job.bb = bb;
+        job.bb_sz = bb_sz;
+        job.cb_bb = cb.bb;
+        job.cb_sz = cb_sz;
+        job.base = base;
+        job.game_count = game_count;
+        job.first = 0;
+        job.mapped_end = mf->base + mf->len;
+        killed = LoadMappedGames( job, *mf, have_footer?&ff:NULL, offset, fh.nbr_games, mega_cache, background_load_permill, kill_background_load, pb );
+        nbr_games = job.nbr_done;
+        nbr_promotion_games = job.nbr_promotion_games;
+        strings_sorted = job.strings_sorted;
+
+        // Keep the piece square masks (in file order) for searching
+        bool keep_masks = !for_append && job.piece_square_table;
+        uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2];
+        if( keep_masks )
         {
-            killed = true;
-            break;
-        }
-        if( pb && pb->Perfraction(i,game_count) )
-        {
-            killed = true;
-            break;
+            memcpy( combos, job.piece_square_table, sizeof(combos) );
+            piece_square_masks.SetCombos( combos );
+            piece_square_game_masks.resize( nbr_games );
+            if( nbr_games > 0 )
+                memcpy( &piece_square_game_masks[0], job.piece_square_table + PIECE_SQUARE_NBR_COMBOS*2, nbr_games*sizeof(uint64_t) );
         }
-        char buf[sizeof(cb.bb)];
-
-        // Read the game header into a std::string
-        fread( buf, bb_sz, 1, fin );
-        std::string game_header(buf,bb_sz);
 
-        // Read the moves, '\0' terminated string follows game_header
-        std::string game_moves;
-        int ch = fgetc(fin);
-        while( ch && ch!=EOF )
+        // The extensions' games follow on, their masks use the same combos (all the games need masks, or none)
+        for( size_t i=0; !killed && i<extensions.size(); i++ )
         {
-            game_moves += static_cast<char>(ch);
-            ch = fgetc(fin);
+            const FileFooter &ext = extensions[i];
+            job.first = nbr_games;
+            killed = LoadMappedGames( job, *mf, &ext, ext.games_offset, ext.nbr_games, mega_cache, background_load_permill, kill_background_load, pb );
+            nbr_games += job.nbr_done;
+            nbr_promotion_games += job.nbr_promotion_games;
+            keep_masks = keep_masks && job.piece_square_table && 0==memcmp(combos,job.piece_square_table,sizeof(combos));
+            if( keep_masks )
+            {
+                piece_square_game_masks.resize( nbr_games );
+                if( job.nbr_done > 0 )
+                    memcpy( &piece_square_game_masks[job.first], job.piece_square_table + PIECE_SQUARE_NBR_COMBOS*2, job.nbr_done*sizeof(uint64_t) );
+            }
         }
-        if( ch == EOF )
-            cprintf( "Whoops\n" );
-
-        // If reading to append, need to translate header from logN bits to 24 bits
-        if( translate_to_24_bit )
+        if( !keep_masks )
         {
-            const char *game_header_ptr = game_header.c_str();
-            uint32_t x0 = bb.Read(0,game_header_ptr);   cb.bb.Write(0,x0);      // Event
-            uint32_t x1 = bb.Read(1,game_header_ptr);   cb.bb.Write(1,x1);      // Site
-            uint32_t x2 = bb.Read(2,game_header_ptr);   cb.bb.Write(2,x2);      // White
-            uint32_t x3 = bb.Read(3,game_header_ptr);   cb.bb.Write(3,x3);      // Black
-            uint32_t x4 = bb.Read(4,game_header_ptr);   cb.bb.Write(4,x4);      // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-            uint32_t x5 = bb.Read(5,game_header_ptr);   cb.bb.Write(5,x5);      // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb.bb=board(0-1023)
-            uint32_t x6 = bb.Read(6,game_header_ptr);   cb.bb.Write(6,x6);      // ECO For now 500 codes (9 bits) (A..E)(00..99)
-            uint32_t x7 = bb.Read(7,game_header_ptr);   cb.bb.Write(7,x7);      // Result (2 bits)
-            uint32_t x8 = bb.Read(8,game_header_ptr);   cb.bb.Write(8,x8);      // WhiteElo 12 bits (range 0..4095)
-            uint32_t x9 = bb.Read(9,game_header_ptr);   cb.bb.Write(9,x9);      // BlackElo
-            game_header = std::string( cb_ptr, cb_sz );
+            piece_square_masks.Clear();
+            std::vector<uint64_t>().swap( piece_square_game_masks );
         }
+        cprintf( "%d games (%d include promotion)\n", nbr_games, nbr_promotion_games );
+    }
+    else
+    {
+        size_t next_extension = 0;
+        uint32_t segment_end = fh.nbr_games;
+        for( uint32_t i=0; i<game_count; i++ )
+        {
+            while( i==segment_end && next_extension<extensions.size() )
+            {
+                Seek64( fin, extensions[next_extension].games_offset );
+                segment_end += extensions[next_extension++].nbr_games;
+            }
+            if( kill_background_load )
+            {
+                killed = true;
+                break;
+            }
+            if( pb && pb->Perfraction(i,game_count) )
+            {
+                killed = true;
+                break;
+            }
+            char buf[sizeof(cb.bb)];
 
-        uint32_t game_id = base;
-        game_id += (do_reverse ? game_count-1-i : i);
-        std::string blob = game_header + game_moves;
-        ListableGameBinDb info( cb_idx, game_id, blob );
-        make_smart_ptr( ListableGameBinDb, new_info, info );
-        new_info->SetLocked( locked );
-        mega_cache.push_back( std::move(new_info) );
-        int num = i;
-        int den = game_count?game_count:1;
-        if( den > 1000000 )
-            background_load_permill = num / (den/1000);
-        else
-            background_load_permill = (num*1000) / den;
-        nbr_games++;
-        if( info.TestPromotion() )
-            nbr_promotion_games++;
-        if(
+            // Read the game header into a std::string
+            fread( buf, bb_sz, 1, fin );
+            std::string game_header(buf,bb_sz);
+
+            // Read the moves, '\0' terminated string follows game_header
+            std::string game_moves;
+            int ch = fgetc(fin);
+            while( ch && ch!=EOF )
+            {
+                game_moves += static_cast<char>(ch);
+                ch = fgetc(fin);
+            }
+            if( ch == EOF )
+                cprintf( "Whoops\n" );
+
+            // If reading to append, need to translate header from logN bits to 24 bits
+            if( translate_to_24_bit )
+            {
+                const char *game_header_ptr = game_header.c_str();
+                uint32_t x0 = bb.Read(0,game_header_ptr);   cb.bb.Write(0,x0);      // Event
+                uint32_t x1 = bb.Read(1,game_header_ptr);   cb.bb.Write(1,x1);      // Site
+                uint32_t x2 = bb.Read(2,game_header_ptr);   cb.bb.Write(2,x2);      // White
+                uint32_t x3 = bb.Read(3,game_header_ptr);   cb.bb.Write(3,x3);      // Black
+                uint32_t x4 = bb.Read(4,game_header_ptr);   cb.bb.Write(4,x4);      // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+                uint32_t x5 = bb.Read(5,game_header_ptr);   cb.bb.Write(5,x5);      // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb.bb=board(0-1023)
+                uint32_t x6 = bb.Read(6,game_header_ptr);   cb.bb.Write(6,x6);      // ECO For now 500 codes (9 bits) (A..E)(00..99)
+                uint32_t x7 = bb.Read(7,game_header_ptr);   cb.bb.Write(7,x7);      // Result (2 bits)
+                uint32_t x8 = bb.Read(8,game_header_ptr);   cb.bb.Write(8,x8);      // WhiteElo 12 bits (range 0..4095)
+                uint32_t x9 = bb.Read(9,game_header_ptr);   cb.bb.Write(9,x9);      // BlackElo
+                game_header = std::string( cb_ptr, cb_sz );
+            }
+
+            uint32_t game_id = base;
+            game_id += (do_reverse ? game_count-1-i : i);
+            std::string blob = game_header + game_moves;
+            ListableGameBinDb info( cb_idx, game_id, blob );
+            make_smart_ptr( ListableGameBinDb, new_info, info );
+            new_info->SetLocked( locked );
+            mega_cache.push_back( std::move(new_info) );
+            int num = i;
+            int den = game_count?game_count:1;
+            if( den > 1000000 )
+                background_load_permill = num / (den/1000);
+            else
+                background_load_permill = (num*1000) / den;
+            nbr_games++;
+            if( info.TestPromotion() )
+                nbr_promotion_games++;
+            if(
 #ifdef _DEBUG
-            (nbr_games<10000 && (nbr_games%100)==0) ||
+                (nbr_games<10000 && (nbr_games%100)==0) ||
 #endif
-            ((nbr_games%10000) == 0 ) /* ||
-                                        (
-                                        (nbr_games < 100) &&
-                                        ((nbr_games%10) == 0 )
-                                        ) */
-            )
-        {
-            cprintf( "%d games (%d include promotion)\n", nbr_games, nbr_promotion_games );
+                ((nbr_games%10000) == 0 ) /* ||
+                                            (
+                                            (nbr_games < 100) &&
+                                            ((nbr_games%10) == 0 )
+                                            ) */
+                )
+            {
+                cprintf( "%d games (%d include promotion)\n", nbr_games, nbr_promotion_games );
+            }
         }
     }
     if( do_reverse )
         std::reverse( mega_cache.begin(), mega_cache.end() );
+
+    // Each extension's strings follow on from the strings before it
+    for( size_t i=0; i<extensions.size(); i++ )
+    {
+        const FileFooter &ext = extensions[i];
+        Seek64( fin, ext.strings_offset );
+        ReadStrings( fin, ext.nbr_players, cb.players );
+        ReadStrings( fin, ext.nbr_events, cb.events );
+        ReadStrings( fin, ext.nbr_sites, cb.sites );
+        if( ext.nbr_players>0 || ext.nbr_events>0 || ext.nbr_sites>0 )
+            strings_sorted = false;     // but see below
+    }
+
+    // When appending, new strings will be added out of order
+    if( !for_append && !strings_sorted )
+        strings_sorted = StringsSorted(cb.players) && StringsSorted(cb.events) && StringsSorted(cb.sites);
+    cb.strings_sorted = !for_append && strings_sorted;
     if( nbr_games > 0 )
     {
         smart_ptr<ListableGame> p1 = mega_cache[0];
@@ -1867,3 +2636,434 @@ bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<Li
     return killed;
 }
 
+
+// Truncate a file opened for writing, return bool ok
+static bool Truncate64( FILE *f, uint64_t len )
+{
+    fflush( f );
+#ifdef THC_WINDOWS
+    return 0 == _chsize_s( _fileno(f), static_cast<__int64>(len) );
+#else
+    return 0 == ftruncate( fileno(f), static_cast<off_t>(len) );
+#endif
+}
+
+// Give each string in ids the id of the same string in strings if there is one, otherwise
+//  the next id after them, the new strings are added to new_strings (in strcmp() order)
+static void ExtensionStringIds( const std::vector<std::string> &strings, std::map<std::string,int> &ids, std::vector<std::string> &new_strings )
+{
+    for( size_t i=0; i<strings.size(); i++ )
+    {
+        std::map<std::string,int>::iterator it = ids.find( strings[i] );
+        if( it!=ids.end() && it->second<0 )
+            it->second = static_cast<int>(i);
+    }
+    int next_id = strings.size();
+    for( std::map<std::string,int>::iterator it = ids.begin(); it != ids.end(); it++ )
+    {
+        if( it->second < 0 )
+        {
+            it->second = next_id++;
+            new_strings.push_back( it->first );
+        }
+    }
+}
+
+// Write '\0' terminated strings, return the number of bytes written
+static uint64_t WriteStrings( FILE *ofile, const std::vector<std::string> &strings, uint32_t &checksum )
+{
+    uint64_t len = 0;
+    for( size_t i=0; i<strings.size(); i++ )
+    {
+        const char *s = strings[i].c_str();
+        fwrite( s, strlen(s)+1, 1, ofile );
+        checksum = Crc32( checksum, s, strlen(s)+1 );
+        len += strlen(s)+1;
+    }
+    return len;
+}
+
+// Check that the file's (or an extension's) fingerprint table and offset table can be used to
+//  look up games. Return bool ok
+static bool FingerprintTableUsable( const BinDbMappedFile &mf, const FileFooter &ff )
+{
+    uint64_t len = mf.len;
+    bool ok = ( ff.fingerprint_version == DUP_FINGERPRINT_VERSION &&
+                ff.fingerprint_table_size == static_cast<uint64_t>(ff.nbr_games) * (sizeof(uint64_t)+sizeof(uint32_t)) &&
+                (ff.offset_width==4 || ff.offset_width==8) &&
+                ff.offset_table_size == (static_cast<uint64_t>(ff.nbr_games)+1) * ff.offset_width &&
+                ff.games_size<=len               && ff.games_offset<=len-ff.games_size &&
+                ff.offset_table_size<=len        && ff.offset_table_offset<=len-ff.offset_table_size &&
+                ff.fingerprint_table_size<=len   && ff.fingerprint_table_offset<=len-ff.fingerprint_table_size );
+    if( ok )
+        ok = ( ff.fingerprint_table_checksum == Crc32( 0, mf.base+ff.fingerprint_table_offset, static_cast<size_t>(ff.fingerprint_table_size) ) );
+    return ok;
+}
+
+// The piece square combos of the file and its extensions, for the masks of new games. Return
+//  bool ok, false if some part has no piece square table or they don't all use the same combos
+static bool PieceSquareCombos( const BinDbMappedFile &mf, const std::vector<FileFooter> &parts, PieceSquareMasks &psm )
+{
+    uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2];
+    for( size_t i=0; i<parts.size(); i++ )
+    {
+        const FileFooter &ff = parts[i];
+        if( ff.piece_square_table_size != PIECE_SQUARE_NBR_COMBOS*2 + static_cast<uint64_t>(ff.nbr_games)*sizeof(uint64_t) ||
+            ff.piece_square_table_size>mf.len || ff.piece_square_table_offset>mf.len-ff.piece_square_table_size )
+            return false;
+        const char *table = mf.base + ff.piece_square_table_offset;
+        if( i == 0 )
+            memcpy( combos, table, sizeof(combos) );
+        else if( 0 != memcmp(combos,table,sizeof(combos)) )
+            return false;
+    }
+    psm.SetCombos( combos );
+    return true;
+}
+
+// Look up the (sorted) keys in the file's (or an extension's) fingerprint table, and add the
+//  games with those fingerprints to gms, in file order. The games are copied out of the file
+//  and checked in full later, so a record that doesn't look right is simply left out
+static void FingerprintLookup( const BinDbMappedFile &mf, const FileFooter &ff, uint8_t cb_idx, int bb_sz,
+                               const std::vector<uint64_t> &keys, std::vector< smart_ptr<ListableGame> > &gms )
+{
+    const char *table = mf.base + ff.fingerprint_table_offset;
+    const char *game_nbrs = table + static_cast<uint64_t>(ff.nbr_games)*sizeof(uint64_t);
+    std::vector<uint32_t> found;
+    for( size_t i=0; i<keys.size(); i++ )
+    {
+        uint32_t lo=0, hi=ff.nbr_games;
+        while( lo < hi )
+        {
+            uint32_t mid = lo + (hi-lo)/2;
+            uint64_t key;
+            memcpy( &key, table + static_cast<uint64_t>(mid)*sizeof(uint64_t), sizeof(uint64_t) );
+            if( key < keys[i] )
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for( ; lo<ff.nbr_games; lo++ )
+        {
+            uint64_t key;
+            memcpy( &key, table + static_cast<uint64_t>(lo)*sizeof(uint64_t), sizeof(uint64_t) );
+            if( key != keys[i] )
+                break;
+            uint32_t game_nbr;
+            memcpy( &game_nbr, game_nbrs + static_cast<uint64_t>(lo)*sizeof(uint32_t), sizeof(uint32_t) );
+            if( game_nbr < ff.nbr_games )
+                found.push_back( game_nbr );
+        }
+    }
+    std::sort( found.begin(), found.end() );
+    found.erase( std::unique(found.begin(),found.end()), found.end() );
+    const char *games = mf.base + ff.games_offset;
+    const char *offsets = mf.base + ff.offset_table_offset;
+    uint32_t base = GameIdAllocateTop( found.size() );
+    for( size_t i=0; i<found.size(); i++ )
+    {
+        uint64_t offset = OffsetTableEntry( offsets, ff.offset_width, found[i] );
+        uint64_t next   = OffsetTableEntry( offsets, ff.offset_width, found[i]+1 );
+        if( offset>=next || next-offset<=static_cast<uint64_t>(bb_sz) || next>ff.games_size || games[next-1]!='\0' )
+            continue;
+        std::string blob( games+offset, static_cast<size_t>(next-offset-1) );
+        ListableGameBinDb info( cb_idx, base+i, blob );
+        make_smart_ptr( ListableGameBinDb, new_info, info );
+        gms.push_back( std::move(new_info) );
+    }
+}
+
+// Append the games in .pgn files to a database in place. Only the new games (less duplicates
+//  of games already in the database, or of each other) and any new players, events and sites
+//  are written, as an extension after the end of the file (see FOOTER_FLAG_EXTENSION), and
+//  the fingerprint tables mean only existing games that might be duplicates are read, so
+//  adding a few thousand games to a huge database is quick. Returns bool ok, with in_place
+//  false if the database can't be appended to in place (it's locked, it has no footer, or
+//  there are too many new strings for its game header layout) and must be read and written
+//  out again with BinDbRemoveDuplicatesAndWrite() instead
+bool BinDbAppendInPlace( const char *db_file, const std::string *pgn_files, int nbr_pgn_files, const std::string &title,
+                         bool &in_place, std::string &error_msg, wxWindow *window )
+{
+    in_place = false;
+    if( !BinDbOpen( db_file, error_msg ) )
+        return false;
+    FileHeader fh;
+    FileFooter ff;
+    std::vector<FileFooter> extensions;
+    memset( &fh, 0, sizeof(fh) );
+    fseek( bin_file, compatibility_header_size, SEEK_SET );
+    bool ok = ( 1==fread(&fh,sizeof(fh),1,bin_file) && fh.hdr_len==sizeof(FileHeader) && !fh.locked &&
+                ReadFileFooters(bin_file,fh,ff,extensions) );
+    uint64_t file_len = FileLength64( bin_file );
+    if( !ok )
+    {
+        BinDbClose();
+        cprintf( "Cannot append to %s in place\n", db_file );
+        return true;
+    }
+
+    // Step 1, the existing strings. If the file and all its extensions have fingerprint tables,
+    //  that's all for now, only the existing games that might be duplicates are read in step 3.
+    //  Otherwise all the existing games too, straight from the memory mapped file
+    char buf[200];
+    sprintf( buf, "%s, step 1 of 5", title.c_str() );
+    std::vector< smart_ptr<ListableGame> > existing;
+    bool killed = false;
+    uint8_t existing_cb_idx;
+    PieceSquareMasks psm;
+    std::vector<uint64_t> masks;
+    bool have_masks;
+    std::vector<FileFooter> parts( 1, ff );
+    parts.insert( parts.end(), extensions.begin(), extensions.end() );
+    smart_ptr<BinDbMappedFile> mf( new BinDbMappedFile );
+    bool lookup = ( ff.nbr_games==static_cast<uint32_t>(fh.nbr_games) && mf->Map(bin_file) && mf->len==file_len );
+    for( size_t i=0; lookup && i<parts.size(); i++ )
+        lookup = FingerprintTableUsable( *mf, parts[i] );
+    if( lookup )
+    {
+        existing_cb_idx = BinDbReadBegin();
+        PackedGameBinDbControlBlock &cb = PackedGameBinDb::GetControlBlock(existing_cb_idx);
+        cb.bb.Clear();
+        GameHeaderLayout( cb.bb, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
+        cb.bb.Freeze();
+        fseek( bin_file, compatibility_header_size+fh.hdr_len, SEEK_SET );
+        ReadStrings( bin_file, fh.nbr_players, cb.players );
+        ReadStrings( bin_file, fh.nbr_events, cb.events );
+        ReadStrings( bin_file, fh.nbr_sites, cb.sites );
+        for( size_t i=0; i<extensions.size(); i++ )
+        {
+            const FileFooter &ext = extensions[i];
+            Seek64( bin_file, ext.strings_offset );
+            ReadStrings( bin_file, ext.nbr_players, cb.players );
+            ReadStrings( bin_file, ext.nbr_events, cb.events );
+            ReadStrings( bin_file, ext.nbr_sites, cb.sites );
+        }
+        have_masks = PieceSquareCombos( *mf, parts, psm );
+        cprintf( "Appending to %s using fingerprint tables\n", db_file );
+    }
+    else
+    {
+        mf.reset();
+        std::string desc("Reading existing database");
+        ProgressBar progress_bar( buf, desc, true, window );
+        bool locked=false;
+        bool dummyb=false;
+        int dummyi=0;
+        killed = BinDbLoadAllGames( locked, false, existing, dummyi, dummyb, &progress_bar );
+        existing_cb_idx = bin_db_append_cb_idx;
+        BinDbGetPieceSquareMasks( psm, masks );     // only the combos are needed, for the new games' masks
+        have_masks = (masks.size() == existing.size());
+        std::vector<uint64_t>().swap( masks );
+    }
+    BinDbClose();
+    if( killed )
+    {
+        error_msg = "cancel";
+        return false;
+    }
+
+    // Step 2, the new games
+    BinDbReadBegin();
+    for( int i=0; i<nbr_pgn_files; i++ )
+    {
+        FILE *ifile = fopen( pgn_files[i].c_str(), "rt" );
+        if( !ifile )
+        {
+            error_msg = "Cannot open ";
+            error_msg += pgn_files[i];
+            return false;
+        }
+        sprintf( buf, "%s, step 2 of 5", title.c_str() );
+        std::string desc("Reading file #");
+        char buf2[80];
+        sprintf( buf2, "%d of %d", i+1, nbr_pgn_files );
+        desc += buf2;
+        ProgressBar progress_bar( buf, desc, true, window, ifile );
+        uint32_t begin = BinDbGetGamesSize();
+        PgnRead pgn('B',&progress_bar);
+        bool aborted = pgn.Process(ifile);
+        uint32_t end = BinDbGetGamesSize();
+        BinDbNormaliseOrder( begin, end );
+        fclose(ifile);
+        if( aborted )
+        {
+            error_msg = "cancel";
+            return false;
+        }
+    }
+
+    // Step 3, remove duplicates. Only existing games with the same fingerprint as a new game
+    //  can be duplicates of one, find them in file order
+    sprintf( buf, "%s, step 3 of 5", title.c_str() );
+    std::string dup_title(buf);
+    std::vector< smart_ptr<ListableGame> > gms;
+    if( lookup )
+    {
+        std::vector<uint64_t> keys( games.size() );
+        for( size_t i=0; i<games.size(); i++ )
+        {
+            DupFingerprint fp;
+            DupFingerprintCalc( games[i], fp );
+            keys[i] = fp.lo;
+        }
+        std::sort( keys.begin(), keys.end() );
+        keys.erase( std::unique(keys.begin(),keys.end()), keys.end() );
+        int bb_sz = PackedGameBinDb::GetControlBlock(existing_cb_idx).bb.FrozenSize();
+        for( size_t i=0; i<parts.size(); i++ )
+            FingerprintLookup( *mf, parts[i], existing_cb_idx, bb_sz, keys, gms );
+        cprintf( "%d existing games found by fingerprint\n", static_cast<int>(gms.size()) );
+    }
+    else
+    {
+        std::vector<DupFingerprint> new_fingerprints( games.size() );
+        for( size_t i=0; i<games.size(); i++ )
+            DupFingerprintCalc( games[i], new_fingerprints[i] );
+        std::sort( new_fingerprints.begin(), new_fingerprints.end(), predicate_sorts_by_fingerprint );
+        std::string desc("Duplicate Removal - existing games");
+        ProgressBar progress_bar( dup_title, desc, true, window );
+        int nbr_existing = existing.size();
+        for( int i=0; i<nbr_existing; i++ )
+        {
+            if( (i&0xffff)==0 && progress_bar.Perfraction(i,nbr_existing) )
+            {
+                error_msg = "cancel";
+                return false;
+            }
+            const smart_ptr<ListableGame> &p = existing[nbr_existing-1-i];  // existing is newest first
+            DupFingerprint fp;
+            DupFingerprintCalc( p, fp );
+            if( std::binary_search( new_fingerprints.begin(), new_fingerprints.end(), fp, predicate_sorts_by_fingerprint ) )
+                gms.push_back( p );
+        }
+    }
+    size_t first_new = gms.size();
+    gms.insert( gms.end(), games.begin(), games.end() );
+    if( !MarkDuplicates( gms, first_new, dup_title, window ) )
+    {
+        error_msg = "cancel";
+        return false;
+    }
+    std::vector< smart_ptr<ListableGame> > additions;
+    std::vector< smart_ptr<ListableGame> > dups;
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        if( games[i]->game_id == GAME_ID_SENTINEL )
+            dups.push_back( games[i] );
+        else
+            additions.push_back( games[i] );
+    }
+
+    // New players, events and sites are numbered after the existing ones, the new games must
+    //  still fit the file's game header layout
+    PackedGameBinDbControlBlock &cb = PackedGameBinDb::GetControlBlock(existing_cb_idx);
+    std::map<std::string,int> map_player;
+    std::map<std::string,int> map_event;
+    std::map<std::string,int> map_site;
+    for( size_t i=0; i<additions.size(); i++ )
+    {
+        smart_ptr<ListableGame> p = additions[i];
+        map_player[ std::string(p->White()) ] = -1;
+        map_player[ std::string(p->Black()) ] = -1;
+        map_event [ std::string(p->Event()) ] = -1;
+        map_site  [ std::string(p->Site())  ] = -1;
+    }
+    std::vector<std::string> new_players;
+    std::vector<std::string> new_events;
+    std::vector<std::string> new_sites;
+    ExtensionStringIds( cb.players, map_player, new_players );
+    ExtensionStringIds( cb.events,  map_event,  new_events  );
+    ExtensionStringIds( cb.sites,   map_site,   new_sites   );
+    ok = ( BitsRequired(cb.players.size()+new_players.size()) <= BitsRequired(fh.nbr_players) &&
+           BitsRequired(cb.events.size() +new_events.size())  <= BitsRequired(fh.nbr_events)  &&
+           BitsRequired(cb.sites.size()  +new_sites.size())   <= BitsRequired(fh.nbr_sites) );
+
+    // Let go of the existing games, and the mapping, before writing to the file
+    existing.clear();
+    gms.clear();
+    cb.mapped_file.reset();
+    mf.reset();
+    if( !ok )
+    {
+        cprintf( "Cannot append to %s in place, too many new strings\n", db_file );
+        return true;
+    }
+
+    // Step 4, write the extension
+    if( additions.size() > 0 )
+    {
+        FILE *ofile = fopen( db_file, "r+b" );
+        if( !ofile )
+        {
+            error_msg = "Cannot open ";
+            error_msg += db_file;
+            return false;
+        }
+        ok = Seek64( ofile, file_len );
+        sprintf( buf, "%s, step 4 of 5", title.c_str() );
+        std::string desc("Writing new games");
+        ProgressBar progress_bar( buf, desc, false, window );
+        FileFooter ext;
+        memset( &ext, 0, sizeof(ext) );
+        uint64_t posn = file_len;
+        ext.prev_len = file_len;
+        ext.nbr_players = new_players.size();
+        ext.nbr_events  = new_events.size();
+        ext.nbr_sites   = new_sites.size();
+        ext.strings_offset = posn;
+        posn += WriteStrings( ofile, new_players, ext.strings_checksum );
+        posn += WriteStrings( ofile, new_events,  ext.strings_checksum );
+        posn += WriteStrings( ofile, new_sites,   ext.strings_checksum );
+        ext.strings_size = posn - ext.strings_offset;
+        ext.games_offset = posn;
+        BinaryBlock bb;
+        GameHeaderLayout( bb, fh.nbr_players, fh.nbr_events, fh.nbr_sites );
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> checksums;
+        std::vector<uint64_t> fingerprints;
+        uint32_t checksum = 0;
+        int nbr_additions = additions.size();
+        for( int i=0; i<nbr_additions; i++ )
+        {
+            offsets.push_back( posn - ext.games_offset );
+            smart_ptr<ListableGame> p = additions[i];
+            posn += WriteGameRecord( ofile, bb, p, map_event[std::string(p->Event())], map_site[std::string(p->Site())],
+                                     map_player[std::string(p->White())], map_player[std::string(p->Black())], checksum );
+            if( have_masks )
+                masks.push_back( psm.GameMask(p->CompressedMoves()) );
+            DupFingerprint fp;
+            DupFingerprintCalc( p, fp );
+            fingerprints.push_back( fp.lo );
+            if( (i+1)%GAMES_PER_CHECKSUM==0 || i+1==nbr_additions )
+            {
+                checksums.push_back( checksum );
+                checksum = 0;
+            }
+            progress_bar.Perfraction( i, nbr_additions );
+        }
+        offsets.push_back( posn - ext.games_offset );
+        ext.flags = FOOTER_FLAG_EXTENSION;
+        WriteTablesAndFooter( ofile, posn, ext, offsets, checksums, have_masks?&psm:NULL, masks, fingerprints );
+
+        // If anything went wrong, put the file back the way it was
+        ok = ok && 0==fflush(ofile) && 0==ferror(ofile);
+        if( !ok )
+            Truncate64( ofile, file_len );
+        fclose( ofile );
+        if( !ok )
+        {
+            error_msg = "Error writing ";
+            error_msg += db_file;
+            return false;
+        }
+    }
+    in_place = true;
+    cprintf( "%d games appended in place, %d duplicates\n", static_cast<int>(additions.size()), static_cast<int>(dups.size()) );
+
+    // Step 5, optionally save the duplicates
+    if( dups.size() > 0 )
+    {
+        sprintf( buf, "%s, step 5 of 5", title.c_str() );
+        SaveDuplicates( dups, std::string(buf), window );
+    }
+    return true;
+}
@@ -11,11 +11,13 @@
 #include "ProgressBar.h"
 #include "BinaryConversions.h"
 #include "ListableGame.h"
+#include "PieceSquareMask.h"
 
 bool BinDbOpen( const char *db_file, std::string &error_msg );
 void BinDbClose();
 bool BinDbLoadAllGames( bool &locked, bool for_append, std::vector< smart_ptr<ListableGame> > &mega_cache, int &background_load_permill, bool &kill_background_load, ProgressBar *pb=NULL  );
 std::vector< smart_ptr<ListableGame> > &BinDbLoadAllGamesGetVector();
+void BinDbGetPieceSquareMasks( PieceSquareMasks &psm, std::vector<uint64_t> &masks );
 
 bool bin_db_append( const char *fen, const char *event, const char *site, const char *date, const char *round,
                   const char *white, const char *black, const char *result, const char *white_elo, const char *black_elo, const char *eco,
@@ -28,6 +30,8 @@ uint32_t BinDbGetGamesSize();
 void BinDbNormaliseOrder( uint32_t begin, uint32_t end );
 bool BinDbRemoveDuplicatesAndWrite( std::string &title, int step, FILE *ofile, bool locked, wxWindow *window );
 bool BinDbWriteOutToFile( FILE *ofile, int nbr_to_omit_from_end, bool locked, ProgressBar *pb=NULL );
+bool BinDbAppendInPlace( const char *db_file, const std::string *pgn_files, int nbr_pgn_files, const std::string &title,
+                         bool &in_place, std::string &error_msg, wxWindow *window );
 bool PgnStateMachine( FILE *pgn_file, int &typ, char *buf, int buflen );
 
 void Pgn2Tdb( const char *infile, const char *outfile );
@@ -37,5 +41,6 @@ void Tdb2Pgn( FILE *fin, FILE *fout );
 
 int BitsRequired( int max );
 void ReadStrings( FILE *fin, int nbr_strings, std::vector<std::string> &strings );
+uint32_t Crc32( uint32_t crc, const void *buf, size_t len );
 
 #endif  // BINDB_H
@@ -495,11 +495,20 @@ void CreateDatabaseDialog::OnAppendDatabase()
             ok = false;
         }
     }
+
+    // Usually the new games can be added at the end of the file, leaving the existing games
+    //  alone. Otherwise read the whole database and write it out again with the new games
+    bool in_place = false;
     if( ok )
+    {
+        std::string title( "Appending to database" );
+        ok = BinDbAppendInPlace( db_name.c_str(), files, cnt, title, in_place, error_msg, this );
+    }
+    if( ok && !in_place )
     {
         ok = BinDbOpen( db_filename.c_str(), error_msg );
     }
-    if( ok )
+    if( ok && !in_place )
     {
         bool dummyb=false;
         int dummyi=false;
@@ -515,7 +524,7 @@ void CreateDatabaseDialog::OnAppendDatabase()
         BinDbClose();
     }
     FILE *ofile=NULL;
-    if( ok )
+    if( ok && !in_place )
     {
         ofile = fopen( db_name.c_str(), "wb" );
         if( ofile )
@@ -527,7 +536,7 @@ void CreateDatabaseDialog::OnAppendDatabase()
             ok = false;
         }
     }
-    for( int i=0; ok && i<cnt; i++ )
+    for( int i=0; ok && !in_place && i<cnt; i++ )
     {
         FILE *ifile = fopen( files[i].c_str(), "rt" );
         if( !ifile )
@@ -557,7 +566,7 @@ void CreateDatabaseDialog::OnAppendDatabase()
             fclose(ifile);
         }
     }
-    if( ok )
+    if( ok && !in_place )
     {
         std::string title3( "Appending to database");    // Step 3,4 and 5 of 5
         int step=3;
@@ -526,6 +526,7 @@ void Database::Reopen( const char *db_file )
     kill_background_load = false;
     player_search_in_progress = false;
     tiny_db.Init();
+    position_cache.Clear();
 
     // Access the database.
     cprintf( "Database startup %s\n", db_file );
@@ -556,8 +557,13 @@ bool Database::IsSuspended()
 int Database::SetDbPosition( DB_REQ db_req_ )
 {
     this->db_req = db_req_;
-    extern void BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games, bool sort_by_player_name );
-    BinDbDatabaseInitialSort( objs.db->tiny_db.in_memory_game_cache, db_req_==REQ_PLAYERS );
+    extern bool BinDbDatabaseInitialSort( std::vector< smart_ptr<ListableGame> > &games, bool sort_by_player_name );
+    bool resorted = BinDbDatabaseInitialSort( objs.db->tiny_db.in_memory_game_cache, db_req_==REQ_PLAYERS );
+    if( resorted )
+    {
+        tiny_db.ForgetSearch();     // search results index the games, so are no longer valid
+        position_cache.Clear();
+    }
     int nbr = tiny_db.in_memory_game_cache.size();
     if( nbr )
     {
@@ -604,6 +610,7 @@ bool Database::LoadAllGamesForPositionSearch( std::vector< smart_ptr<ListableGam
     bool killed = BinDbLoadAllGames( locked, false, mega_cache, background_load_permill, kill_background_load );
     is_partial_load = killed;
     BinDbClose();
+    tiny_db.AttachDatabaseFile( db_filename, mega_cache );
     int cache_nbr = mega_cache.size();
     cprintf( "Number of games = %d\n", cache_nbr );
     if( cache_nbr > 0 )
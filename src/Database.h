@@ -15,6 +15,7 @@
 #include "thc.h"
 #include "GameDocument.h"
 #include "MemoryPositionSearch.h"
+#include "PositionCache.h"
 #include "GamesCache.h"
 
 enum DB_REQ
@@ -36,6 +37,7 @@ public:
     int  FindPlayer( std::string &name, std::string &current, int start_row, bool white );
     int LoadPlayerGamesWithQuery( std::string &player_name, bool white, std::vector< smart_ptr<ListableGame> > &games );
     MemoryPositionSearch tiny_db;
+    PositionCache position_cache;   // DbDialog results for recently searched positions
     int background_load_permill;
     bool kill_background_load;
     std::string GetStatus();
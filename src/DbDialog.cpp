@@ -23,12 +23,14 @@
 #include "CtrlChessBoard.h"
 #include "DbDialog.h"
 #include "Database.h"
+#include "HeaderQuery.h"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <iterator>
 #include <list>
 #include <algorithm>
+#include <system_error>
 
 // DbDialog constructors
 DbDialog::DbDialog
@@ -50,6 +52,20 @@ DbDialog::DbDialog
     activated_at_least_once = false;
     transpo_activated = false;
     white_player_search = true;
+    header_query_set = false;
+    narrow_code = '\0';
+    background_search_cancel = false;
+    background_search_generation = 0;
+    background_search.SetCancelFlag( &background_search_cancel );
+}
+
+DbDialog::~DbDialog()
+{
+    StopBackgroundSearch();
+
+    // The next dialog starts without a query, so shouldn't reuse the filtered results
+    if( header_query_set )
+        objs.db->tiny_db.ForgetSearch();
 }
 
 void DbDialog::GdvEnumerateGames()
@@ -101,6 +117,17 @@ wxSizer *DbDialog::GdvAddExtraControls( bool WXUNUSED(big_display) )
         //wxSize sz3=reload->GetSize();
         //text_ctrl->SetSize( sz3.x*2, sz3.y );      // temp temp
     }
+    else
+    {
+        // Header query, eg "year >= 2010 and elo >= 2600", to search only some of the games
+        text_ctrl = new wxTextCtrl ( this, ID_DB_TEXT, wxT(""), wxDefaultPosition, sz5, 0 );
+        gdr.RegisterPanelWindow( text_ctrl );
+        vsiz_panel_buttons->Add(text_ctrl, 0, wxALIGN_CENTER_VERTICAL|wxALL, 5);
+        wxButton* filter = new wxButton ( this, ID_DB_SEARCH, wxT("Filter"),
+                                         wxDefaultPosition, wxDefaultSize, 0 );
+        gdr.RegisterPanelWindow( filter );
+        vsiz_panel_buttons->Add(filter, 0, wxALIGN_CENTER_VERTICAL|wxALL, 5);
+    }
 
 
 //    wxStaticText* spacer1 = new wxStaticText( this, wxID_ANY, wxT(""),
@@ -186,6 +213,16 @@ void DbDialog::SetDialogHelp()
         FindWindow(ID_DB_SEARCH)->SetHelpText(search_help);
         FindWindow(ID_DB_SEARCH)->SetToolTip(search_help);
     }
+    else
+    {
+        wxString query_help = "Enter a query to search only some of the database games, eg year >= 2010 and elo >= 2600, or "
+                              "eco in B90-B99 and (white = carlsen or black = carlsen). Leave it empty to search all the games.";
+        wxString filter_help = "Search only the database games that match the query to the left.";
+        FindWindow(ID_DB_TEXT)->SetHelpText(query_help);
+        FindWindow(ID_DB_TEXT)->SetToolTip(query_help);
+        FindWindow(ID_DB_SEARCH)->SetHelpText(filter_help);
+        FindWindow(ID_DB_SEARCH)->SetToolTip(filter_help);
+    }
 }
 
 // Games Dialog Override - One time activation
@@ -329,9 +366,52 @@ void DbDialog::GdvSearch()
             cprintf( "row=%d\n", row );
             Goto(row);
         }
+
+        // Or filter the database games
+        else if( db_req != REQ_PLAYERS )
+            ApplyHeaderQuery( sname );
     }
 }
 
+// Restrict searches of the database to the games a header query selects. The query's
+//  fields are described in HeaderQuery.h
+void DbDialog::ApplyHeaderQuery( const std::string &txt )
+{
+    MemoryPositionSearch &tiny_db = objs.db->tiny_db;
+    HeaderQuery query;
+    std::string error_msg;
+    if( !query.Compile( txt, tiny_db.GetHeaderColumns(), error_msg ) )
+    {
+        wxMessageBox( error_msg.c_str(), "Query not understood", wxOK|wxICON_ERROR, this );
+        return;
+    }
+    StopBackgroundSearch();         // it might be searching the old selection
+    header_query_set = !query.IsEmpty();
+    if( header_query_set )
+        tiny_db.SelectGames( query );
+
+    // Results for the old selection, including the cached results, no longer apply
+    tiny_db.ForgetSearch();
+    objs.db->position_cache.Clear();
+    narrowed_entry = POSITION_CACHE_ENTRY();
+    if( objs.gl->db_clipboard )
+        return;     // the query applies to the database, not the clipboard
+    gc_db_displayed_games.gds.clear();
+    if( db_req == REQ_PATTERN )
+        PatternSearch();
+    else
+        StatsCalculate();
+    Goto(0);
+}
+
+// The database games to search, all of them or those the header query selected
+std::vector< smart_ptr<ListableGame> > *DbDialog::DatabaseSource()
+{
+    if( header_query_set )
+        return objs.db->tiny_db.GetSelectedGames();
+    return &objs.db->tiny_db.in_memory_game_cache;
+}
+
 
 // Games Dialog Override - Save all to a .pgn file
 void DbDialog::GdvSaveAllToAFile()
@@ -380,6 +460,13 @@ void DbDialog::GdvHelpClick()
     "\n\n"
     "You can drill down by clicking on moves in the Next Move box."
     "\n\n"
+    "To search only some of the database games, enter a query and click Filter. For example "
+    "year >= 2010 and elo >= 2600, or eco in B90-B99 and (white = carlsen or black = carlsen). "
+    "The fields are year, elo (both players), white_elo, black_elo, eco, result, white, black, "
+    "player (either player) and event. Conditions combine with and, or, not and parentheses, "
+    "\"last 5 years\" is another useful condition. Clear the query and click Filter to search "
+    "all the games again."
+    "\n\n"
     "You can add games to the clipboard and set the clipboard as the "
     "temporary database so that only games from the clipboard appear "
     "and the drill down stats apply to those games only."
@@ -600,6 +687,8 @@ void DbDialog::CopyOrAdd( bool clear_clipboard )
 void DbDialog::GdvNextMove( int idx )
 {
     dirty = true;
+    StopBackgroundSearch();
+    narrow_code = '\0';
     if( idx==0 && moves_from_base_position.size()>0 )
     {
         moves_from_base_position.pop_back();  // Undo last move
@@ -608,6 +697,7 @@ void DbDialog::GdvNextMove( int idx )
     {
         thc::Move this_one = moves_in_this_position[idx];
         moves_from_base_position.push_back(this_one);
+        narrow_code = codes_in_this_position[idx];
     }
 
     thc::ChessRules cr_to_match = this->cr;
@@ -649,10 +739,10 @@ void DbDialog::StatsCalculate()
 {
     wxString save_title = GetTitle();
     SetTitle("Searching...");
+    StopBackgroundSearch();
+    char narrow = narrow_code;
+    narrow_code = '\0';
 
-    int total_white_wins = 0;
-    int total_black_wins = 0;
-    int total_draws = 0;
     transpositions.clear();
     stats.clear();
     dirty = true;
@@ -662,6 +752,7 @@ void DbDialog::StatsCalculate()
     list_ctrl->SetItemState( track->focus_idx, 0, wxLIST_STATE_FOCUSED );
     list_ctrl->SetItemState( track->focus_idx, 0, wxLIST_STATE_SELECTED );
     thc::ChessRules cr_to_match = this->cr;
+    thc::ChessRules cr_parent = this->cr;
     bool add_go_back = false;
     std::string go_back_string;
     for( size_t i=0; i<moves_from_base_position.size(); i++ )
@@ -669,6 +760,7 @@ void DbDialog::StatsCalculate()
         thc::Move mv = moves_from_base_position[i];
         if( i+1 == moves_from_base_position.size() )
         {
+            cr_parent = cr_to_match;
             std::string s = mv.NaturalOut(&cr_to_match);
             LangOut(s);
             if( !cr_to_match.white )
@@ -696,6 +788,7 @@ void DbDialog::StatsCalculate()
         do_partial_search = false;
     }
     int game_count = 0;
+    const POSITION_CACHE_ENTRY *cached = NULL;
 
     // The fast MemoryPositionSearch facility was developed to scan all the games in a tiny database,
     //  but once it was available it made sense to apply it to searching for positions in any game
@@ -714,12 +807,29 @@ void DbDialog::StatsCalculate()
     else
     {
         bool search_needed = !mps->IsThisSearchPosition(cr_to_match);
+
+        // Going back to a recently visited position costs nothing
+        cached = objs.db->position_cache.Lookup( cr_to_match, DatabaseSource() );
+        if( cached && (search_needed || mps->IsSearchNarrowed()) )
+        {
+            mps->RestoreSearch( cr_to_match, cached->games_found, cached->table );
+            search_needed = false;
+        }
         cprintf( "search_needed = %s\n", search_needed?"true":"false" );
+
+        // Stepping forward from the last search position, the games that reach the new position
+        //  are (transpositions apart) the games found last time that continue with the move
+        //  played. Show those immediately, and find any transpositions in the background
+        if( search_needed && narrow && mps->IsThisSearchPosition(cr_parent) && mps->NarrowSearch(cr_to_match,narrow) )
+        {
+            search_needed = false;
+            StartBackgroundSearch( cr_to_match );
+        }
         if( search_needed )
         {
             ProgressBar progress2("Searching Database", "Searching",false);
             //progress2.DrawNow();
-            game_count = mps->DoSearch(cr_to_match,&progress2);
+            game_count = mps->DoSearch(cr_to_match,&progress2,DatabaseSource());
         }
     }
 
@@ -727,87 +837,36 @@ void DbDialog::StatsCalculate()
     std::vector<DoSearchFoundGame>          &found_games = mps->GetVectorGamesFound();
     size_t nbr_found_games = found_games.size();
 
+    // The search calculates the next move stats and transpositions as it finds the games
+    MpsMoveTable &table = mps->GetMoveTable();
     {
-        ProgressBar progress("Calculating Stats","Calculating Stats",false);
         for( size_t i=0; i<nbr_found_games; i++ )
+            temp.gds.push_back( db_games[ found_games[i].idx ] );
+        stats = table.moves;
+        std::map< std::string, int >::iterator it2;
+        for( it2=table.paths.begin(); it2!=table.paths.end(); it2++ )
         {
-            double permill = (static_cast<double>(i) * 1000.0) / static_cast<double>(nbr_found_games);
-            progress.Permill( static_cast<int>(permill) );
-            int idx                   = found_games[i].idx;
-            unsigned short offset_first = found_games[i].offset_first;
-            unsigned short offset_last  = found_games[i].offset_last;
-            temp.gds.push_back(db_games[idx]);
-            std::string blob = db_games[idx]->CompressedMoves();
-
-            // Search for a match to this game
-            bool new_transposition_found=false;
-            bool found=false;
-            int found_idx=0;
-            for( size_t j=0; !found && j<transpositions.size(); j++ )
-            {
-                size_t len = transpositions[j].blob.size();
-                if( len <= blob.size() )
-                {
-                    std::string s1 = blob.substr(0,len);
-                    std::string s2 = transpositions[j].blob;
-                    if( s1 == s2 )
-                    {
-                        found = true;
-                        found_idx = j;
-                    }
-                }
-            }
-
-            // If none so far add the one from this game
-            if( !found )
-            {
-                new_transposition_found = true;
-                PATH_TO_POSITION ptp;
-                ptp.blob = blob.substr(0,offset_first);
-                transpositions.push_back(ptp);
-                found_idx = transpositions.size()-1;
-            }
-            const char *result = db_games[idx]->Result();
-            bool white_wins = (0==strcmp(result,"1-0"));
-            if( white_wins )
-                total_white_wins++;
-            bool black_wins = (0==strcmp(result,"0-1"));
-            if( black_wins )
-                total_black_wins++;
-            bool draw       = (0==strcmp(result,"1/2-1/2"));
-            if( draw )
-                total_draws++;
-            PATH_TO_POSITION *p = &transpositions[found_idx];
-            p->frequency++;
-            if( offset_last < blob.length() ) // must be more moves
-            {
-                char compressed_move = blob[offset_last];
-                std::map< char, MOVE_STATS >::iterator it;
-                it = stats.find(compressed_move);
-                if( it == stats.end() )
-                {
-                    MOVE_STATS empty;
-                    empty.nbr_games = 0;
-                    empty.nbr_white_wins = 0;
-                    empty.nbr_black_wins = 0;
-                    empty.nbr_draws = 0;
-                    stats[compressed_move] = empty;
-                    it = stats.find(compressed_move);
-                }
-                it->second.nbr_games++;
-                if( white_wins )
-                    it->second.nbr_white_wins++;
-                else if( black_wins )
-                    it->second.nbr_black_wins++;
-                else if( draw )
-                    it->second.nbr_draws++;
-            }
+            PATH_TO_POSITION ptp;
+            ptp.blob = it2->first;
+            ptp.frequency = it2->second;
+            transpositions.push_back(ptp);
+        }
 
-            // For speed, have the most frequent transpositions first
-            if( new_transposition_found )
-            {
-                std::sort( transpositions.rbegin(), transpositions.rend() );
-            }
+        // Cache the results, unless they might be missing transpositions (in which case the
+        //  background search will cache them if it doesn't find any more games), or the search
+        //  was cancelled
+        if( !do_partial_search && !cached && mps->IsThisSearchPosition(cr_to_match) )
+        {
+            POSITION_CACHE_ENTRY entry;
+            entry.position         = cr_to_match;
+            entry.source           = DatabaseSource();
+            entry.nbr_source_games = DatabaseSource()->size();
+            entry.games_found      = found_games;
+            entry.table            = table;
+            if( mps->IsSearchNarrowed() )
+                std::swap( narrowed_entry, entry );
+            else
+                objs.db->position_cache.Insert( entry );
         }
 
         // Play through the current game, and find the last instance of a user move in this position
@@ -827,6 +886,7 @@ void DbDialog::StatsCalculate()
         std::multimap< MOVE_STATS,  char > dst = flip_and_sort_map(stats);
         std::multimap< MOVE_STATS,  char >::reverse_iterator it;
         moves_in_this_position.clear();
+        codes_in_this_position.clear();
         wxArrayString strings_stats;
         for( it=dst.rbegin(); it!=dst.rend(); it++ )
         {
@@ -835,6 +895,8 @@ void DbDialog::StatsCalculate()
             int nbr_white_wins = it->first.nbr_white_wins;
             int nbr_black_wins = it->first.nbr_black_wins;
             int nbr_draws      = it->first.nbr_draws;
+            int average_elo    = it->first.AverageElo();
+            int performance    = it->first.Performance();
             int draws_plus_no_result = nbr_games - nbr_white_wins - nbr_black_wins;
             if( nbr_games )
                 percentage_score = ((1.0*nbr_white_wins + 0.5*draws_plus_no_result) * 100.0) / nbr_games;
@@ -847,8 +909,10 @@ void DbDialog::StatsCalculate()
                 wxString wstr( go_back_string.c_str() );
                 strings_stats.Add(wstr);
                 moves_in_this_position.push_back(mv);
+                codes_in_this_position.push_back('\0');
             }
             moves_in_this_position.push_back(mv);
+            codes_in_this_position.push_back(compressed_move);
             std::string s = mv.NaturalOut(&cr_to_match);
             LangOut(s);
             if( !cr_to_match.white )
@@ -861,6 +925,10 @@ void DbDialog::StatsCalculate()
                     nbr_games==1 ? "game" : "games",
                     percentage_score,
                     nbr_white_wins, nbr_black_wins, nbr_draws );
+            if( average_elo )
+                sprintf( buf+strlen(buf), ", avg Elo %d", average_elo );
+            if( performance )
+                sprintf( buf+strlen(buf), ", perf %d", performance );
             cprintf( "%s\n", buf );
             wxString wstr(buf);
             strings_stats.Add(wstr);
@@ -902,12 +970,15 @@ void DbDialog::StatsCalculate()
 
         char buf[1000];
         int total_games  = temp.gds.size();
+        int total_white_wins = table.total.nbr_white_wins;
+        int total_black_wins = table.total.nbr_black_wins;
+        int total_draws      = table.total.nbr_draws;
         int total_draws_plus_no_result = total_games - total_white_wins - total_black_wins;
         double percent_score=0.0;
         if( total_games )
             percent_score= ((1.0*total_white_wins + 0.5*total_draws_plus_no_result) * 100.0) / total_games;
         sprintf( buf, "%s%d %s, white scores %.1f%% +%d -%d =%d",
-                objs.gl->db_clipboard ? "Clipboard search: " : "",
+                objs.gl->db_clipboard ? "Clipboard search: " : (header_query_set ? "Filtered: " : ""),
                 total_games,
                 total_games==1 ? "game" : "games",
                 percent_score,
@@ -945,9 +1016,61 @@ void DbDialog::StatsCalculate()
     SetTitle(save_title);
 }
 
+// Complete narrowed search results with a full search in the background. The full search runs
+//  on a single thread of its own so the dialog stays responsive
+void DbDialog::StartBackgroundSearch( const thc::ChessPosition &cp )
+{
+    StopBackgroundSearch();
+    background_search_position = cp;
+    background_search_cancel = false;
+    background_search_generation++;
+    background_search.SetParallelSearch( false );
+    try
+    {
+        background_search_thread = std::thread( BackgroundSearchWorker, this, background_search_generation );
+    }
+    catch( std::system_error & )
+    {
+        cprintf( "Background search not started\n" );
+    }
+}
+
+void DbDialog::StopBackgroundSearch()
+{
+    if( background_search_thread.joinable() )
+    {
+        background_search_cancel = true;
+        background_search_thread.join();
+    }
+}
+
+void DbDialog::BackgroundSearchWorker( DbDialog *dialog, int generation )
+{
+    dialog->background_search.DoSearch( dialog->background_search_position, NULL, dialog->DatabaseSource() );
+    if( !dialog->background_search_cancel )
+        dialog->CallAfter( &DbDialog::BackgroundSearchDone, generation );
+}
+
+// Back on the GUI thread, if the background search found more games recalculate the stats
+void DbDialog::BackgroundSearchDone( int generation )
+{
+    if( generation!=background_search_generation || !background_search_thread.joinable() )
+        return;     // superseded by a later search
+    background_search_thread.join();
+    if( background_search.IsThisSearchPosition(background_search_position) )
+    {
+        bool changed = objs.db->tiny_db.CompleteNarrowedSearch( background_search_position, background_search.GetVectorGamesFound(), background_search.GetMoveTable() );
+        if( changed )
+            StatsCalculate();
+        else if( narrowed_entry.source && narrowed_entry.position == background_search_position )
+            objs.db->position_cache.Insert( narrowed_entry );  // the narrowed results were complete
+    }
+}
+
 // Search for patterns
 void DbDialog::PatternSearch()
 {
+    StopBackgroundSearch();
     gc_db_displayed_games.gds.clear();
     cprintf( "Remove focus %d\n", track->focus_idx );
     list_ctrl->SetItemState( track->focus_idx, 0, wxLIST_STATE_FOCUSED );
@@ -985,7 +1108,7 @@ void DbDialog::PatternSearch()
     else
     {
         ProgressBar progress2("Searching", "Searching",false);
-        game_count = mps->DoPatternSearch(pm,&progress2,stats_);
+        game_count = mps->DoPatternSearch(pm,&progress2,stats_,DatabaseSource());
     }
 
     std::vector< smart_ptr<ListableGame> >  &db_games    = mps->GetVectorSourceGames();
@@ -1013,7 +1136,7 @@ void DbDialog::PatternSearch()
     if( total_games )
         percent_score= ((1.0*stats_.white_wins + 0.5*total_draws_plus_no_result) * 100.0) / total_games;
     sprintf( base, "%s%d %s, white scores %.1f%% +%d -%d =%d",
-            objs.gl->db_clipboard ? "Clipboard search: " : "",
+            objs.gl->db_clipboard ? "Clipboard search: " : (header_query_set ? "Filtered: " : ""),
             total_games,
             total_games==1 ? "game" : "games",
             percent_score,
@@ -7,6 +7,8 @@
 #ifndef DB_DIALOG_H
 #define DB_DIALOG_H
 #include <unordered_set>
+#include <thread>
+#include <atomic>
 #include "wx/spinctrl.h"
 #include "wx/statline.h"
 #include "wx/accel.h"
@@ -23,33 +25,6 @@
 #include "GamesDialog.h"
 
 
-// Each move in a given position has stats associated with it
-struct MOVE_STATS
-{
-    int nbr_games;
-    int nbr_white_wins;
-    int nbr_black_wins;
-    int nbr_draws;
-
-    // Sort according to number of games
-    bool operator < (const MOVE_STATS& ms)  const { return nbr_games < ms.nbr_games; }
-    bool operator > (const MOVE_STATS& ms)  const { return nbr_games > ms.nbr_games; }
-    bool operator == (const MOVE_STATS& ms) const { return nbr_games == ms.nbr_games; }
-};
-
-// Individual path to a given position
-struct PATH_TO_POSITION
-{
-    PATH_TO_POSITION() { frequency=0; }
-    int frequency;
-    std::string blob;
-
-    // Sort according to frequency
-    bool operator < (const PATH_TO_POSITION& ptp)  const { return frequency < ptp.frequency; }
-    bool operator > (const PATH_TO_POSITION& ptp)  const { return frequency > ptp.frequency; }
-    bool operator == (const PATH_TO_POSITION& ptp) const { return frequency == ptp.frequency; }
-};
-
 // DbDialog class declaration
 class DbDialog : public GamesDialog
 {
@@ -66,7 +41,7 @@ public:
         const wxPoint& pos = wxDefaultPosition,
         const wxSize& size = wxDefaultSize
     );
-    virtual ~DbDialog() {}
+    virtual ~DbDialog();
 
     // We calculate a vector of all blobs in the games that leading to the search position
     std::vector< PATH_TO_POSITION > transpositions;
@@ -100,6 +75,18 @@ public:
     void StatsCalculate();
     void PatternSearch();
 
+    // Restrict searches of the database to the games a header query selects (all the games
+    //  if the query is empty)
+    void ApplyHeaderQuery( const std::string &txt );
+    std::vector< smart_ptr<ListableGame> > *DatabaseSource();
+
+    // Stepping forward a move narrows the previous search results, a full search in the
+    //  background then adds any games that reach the position by transposition
+    void StartBackgroundSearch( const thc::ChessPosition &cp );
+    void StopBackgroundSearch();
+    void BackgroundSearchDone( int generation );
+    static void BackgroundSearchWorker( DbDialog *dialog, int generation );
+
     // Sets the help text for the dialog controls
     void SetDialogHelp();
 
@@ -107,8 +94,17 @@ public:
 private:
     std::map< char, MOVE_STATS > stats; // map each compressed move in the position to move stats
     bool white_player_search;
+    bool header_query_set;                          // database searches are of the games tiny_db.SelectGames() selected
     std::vector<thc::Move> moves_in_this_position;
+    std::vector<char>      codes_in_this_position;  // compressed move for each of the above ('\0' for go back)
     std::vector<thc::Move> moves_from_base_position;
+    char narrow_code;                               // compressed move just played, if the results can be narrowed
+    std::thread        background_search_thread;
+    std::atomic<bool>  background_search_cancel;
+    int                background_search_generation;
+    thc::ChessPosition background_search_position;
+    MemoryPositionSearch background_search;
+    POSITION_CACHE_ENTRY narrowed_entry;            // results to cache once the background search confirms them
     GamesCache gc_db_displayed_games;
     PatternMatch pm;
 };
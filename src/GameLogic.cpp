@@ -45,6 +45,7 @@
 #include "CompressMoves.h"
 #include "Tabs.h"
 #include "Database.h"
+#include "RepertoireReport.h"
 using namespace std;
 using namespace thc;
 
@@ -1114,6 +1115,60 @@ void GameLogic::CmdDatabaseMaterial()
     }
 }
 
+// Annotate a copy of the current game, presumably a repertoire with lots of variations, with
+//  the database games for each position and opens it in a new tab
+void GameLogic::CmdDatabaseRepertoire()
+{
+    cprintf( "CmdDatabaseRepertoire(): May wait for tiny database load here...\n" );
+    extern wxMutex *WaitForWorkerThread( const char *title );
+    wxMutex *ptr_mutex_tiny_database = WaitForWorkerThread( "Completing Initial Database Load" );
+    wxMutexLocker lock(*ptr_mutex_tiny_database);
+    std::string error_msg;
+    if( objs.db->IsSuspended() || !objs.db->IsOperational(error_msg) )
+    {
+        wxMessageBox(
+            "The database is not currently running. To correct this select a database "
+            "using the 'Select current database' command in the database menu", "Database problem", wxOK|wxICON_ERROR
+        );
+        return;
+    }
+    if( gd.IsEmpty() )
+    {
+        wxMessageBox(
+            "First open or create the repertoire, a game with a variation for every line you play. "
+            "The report is a copy of it with the database games, white's score and the most popular moves "
+            "it doesn't cover commented after every move", "Repertoire coverage report", wxOK|wxICON_INFORMATION
+        );
+        return;
+    }
+    Atomic begin;
+    GameDocument report = gd;
+    RepertoireReport rr;
+    bool ok;
+    {
+        ProgressBar progress_bar( "Repertoire coverage report", "Searching database for every position in the repertoire", true, objs.frame );
+        ok = rr.Annotate( report.tree, report.start_position, objs.db->tiny_db, &progress_bar );
+    }
+    if( ok )
+    {
+        // The report is a new game, not an edit of the repertoire
+        report.game_being_edited = 0;
+        report.pgn_handle = 0;
+        report.modified = true;
+        report.Rebuild();
+        objs.session->SaveGame(&gd);
+        PutBackDocument();
+        tabs->TabNew(report);
+        ShowNewDocument();
+        char buf[400];
+        sprintf( buf, "%d of the %d positions in the repertoire occur in database games. Database moves not covered by "
+                      "the repertoire: %d. Use File > Save as to export the report to a .pgn file",
+                      rr.nbr_positions_found, rr.nbr_positions, rr.nbr_uncovered );
+        wxMessageBox( buf, "Repertoire coverage report", wxOK|wxICON_INFORMATION );
+    }
+    atom.StatusUpdate();
+}
+
 void GameLogic::CmdDatabaseShowAll()
 {
     thc::ChessRules cr;
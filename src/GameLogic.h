@@ -100,6 +100,7 @@ public:
     void CmdDatabaseAppend();
     void CmdDatabasePattern();
     void CmdDatabaseMaterial();
+    void CmdDatabaseRepertoire();
 
     void CmdDatabase( thc::ChessRules &cr, DB_REQ db_req, PatternParameters *parm=NULL );
     void CmdNextGame();
@@ -0,0 +1,203 @@
+/****************************************************************************
+ * HeaderColumns - Game headers column by column, for fast filtering
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include "DebugPrintf.h"
+#include "BinaryConversions.h"
+#include "HeaderColumns.h"
+
+void HeaderColumns::Clear()
+{
+    cb_idx = 0;
+    cb_idx_valid = false;
+    std::vector<uint32_t>().swap( dates );
+    std::vector<uint16_t>().swap( white_elos );
+    std::vector<uint16_t>().swap( black_elos );
+    std::vector<uint16_t>().swap( ecos );
+    std::vector<uint8_t>().swap( results );
+    std::vector<uint32_t>().swap( whites );
+    std::vector<uint32_t>().swap( blacks );
+    std::vector<uint32_t>().swap( events );
+}
+
+// The nbr_games games from the database file have ids counting down from first_game_id in file
+//  order, they can be in any order in games (eg after a sort)
+void HeaderColumns::Build( const std::vector< smart_ptr<ListableGame> > &games, uint32_t first_game_id, size_t nbr_games )
+{
+    Clear();
+    size_t n = nbr_games;
+    if( n==0 || games.size()==0 )
+        return;
+    cb_idx_valid = games[0]->UsesControlBlock( cb_idx );
+    dates.resize( n );
+    white_elos.resize( n );
+    black_elos.resize( n );
+    ecos.resize( n, 500 );      // 500 is empty
+    results.resize( n );
+    whites.resize( n );
+    blacks.resize( n );
+    events.resize( n );
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        ListableGame *p = games[i].get();
+        uint32_t idx = first_game_id - p->game_id;
+        if( p->game_id>first_game_id || idx>=n )
+            continue;   // not from the database file
+        dates[idx]      = p->DateBin();
+        white_elos[idx] = p->WhiteEloBin();
+        black_elos[idx] = p->BlackEloBin();
+        ecos[idx]       = p->EcoBin();
+        results[idx]    = p->ResultBin();
+        whites[idx]     = p->WhiteBin();
+        blacks[idx]     = p->BlackBin();
+        events[idx]     = p->EventBin();
+    }
+}
+
+void HeaderFilter::AddRange( HEADER_FIELD field, uint32_t lo, uint32_t hi )
+{
+    RANGE range;
+    range.field = field;
+    range.lo = lo;
+    range.hi = hi;
+    ranges.push_back( range );
+}
+
+void HeaderFilter::AddIds( HEADER_FIELD field, const std::vector<uint8_t> &ids )
+{
+    ID_SET id_set;
+    id_set.field = field;
+    id_set.ids = ids;
+    id_sets.push_back( id_set );
+}
+
+void HeaderFilter::Add( const HeaderFilter &other )
+{
+    ranges.insert( ranges.end(), other.ranges.begin(), other.ranges.end() );
+    id_sets.insert( id_sets.end(), other.id_sets.begin(), other.id_sets.end() );
+}
+
+// Year 0 in a date means unknown, so an unknown year is only in the range if lo is 1500 or
+//  earlier
+void HeaderFilter::AddYears( int lo, int hi )
+{
+    lo = lo<1500 ? 0 : (lo>2523 ? 1023 : lo-1500);
+    hi = hi<1500 ? 0 : (hi>2523 ? 1023 : hi-1500);
+    AddRange( HF_DATE, lo<<9, (hi<<9) | 0x1ff );
+}
+
+void HeaderFilter::AddEcos( const char *lo, const char *hi )
+{
+    AddRange( HF_ECO, Eco2Bin(lo), Eco2Bin(hi) );
+}
+
+void HeaderFilter::AddMinElo( int elo )
+{
+    AddRange( HF_WHITE_ELO, elo, 4095 );
+    AddRange( HF_BLACK_ELO, elo, 4095 );
+}
+
+// (value-lo) <= (hi-lo) as unsigned is lo <= value <= hi, with no branch
+template <class T> static void AndRange( uint8_t *selected, const T *column, size_t n, uint32_t lo, uint32_t hi )
+{
+    uint32_t width = hi-lo;
+    for( size_t i=0; i<n; i++ )
+        selected[i] &= (static_cast<uint32_t>(column[i])-lo <= width);
+}
+
+static void AndIds( uint8_t *selected, const uint32_t *column, size_t n, const std::vector<uint8_t> &ids )
+{
+    const uint8_t *lookup = ids.size() ? &ids[0] : NULL;
+    uint32_t nbr_ids = ids.size();
+    for( size_t i=0; i<n; i++ )
+    {
+        uint32_t id = column[i];
+        selected[i] &= (id<nbr_ids && lookup[id]);
+    }
+}
+
+void HeaderFilter::Evaluate( const HeaderColumns &columns, std::vector<uint8_t> &selected ) const
+{
+    size_t n = columns.NbrGames();
+    selected.assign( n, 1 );
+    if( n == 0 )
+        return;
+    uint8_t *sel = &selected[0];
+    for( size_t i=0; i<ranges.size(); i++ )
+    {
+        const RANGE &r = ranges[i];
+        if( r.lo > r.hi )
+        {
+            selected.assign( n, 0 );
+            return;
+        }
+        switch( r.field )
+        {
+            case HF_DATE:       AndRange( sel, &columns.dates[0],      n, r.lo, r.hi );  break;
+            case HF_WHITE_ELO:  AndRange( sel, &columns.white_elos[0], n, r.lo, r.hi );  break;
+            case HF_BLACK_ELO:  AndRange( sel, &columns.black_elos[0], n, r.lo, r.hi );  break;
+            case HF_ECO:        AndRange( sel, &columns.ecos[0],       n, r.lo, r.hi );  break;
+            case HF_RESULT:     AndRange( sel, &columns.results[0],    n, r.lo, r.hi );  break;
+            case HF_WHITE:      AndRange( sel, &columns.whites[0],     n, r.lo, r.hi );  break;
+            case HF_BLACK:      AndRange( sel, &columns.blacks[0],     n, r.lo, r.hi );  break;
+            case HF_EVENT:      AndRange( sel, &columns.events[0],     n, r.lo, r.hi );  break;
+        }
+    }
+    for( size_t i=0; i<id_sets.size(); i++ )
+    {
+        const ID_SET &s = id_sets[i];
+        switch( s.field )
+        {
+            case HF_WHITE:      AndIds( sel, &columns.whites[0], n, s.ids );  break;
+            case HF_BLACK:      AndIds( sel, &columns.blacks[0], n, s.ids );  break;
+            case HF_EVENT:      AndIds( sel, &columns.events[0], n, s.ids );  break;
+            default:            selected.assign( n, 0 );  return;   // ids are for players and events only
+        }
+    }
+}
+
+bool HeaderFilter::Match( ListableGame *p, uint8_t cb_idx, bool cb_idx_valid ) const
+{
+    uint8_t game_cb_idx = 0;
+    bool same_ids = cb_idx_valid && p->UsesControlBlock(game_cb_idx) && game_cb_idx==cb_idx;
+    for( size_t i=0; i<ranges.size(); i++ )
+    {
+        const RANGE &r = ranges[i];
+        bool is_id = (r.field==HF_WHITE || r.field==HF_BLACK || r.field==HF_EVENT);
+        if( is_id && !same_ids )
+            return false;
+        uint32_t value = 0;
+        switch( r.field )
+        {
+            case HF_DATE:       value = p->DateBin();       break;
+            case HF_WHITE_ELO:  value = p->WhiteEloBin();   break;
+            case HF_BLACK_ELO:  value = p->BlackEloBin();   break;
+            case HF_ECO:        value = p->EcoBin();        break;
+            case HF_RESULT:     value = p->ResultBin();     break;
+            case HF_WHITE:      value = p->WhiteBin();      break;
+            case HF_BLACK:      value = p->BlackBin();      break;
+            case HF_EVENT:      value = p->EventBin();      break;
+        }
+        if( value<r.lo || value>r.hi )
+            return false;
+    }
+    for( size_t i=0; i<id_sets.size(); i++ )
+    {
+        const ID_SET &s = id_sets[i];
+        if( !same_ids )
+            return false;
+        uint32_t id = 0;
+        switch( s.field )
+        {
+            case HF_WHITE:      id = p->WhiteBin();     break;
+            case HF_BLACK:      id = p->BlackBin();     break;
+            case HF_EVENT:      id = p->EventBin();     break;
+            default:            return false;
+        }
+        if( id>=s.ids.size() || !s.ids[id] )
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+/****************************************************************************
+ * HeaderColumns - Game headers column by column, for fast filtering
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef HEADER_COLUMNS_H
+#define HEADER_COLUMNS_H
+#include <stdint.h>
+#include <vector>
+#include "ListableGame.h"
+
+// The headers of the games loaded from the database file, one array per field, in .tdb file
+//  order (see MemoryPositionSearch::FileIdx()). Filled once, when first needed, so a filter
+//  reads contiguous memory a field at a time, rather than unpacking each game's bit packed
+//  fields through a virtual call per value. Values are in the binary formats of
+//  BinaryConversions.h, players and events are ids in the database file's control block
+class HeaderColumns
+{
+public:
+    HeaderColumns() { cb_idx=0; cb_idx_valid=false; }
+    void Clear();
+    void Build( const std::vector< smart_ptr<ListableGame> > &games, uint32_t first_game_id, size_t nbr_games );
+    size_t NbrGames() const { return dates.size(); }
+
+    uint8_t  cb_idx;            // control block the player and event ids refer to
+    bool     cb_idx_valid;
+    std::vector<uint32_t> dates;
+    std::vector<uint16_t> white_elos;
+    std::vector<uint16_t> black_elos;
+    std::vector<uint16_t> ecos;
+    std::vector<uint8_t>  results;
+    std::vector<uint32_t> whites;
+    std::vector<uint32_t> blacks;
+    std::vector<uint32_t> events;
+};
+
+enum HEADER_FIELD
+{
+    HF_DATE, HF_WHITE_ELO, HF_BLACK_ELO, HF_ECO, HF_RESULT, HF_WHITE, HF_BLACK, HF_EVENT
+};
+
+// A filter is a list of conditions, all of which a game must meet. Evaluate() applies the
+//  conditions a column at a time to all the games, branch free, so the compiler can
+//  vectorise the inner loops
+class HeaderFilter
+{
+public:
+    bool IsEmpty() const { return ranges.size()==0 && id_sets.size()==0; }
+    void Clear() { ranges.clear(); id_sets.clear(); }
+
+    // Games with the field in the range lo to hi inclusive
+    void AddRange( HEADER_FIELD field, uint32_t lo, uint32_t hi );
+
+    // Games with the player or event field one of the ids, ids[id] is non zero for each
+    void AddIds( HEADER_FIELD field, const std::vector<uint8_t> &ids );
+
+    // All the conditions of another filter too
+    void Add( const HeaderFilter &other );
+
+    // Some common conditions
+    void AddYears( int lo, int hi );                // eg 2015,9999 = 2015 or later
+    void AddEcos( const char *lo, const char *hi ); // eg "B90","B99"
+    void AddMinElo( int elo );                      // both players
+
+    // Set selected[i] to 1 if the i'th game meets all the conditions, otherwise 0
+    void Evaluate( const HeaderColumns &columns, std::vector<uint8_t> &selected ) const;
+
+    // Check one game, for games that are not in the columns. Games from a control block
+    //  other than the one the player and event ids refer to can't meet those conditions
+    bool Match( ListableGame *p, uint8_t cb_idx, bool cb_idx_valid ) const;
+
+private:
+    struct RANGE
+    {
+        HEADER_FIELD field;
+        uint32_t lo;
+        uint32_t hi;
+    };
+    struct ID_SET
+    {
+        HEADER_FIELD field;
+        std::vector<uint8_t> ids;
+    };
+    std::vector<RANGE>  ranges;
+    std::vector<ID_SET> id_sets;
+};
+
+#endif  // HEADER_COLUMNS_H
@@ -0,0 +1,546 @@
+/****************************************************************************
+ * HeaderQuery - A little query language over game headers
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "DebugPrintf.h"
+#include "BinaryConversions.h"
+#include "PackedGameBinDb.h"
+#include "HeaderQuery.h"
+
+static std::string Lower( const std::string &s )
+{
+    std::string lower = s;
+    for( size_t i=0; i<lower.length(); i++ )
+        lower[i] = tolower( static_cast<unsigned char>(lower[i]) );
+    return lower;
+}
+
+bool HeaderQuery::Compile( const std::string &txt, const HeaderColumns &columns, std::string &error_msg )
+{
+    plan.clear();
+    error.clear();
+    compile_columns = &columns;
+    bool ok = Tokenise(txt);
+    next = 0;
+    if( ok && tokens[0].type!=TOKEN_END )
+    {
+        ok = ParseOr();
+        if( ok && tokens[next].type!=TOKEN_END )
+        {
+            error = "Unexpected '" + tokens[next].txt + "'";
+            ok = false;
+        }
+    }
+    tokens.clear();
+    if( !ok )
+    {
+        plan.clear();
+        error_msg = error;
+    }
+    return ok;
+}
+
+bool HeaderQuery::Tokenise( const std::string &txt )
+{
+    tokens.clear();
+    size_t len = txt.length();
+    size_t i=0;
+    while( i < len )
+    {
+        char c = txt[i];
+        TOKEN token;
+        token.quoted = false;
+        if( isspace(static_cast<unsigned char>(c)) )
+        {
+            i++;
+            continue;
+        }
+        if( c=='(' || c==')' )
+        {
+            token.type = (c=='(' ? TOKEN_LPAREN : TOKEN_RPAREN);
+            token.txt = c;
+            i++;
+        }
+        else if( c=='<' || c=='>' || c=='=' || c=='!' )
+        {
+            token.type = TOKEN_OP;
+            token.txt = c;
+            i++;
+            if( i<len && txt[i]=='=' && c!='=' )
+                token.txt += txt[i++];
+            if( token.txt == "!" )
+            {
+                error = "Expected '!='";
+                return false;
+            }
+        }
+        else if( c == '"' )
+        {
+            size_t end = txt.find( '"', i+1 );
+            if( end == std::string::npos )
+            {
+                error = "Missing closing quote";
+                return false;
+            }
+            token.type = TOKEN_WORD;
+            token.txt = txt.substr( i+1, end-i-1 );
+            token.quoted = true;
+            i = end+1;
+        }
+        else
+        {
+            token.type = TOKEN_WORD;
+            while( i<len && !isspace(static_cast<unsigned char>(txt[i])) && !strchr("()<>=!\"",txt[i]) )
+                token.txt += txt[i++];
+        }
+        tokens.push_back( token );
+    }
+    TOKEN end;
+    end.type = TOKEN_END;
+    end.txt = "end of query";
+    end.quoted = false;
+    tokens.push_back( end );
+    return true;
+}
+
+bool HeaderQuery::Keyword( const char *keyword )
+{
+    const TOKEN &token = tokens[next];
+    if( token.type==TOKEN_WORD && !token.quoted && Lower(token.txt)==keyword )
+    {
+        next++;
+        return true;
+    }
+    return false;
+}
+
+bool HeaderQuery::ParseOr()
+{
+    if( !ParseAnd() )
+        return false;
+    while( Keyword("or") )
+    {
+        if( !ParseAnd() )
+            return false;
+        Emit( STEP_OR );
+    }
+    return true;
+}
+
+bool HeaderQuery::ParseAnd()
+{
+    if( !ParseNot() )
+        return false;
+    for(;;)
+    {
+        if( !Keyword("and") )
+        {
+            // Two conditions in a row are an implicit and
+            const TOKEN &token = tokens[next];
+            bool another = token.type==TOKEN_LPAREN || (token.type==TOKEN_WORD && (token.quoted || Lower(token.txt)!="or"));
+            if( !another )
+                break;
+        }
+        if( !ParseNot() )
+            return false;
+        Emit( STEP_AND );
+    }
+    return true;
+}
+
+bool HeaderQuery::ParseNot()
+{
+    if( Keyword("not") )
+    {
+        if( !ParseNot() )
+            return false;
+        Emit( STEP_NOT );
+        return true;
+    }
+    if( tokens[next].type == TOKEN_LPAREN )
+    {
+        next++;
+        if( !ParseOr() )
+            return false;
+        if( tokens[next].type != TOKEN_RPAREN )
+        {
+            error = "Expected ')' not '" + tokens[next].txt + "'";
+            return false;
+        }
+        next++;
+        return true;
+    }
+    return ParseCondition();
+}
+
+bool HeaderQuery::ParseNumber( const std::string &txt, int &value )
+{
+    if( txt.length()==0 || txt.length()>6 )
+        return false;
+    for( size_t i=0; i<txt.length(); i++ )
+    {
+        if( !isdigit(static_cast<unsigned char>(txt[i])) )
+            return false;
+    }
+    value = atoi( txt.c_str() );
+    return true;
+}
+
+bool HeaderQuery::ParseEco( const std::string &txt, int &value )
+{
+    if( txt.length() != 3 )
+        return false;
+    char eco[4];
+    eco[0] = toupper( static_cast<unsigned char>(txt[0]) );
+    eco[1] = txt[1];
+    eco[2] = txt[2];
+    eco[3] = '\0';
+    if( eco[0]<'A' || eco[0]>'E' || !isdigit(static_cast<unsigned char>(eco[1])) || !isdigit(static_cast<unsigned char>(eco[2])) )
+        return false;
+    value = Eco2Bin( eco );
+    return true;
+}
+
+bool HeaderQuery::ParseCondition()
+{
+    const TOKEN &token = tokens[next];
+    if( token.type!=TOKEN_WORD || token.quoted )
+    {
+        error = "Expected a field name not '" + token.txt + "'";
+        return false;
+    }
+
+    // last N years
+    if( Keyword("last") )
+    {
+        int n;
+        if( !ParseNumber(tokens[next].txt,n) || n==0 )
+        {
+            error = "Expected a number of years after 'last'";
+            return false;
+        }
+        next++;
+        if( !Keyword("years") && !Keyword("year") )
+        {
+            error = "Expected 'years' not '" + tokens[next].txt + "'";
+            return false;
+        }
+        time_t now = time(NULL);
+        struct tm *local = localtime(&now);
+        int this_year = local ? local->tm_year+1900 : 2000;
+        HeaderFilter filter;
+        filter.AddYears( this_year+1-n, 9999 );
+        EmitLeaf( filter );
+        return true;
+    }
+
+    // field op value, or field in lo-hi
+    std::string field = Lower(token.txt);
+    next++;
+    bool is_year   = (field=="year");
+    bool is_elo    = (field=="elo" || field=="white_elo" || field=="black_elo");
+    bool is_eco    = (field=="eco");
+    bool is_result = (field=="result");
+    bool is_name   = (field=="white" || field=="black" || field=="player" || field=="event");
+    if( !is_year && !is_elo && !is_eco && !is_result && !is_name )
+    {
+        error = "Unknown field '" + token.txt + "'";
+        return false;
+    }
+    std::string op;
+    if( Keyword("in") )
+        op = "in";
+    else if( tokens[next].type == TOKEN_OP )
+        op = tokens[next++].txt;
+    else
+    {
+        error = "Expected an operator after '" + field + "'";
+        return false;
+    }
+    const TOKEN &value_token = tokens[next];
+    if( value_token.type != TOKEN_WORD )
+    {
+        error = "Expected a value after '" + field + " " + op + "'";
+        return false;
+    }
+    next++;
+    std::string value = value_token.txt;
+    bool negate = (op=="!=");
+    HeaderFilter filter;
+    if( is_name || is_result )
+    {
+        if( op!="=" && op!="!=" )
+        {
+            error = "Only = and != are allowed with '" + field + "'";
+            return false;
+        }
+        if( is_result )
+        {
+            std::string result = Lower(value);
+            int bin;
+            if( result == "1-0" )
+                bin = 1;
+            else if( result == "0-1" )
+                bin = 2;
+            else if( result=="1/2-1/2" || result=="1/2" || result=="draw" )
+                bin = 3;
+            else if( result == "*" )
+                bin = 0;
+            else
+            {
+                error = "Unknown result '" + value + "'";
+                return false;
+            }
+            filter.AddRange( HF_RESULT, bin, bin );
+            EmitLeaf( filter );
+        }
+        else if( field == "player" )
+        {
+            EmitSubstring( HF_WHITE, value );
+            EmitSubstring( HF_BLACK, value );
+            Emit( STEP_OR );
+        }
+        else
+            EmitSubstring( field=="white" ? HF_WHITE : (field=="black" ? HF_BLACK : HF_EVENT), value );
+    }
+    else
+    {
+        // Years and Elos start at 1, (0 is unknown), ECO codes A00-E99 are 0-499 (500 is unknown)
+        int min = is_eco ? 0   : 1;
+        int max = is_eco ? 499 : (is_year ? 9999 : 4095);
+        int lo, hi;
+        bool ok;
+        if( op == "in" )
+        {
+            size_t dash = value.find('-');
+            ok = (dash != std::string::npos);
+            if( ok && is_eco )
+                ok = ParseEco(value.substr(0,dash),lo) && ParseEco(value.substr(dash+1),hi);
+            else if( ok )
+                ok = ParseNumber(value.substr(0,dash),lo) && ParseNumber(value.substr(dash+1),hi);
+        }
+        else
+        {
+            int v;
+            ok = is_eco ? ParseEco(value,v) : ParseNumber(value,v);
+            lo = min;
+            hi = max;
+            if( op=="=" || op=="!=" )
+                lo = hi = v;
+            else if( op == "<" )
+                hi = v-1;
+            else if( op == "<=" )
+                hi = v;
+            else if( op == ">" )
+                lo = v+1;
+            else if( op == ">=" )
+                lo = v;
+        }
+        if( !ok )
+        {
+            error = "Bad value '" + value + "' for '" + field + "'";
+            return false;
+        }
+        NumericFilter( filter, field, is_year, is_eco, lo<min?min:lo, hi>max?max:hi );
+
+        // An unknown value doesn't match != either, so != is known and not equal (whereas
+        //  'not' is simply the opposite of the condition that follows)
+        if( negate )
+        {
+            HeaderFilter known;
+            NumericFilter( known, field, is_year, is_eco, min, max );
+            EmitLeaf( known );
+            EmitLeaf( filter );
+            Emit( STEP_NOT );
+            Emit( STEP_AND );
+            return true;
+        }
+        EmitLeaf( filter );
+    }
+    if( negate )
+        Emit( STEP_NOT );
+    return true;
+}
+
+// Games with a year, Elo (field elo means both players) or ECO in the range lo to hi
+void HeaderQuery::NumericFilter( HeaderFilter &filter, const std::string &field, bool is_year, bool is_eco, int lo, int hi )
+{
+    if( is_year )
+    {
+        if( lo < 1501 )
+            lo = 1501;  // so an unknown year never matches
+        if( lo > hi )
+            filter.AddRange( HF_DATE, 1, 0 );
+        else
+            filter.AddYears( lo, hi );
+    }
+    else if( is_eco )
+        filter.AddRange( HF_ECO, lo, hi );
+    else
+    {
+        if( field != "black_elo" )
+            filter.AddRange( HF_WHITE_ELO, lo, hi );
+        if( field != "white_elo" )
+            filter.AddRange( HF_BLACK_ELO, lo, hi );
+    }
+}
+
+// A conjunction of two leaves is merged into a single leaf
+void HeaderQuery::Emit( STEP_OP op )
+{
+    size_t n = plan.size();
+    if( op==STEP_AND && n>=2 && plan[n-1].op==STEP_LEAF && plan[n-2].op==STEP_LEAF )
+    {
+        plan[n-2].filter.Add( plan[n-1].filter );
+        plan.pop_back();
+        return;
+    }
+    STEP step;
+    step.op = op;
+    plan.push_back( step );
+}
+
+void HeaderQuery::EmitLeaf( const HeaderFilter &filter )
+{
+    STEP step;
+    step.op = STEP_LEAF;
+    step.filter = filter;
+    plan.push_back( step );
+}
+
+// Resolve a player or event substring to the set of ids of the names that contain it
+void HeaderQuery::EmitSubstring( HEADER_FIELD field, const std::string &substring )
+{
+    std::vector<uint8_t> ids;
+    if( compile_columns->cb_idx_valid )
+    {
+        PackedGameBinDbControlBlock &cb = PackedGameBinDb::GetControlBlock( compile_columns->cb_idx );
+        const std::vector<std::string> &names = (field==HF_EVENT ? cb.events : cb.players);
+        std::string lower = Lower(substring);
+        ids.resize( names.size() );
+        for( size_t i=0; i<names.size(); i++ )
+            ids[i] = (Lower(names[i]).find(lower) != std::string::npos);
+    }
+    HeaderFilter filter;
+    filter.AddIds( field, ids );
+    EmitLeaf( filter );
+}
+
+void HeaderQuery::Evaluate( const HeaderColumns &columns, std::vector<uint8_t> &selected ) const
+{
+    size_t n = columns.NbrGames();
+    if( plan.size() == 0 )
+    {
+        selected.assign( n, 1 );
+        return;
+    }
+    std::vector< std::vector<uint8_t> > stack;
+    for( size_t i=0; i<plan.size(); i++ )
+    {
+        const STEP &step = plan[i];
+        if( step.op == STEP_LEAF )
+        {
+            stack.push_back( std::vector<uint8_t>() );
+            step.filter.Evaluate( columns, stack.back() );
+            continue;
+        }
+        std::vector<uint8_t> &a = stack[ stack.size() - (step.op==STEP_NOT ? 1 : 2) ];
+        uint8_t *pa = n ? &a[0] : NULL;
+        if( step.op == STEP_NOT )
+        {
+            for( size_t j=0; j<n; j++ )
+                pa[j] ^= 1;
+            continue;
+        }
+        const uint8_t *pb = n ? &stack.back()[0] : NULL;
+        if( step.op == STEP_AND )
+        {
+            for( size_t j=0; j<n; j++ )
+                pa[j] &= pb[j];
+        }
+        else
+        {
+            for( size_t j=0; j<n; j++ )
+                pa[j] |= pb[j];
+        }
+        stack.pop_back();
+    }
+    selected.swap( stack.back() );
+}
+
+bool HeaderQuery::Match( ListableGame *p, uint8_t cb_idx, bool cb_idx_valid ) const
+{
+    std::vector<bool> stack;
+    for( size_t i=0; i<plan.size(); i++ )
+    {
+        const STEP &step = plan[i];
+        if( step.op == STEP_LEAF )
+            stack.push_back( step.filter.Match(p,cb_idx,cb_idx_valid) );
+        else if( step.op == STEP_NOT )
+            stack.back() = !stack.back();
+        else
+        {
+            bool b = stack.back();
+            stack.pop_back();
+            stack.back() = (step.op==STEP_AND ? (stack.back()&&b) : (stack.back()||b));
+        }
+    }
+    return stack.size()==0 || stack.back();
+}
+
+// Check some queries against a few made up games, return bool ok
+bool TestHeaderQuery()
+{
+    // Game 0 is 2000, both players 2600, B90. Game 1 has an unknown year, Elos and ECO. Game 2
+    //  is 2001, both players 2500, C00
+    HeaderColumns columns;
+    columns.dates.push_back( Date2Bin("2000.01.01") );
+    columns.dates.push_back( 0 );
+    columns.dates.push_back( Date2Bin("2001.06.30") );
+    columns.white_elos.push_back( 2600 );
+    columns.white_elos.push_back( 0 );
+    columns.white_elos.push_back( 2500 );
+    columns.black_elos = columns.white_elos;
+    columns.ecos.push_back( Eco2Bin("B90") );
+    columns.ecos.push_back( 500 );
+    columns.ecos.push_back( Eco2Bin("C00") );
+    columns.results.assign( 3, 3 );
+    columns.whites.assign( 3, 0 );
+    columns.blacks.assign( 3, 0 );
+    columns.events.assign( 3, 0 );
+    static const char *tests[][2] =
+    {
+        { "year = 2000",        "100" },
+        { "year != 2000",       "001" },
+        { "not year = 2000",    "011" },
+        { "year >= 1900",       "101" },
+        { "elo != 2600",        "001" },
+        { "white_elo < 2600",   "001" },
+        { "eco != B90",         "001" },
+        { "eco in A00-E99",     "101" },
+        { "not eco = B90",      "011" },
+    };
+    bool ok = true;
+    for( size_t i=0; i<sizeof(tests)/sizeof(tests[0]); i++ )
+    {
+        HeaderQuery query;
+        std::string error_msg;
+        bool compiled = query.Compile( tests[i][0], columns, error_msg );
+        std::vector<uint8_t> selected;
+        query.Evaluate( columns, selected );
+        std::string s;
+        for( size_t j=0; j<selected.size(); j++ )
+            s += (selected[j] ? '1' : '0');
+        bool pass = compiled && s==tests[i][1];
+        cprintf( "%s: %s -> %s\n", pass?"OK":"FAIL", tests[i][0], compiled?s.c_str():error_msg.c_str() );
+        if( !pass )
+            ok = false;
+    }
+    return ok;
+}
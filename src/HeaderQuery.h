@@ -0,0 +1,85 @@
+/****************************************************************************
+ * HeaderQuery - A little query language over game headers
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef HEADER_QUERY_H
+#define HEADER_QUERY_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "HeaderColumns.h"
+
+// Queries look like this;
+//
+//   last 5 years and elo >= 2600
+//   year in 2000-2010 and eco in B90-B99 and not result = 0-1
+//   (white = carlsen or black = "caruana, f") and event = olympiad
+//
+// Fields are year, elo (meaning both players), white_elo, black_elo, eco, result, white,
+//  black, player (meaning either player) and event. Numeric fields (and eco) accept
+//  = != < <= > >= and in lo-hi, an unknown year, Elo or ECO never matches (not even !=,
+//  though "not year = 2000" does). For white, black, player and event, = is a case
+//  insensitive substring match and != its opposite. "last N years" means the current year
+//  and the N-1 before it. Conditions combine with and, or, not and parentheses, two
+//  conditions in a row are an implicit and
+//
+// A query is compiled to a plan, a postfix program of steps. Each leaf step is a HeaderFilter,
+//  conjunctions of simple conditions are merged into a single leaf, so the commonest queries
+//  are evaluated in one pass over the header columns. Player and event substrings are
+//  resolved to sets of ids when the query is compiled
+class HeaderQuery
+{
+public:
+    HeaderQuery() {}
+
+    // Returns false with an explanation if the query can't be compiled
+    bool Compile( const std::string &txt, const HeaderColumns &columns, std::string &error_msg );
+    bool IsEmpty() const { return plan.size() == 0; }
+
+    // Set selected[i] to 1 if the i'th game in the columns matches, otherwise 0
+    void Evaluate( const HeaderColumns &columns, std::vector<uint8_t> &selected ) const;
+
+    // Check one game, for games that are not in the columns
+    bool Match( ListableGame *p, uint8_t cb_idx, bool cb_idx_valid ) const;
+
+private:
+    enum STEP_OP { STEP_LEAF, STEP_AND, STEP_OR, STEP_NOT };
+    struct STEP
+    {
+        STEP_OP op;
+        HeaderFilter filter;    // if a leaf
+    };
+    std::vector<STEP> plan;
+
+    // Compiling
+    enum TOKEN_TYPE { TOKEN_END, TOKEN_LPAREN, TOKEN_RPAREN, TOKEN_OP, TOKEN_WORD };
+    struct TOKEN
+    {
+        TOKEN_TYPE type;
+        std::string txt;
+        bool quoted;
+    };
+    std::vector<TOKEN> tokens;
+    size_t next;
+    const HeaderColumns *compile_columns;
+    std::string error;
+    bool Tokenise( const std::string &txt );
+    bool Keyword( const char *keyword );
+    bool ParseOr();
+    bool ParseAnd();
+    bool ParseNot();
+    bool ParseCondition();
+    bool ParseNumber( const std::string &txt, int &value );
+    bool ParseEco( const std::string &txt, int &value );
+    void Emit( STEP_OP op );
+    void EmitLeaf( const HeaderFilter &filter );
+    void EmitSubstring( HEADER_FIELD field, const std::string &substring );
+    static void NumericFilter( HeaderFilter &filter, const std::string &field, bool is_year, bool is_eco, int lo, int hi );
+};
+
+// Check some queries against a few made up games, return bool ok
+bool TestHeaderQuery();
+
+#endif  // HEADER_QUERY_H
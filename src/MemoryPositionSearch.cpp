@@ -6,10 +6,16 @@
  ****************************************************************************/
 #include <algorithm>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <system_error>
 #include <stdlib.h>
+#include <string.h>
 #include <wx/utils.h>
 #include "AutoTimer.h"
 #include "ProgressBar.h"
+#include "BinDb.h"
 #include "MemoryPositionSearch.h"
 #include "CompressMoves.h"  //temp testing
 
@@ -118,10 +124,187 @@
 #endif
 
 
+void MOVE_STATS::AddGame( int result_bin, bool white_is_mover, int white_elo, int black_elo )
+{
+    nbr_games++;
+    bool has_result = true;
+    int mover_score = 0;
+    switch( result_bin )
+    {
+        case 1:  nbr_white_wins++;  mover_score = white_is_mover ?  1 : -1;  break;    // "1-0"
+        case 2:  nbr_black_wins++;  mover_score = white_is_mover ? -1 :  1;  break;    // "0-1"
+        case 3:  nbr_draws++;                                               break;    // "1/2-1/2"
+        default: has_result = false;                                        break;    // "*"
+    }
+    int mover_elo    = white_is_mover ? white_elo : black_elo;
+    int opponent_elo = white_is_mover ? black_elo : white_elo;
+    if( mover_elo > 0 )
+    {
+        nbr_mover_rated++;
+        mover_elo_total += mover_elo;
+    }
+    if( opponent_elo>0 && has_result )
+    {
+        nbr_opponent_rated++;
+        opponent_elo_total += opponent_elo;
+        opponent_rated_net_score += mover_score;
+    }
+}
+
+void MOVE_STATS::Add( const MOVE_STATS &other )
+{
+    nbr_games                += other.nbr_games;
+    nbr_white_wins           += other.nbr_white_wins;
+    nbr_black_wins           += other.nbr_black_wins;
+    nbr_draws                += other.nbr_draws;
+    nbr_mover_rated          += other.nbr_mover_rated;
+    mover_elo_total          += other.mover_elo_total;
+    nbr_opponent_rated       += other.nbr_opponent_rated;
+    opponent_elo_total       += other.opponent_elo_total;
+    opponent_rated_net_score += other.opponent_rated_net_score;
+}
+
+int MOVE_STATS::AverageElo() const
+{
+    if( nbr_mover_rated == 0 )
+        return 0;
+    return static_cast<int>( (mover_elo_total + nbr_mover_rated/2) / nbr_mover_rated );
+}
+
+int MOVE_STATS::Performance() const
+{
+    if( nbr_opponent_rated == 0 )
+        return 0;
+    double average = static_cast<double>(opponent_elo_total) / nbr_opponent_rated;
+    double perf = average + (400.0*opponent_rated_net_score) / nbr_opponent_rated;
+    return static_cast<int>( perf + 0.5 );
+}
+
+// A game found, reaching the position after offset_first moves (the first time) and offset_last
+//  moves (the last time). The next move is the one played after offset_last, as it always has been
+//  for the database dialog's stats
+void MpsMoveTable::AddGame( ListableGame *p, const char *blob, unsigned short offset_first, unsigned short offset_last, bool white_is_mover )
+{
+    int result_bin = p->ResultBin();
+    int white_elo  = p->WhiteEloBin();
+    int black_elo  = p->BlackEloBin();
+    total.AddGame( result_bin, white_is_mover, white_elo, black_elo );
+    char next = blob[offset_last];  // the game has at least offset_last moves, so at worst '\0'
+    if( next != '\0' )
+        moves[next].AddGame( result_bin, white_is_mover, white_elo, black_elo );
+    const char *fen = p->Fen();
+    if( !fen || !*fen )
+        paths[ std::string(blob,offset_first) ]++;     // not a transposition if the game starts from a setup position
+}
+
+void MpsMoveTable::Add( const MpsMoveTable &other )
+{
+    total.Add( other.total );
+    std::map< char, MOVE_STATS >::const_iterator it;
+    for( it=other.moves.begin(); it!=other.moves.end(); it++ )
+        moves[it->first].Add( it->second );
+    std::map< std::string, int >::const_iterator it2;
+    for( it2=other.paths.begin(); it2!=other.paths.end(); it2++ )
+        paths[it2->first] += it2->second;
+}
+
+// A hash of the board, the same for the quick and slow search boards (both use the 'D'/'d' dark
+//  squared bishop convention)
+uint64_t MpsBatchTargets::Signature( const char *squares, bool white )
+{
+    const uint64_t *ranks = reinterpret_cast<const uint64_t *>(squares);
+    uint64_t h = white ? 1 : 2;
+    for( int i=0; i<8; i++ )
+    {
+        h ^= ranks[i];
+        h *= 0x9e3779b97f4a7c15ULL;
+        h ^= (h>>29);
+    }
+    return h;
+}
+
+int MpsBatchTargets::Build( const std::vector<thc::ChessPosition> &positions, std::vector<int> &target_of_position )
+{
+    boards.clear();
+    whites.clear();
+    target_of_position.clear();
+    size_t size = 16;
+    while( size < 2*positions.size() )
+        size *= 2;
+    mask = size-1;
+    table.assign( size, MpsBatchSlot() );
+    for( size_t i=0; i<positions.size(); i++ )
+    {
+        char squares[64];
+        for( int j=0; j<64; j++ )
+        {
+            char c = positions[i].squares[j];
+            if( c=='B' && is_dark(j) )
+                c = 'D';
+            else if( c=='b' && is_dark(j) )
+                c = 'd';
+            squares[j] = c;
+        }
+        bool white = positions[i].white;
+        int target = Find( squares, white );
+        if( target < 0 )
+        {
+            target = static_cast<int>(whites.size());
+            boards.insert( boards.end(), squares, squares+64 );
+            whites.push_back( white );
+            uint64_t signature = Signature( squares, white );
+            size_t j = signature & mask;
+            while( table[j].target >= 0 )
+                j = (j+1) & mask;
+            table[j].signature = signature;
+            table[j].target = target;
+        }
+        target_of_position.push_back( target );
+    }
+    return NbrTargets();
+}
+
+// Everything the workers need to search games in parallel. The source is split into chunks,
+//  each worker grabs chunks until there are none left. The games found in each chunk are kept
+//  separately so they can be merged in source order
+struct MpsJob
+{
+    MemoryPositionSearch *parent;
+    std::vector< smart_ptr<ListableGame> > *source;
+    bool  from_file;                    // source is the games loaded from the database file
+    bool  parallel;                     // if false search on the calling thread only
+    PatternMatch *pm;                   // if not NULL a pattern search
+    int   nbr_games;
+    int   chunk_size;
+    int   nbr_chunks;
+    std::vector< std::vector<DoSearchFoundGame> > found;    // games found in each chunk
+    std::vector<PATTERN_STATS> chunk_stats;                 // pattern search stats for each chunk
+    std::vector<MpsMoveTable>  chunk_tables;                // position search move table for each chunk
+    std::vector< std::vector<MpsBatchHit> > chunk_hits;     // batch search hits in each chunk
+    bool  batch;                        // if true a batch search
+    PATTERN_STATS         stats;        // pattern search stats, merged
+    std::vector<char>     chunk_done;
+    std::atomic<int>      next_chunk;
+    std::atomic<int>      nbr_done;
+    std::atomic<int>      nbr_masked_out;
+    std::atomic<int>      nbr_prefix_shared;
+    std::atomic<int64_t>  nbr_ply_skipped;
+    std::atomic<int>      nbr_quick;
+    std::atomic<int>      nbr_quick_promotion;
+    std::atomic<int>      nbr_slow;
+    std::atomic<int>      nbr_fen;
+    std::atomic<int>      nbr_filtered_out;
+    std::atomic<int>      nbr_running;
+    std::atomic<bool>     abort;
+};
+
 void MemoryPositionSearch::Init()
 {
     in_memory_game_cache.clear();
+    DetachDatabaseFile();
     search_position_set=false;
+    search_narrowed=false;
+    search_pattern=false;
     search_source = &in_memory_game_cache;
     thc::ChessPosition *cp = static_cast<thc::ChessPosition *>(&msi.cr);
     cp->Init();
@@ -139,6 +322,12 @@ void MemoryPositionSearch::Init()
     msi.sides[0] = sides[0];
     msi.sides[1] = sides[0];
     memcpy( mqi_init.squares, START_POSITION, 64 );
+    InitPointers();
+}
+
+// The scratch state includes pointers into itself, set them up
+void MemoryPositionSearch::InitPointers()
+{
     mq.rank8_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[ 0]);
     mq.rank7_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[ 8]);
     mq.rank6_ptr = reinterpret_cast<uint64_t*>(&mqi.squares[16]);
@@ -173,6 +362,24 @@ void MemoryPositionSearch::Init()
     ms.slow_rank1_target_ptr = reinterpret_cast<uint64_t*>(&ms.slow_target_squares[56]);
 }
 
+// A worker thread's MemoryPositionSearch gets a copy of the parent's search target
+void MemoryPositionSearch::CopySearchTarget( const MemoryPositionSearch &parent )
+{
+    search_position     = parent.search_position;
+    search_position_set = parent.search_position_set;
+    ms       = parent.ms;
+    msi      = parent.msi;
+    mq       = parent.mq;
+    mqi_init = parent.mqi_init;
+    mqi      = parent.mqi;
+    white_home_mask  = parent.white_home_mask;
+    white_home_pawns = parent.white_home_pawns;
+    black_home_mask  = parent.black_home_mask;
+    black_home_pawns = parent.black_home_pawns;
+    batch_targets    = parent.batch_targets;
+    InitPointers();
+}
+
 // Pawns for each side are assigned logical numbers from 0 to nbr_pawns-1
 //  The ordering of the numbers is determined by consulting this table...
 static int pawn_ordering[64] =
@@ -204,6 +411,12 @@ static thc::Square traverse_order[64] =
 
 // Try to set fast mode, return bool okay
 bool MemoryPositionSearch::TryFastMode( MpsSide *side )
+{
+    return TryFastMode( side, msi.cr.squares );
+}
+
+// Assign the side's pieces on the board to the fast mode slots, exactly as CompressMoves does
+bool MemoryPositionSearch::TryFastMode( MpsSide *side, const char *squares )
 {
     bool okay = true;
     side->nbr_pawns   = 0;
@@ -217,7 +430,7 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
 
         // Pawns are traversed according to pawn_ordering[]
         int j = static_cast<int>(traverse_order[i]);
-        if( msi.cr.squares[j] == (side->white?'P':'p') )
+        if( squares[j] == (side->white?'P':'p') )
         {
             if( side->nbr_pawns < 8 )
                 side->pawns[side->nbr_pawns++] = j;
@@ -226,21 +439,21 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
         }
 
         // Other pieces are traversed in normal square convention order
-        if( msi.cr.squares[i] == (side->white?'R':'r') )
+        if( squares[i] == (side->white?'R':'r') )
         {
             if( side->nbr_rooks < 2 )
                 side->rooks[side->nbr_rooks++] = i;
             else
                 okay = false;
         }
-        else if( msi.cr.squares[i] == (side->white?'N':'n') )
+        else if( squares[i] == (side->white?'N':'n') )
         {
             if( side->nbr_knights < 2 )
                 side->knights[side->nbr_knights++] = i;
             else
                 okay = false;
         }
-        else if( msi.cr.squares[i] == (side->white?'D':'d') )
+        else if( squares[i] == (side->white?'D':'d') )
         {
             side->bishop_dark = i;
             if( side->nbr_dark_bishops < 1 )
@@ -248,7 +461,7 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
             else
                 okay = false;
         }
-        else if( msi.cr.squares[i] == (side->white?'B':'b') )
+        else if( squares[i] == (side->white?'B':'b') )
         {
             side->bishop_light = i;
             if( side->nbr_light_bishops < 1 )
@@ -256,14 +469,14 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
             else
                 okay = false;
         }
-        else if( msi.cr.squares[i] == (side->white?'Q':'q') )
+        else if( squares[i] == (side->white?'Q':'q') )
         {
             if( side->nbr_queens < 2 )
                 side->queens[side->nbr_queens++] = i;
             else
                 okay = false;
         }
-        else if( msi.cr.squares[i] == (side->white?'K':'k') )
+        else if( squares[i] == (side->white?'K':'k') )
         {
             side->king = i;
         }
@@ -274,18 +487,109 @@ bool MemoryPositionSearch::TryFastMode( MpsSide *side )
     return okay;
 }
 
+// Use the optional position index and piece square masks (if there are any) for the games just
+//  loaded from the database file. They must still be in load order, most recent (last in the
+//  file) first
+void MemoryPositionSearch::AttachDatabaseFile( const std::string &db_filename, const std::vector< smart_ptr<ListableGame> > &loaded )
+{
+    DetachDatabaseFile();
+    BinDbGetPieceSquareMasks( piece_square_masks, game_masks );
+    if( loaded.size() == 0 )
+        return;
+    file_first_game_id = loaded[loaded.size()-1]->game_id;
+    file_nbr_games = loaded.size();
+    if( position_index.Open(db_filename) )
+    {
+        index_nbr_games = position_index.NbrGamesCovered();
+        if( index_nbr_games > file_nbr_games )
+            index_nbr_games = file_nbr_games;  // eg a partial load
+    }
+    if( game_masks.size() < file_nbr_games )
+        game_masks.clear();     // shouldn't happen
+    if( game_masks.size() > 0 )
+        cprintf( "Piece square masks: %d games, %d combos\n", static_cast<int>(game_masks.size()), piece_square_masks.NbrCombos() );
+    if( header_filter_set )
+    {
+        header_columns.Build( loaded, file_first_game_id, file_nbr_games );
+        header_filter.Evaluate( header_columns, header_selected );
+    }
+}
+
+void MemoryPositionSearch::DetachDatabaseFile()
+{
+    position_index.Close();
+    file_first_game_id = 0;
+    file_nbr_games = 0;
+    index_nbr_games = 0;
+    piece_square_masks.Clear();
+    std::vector<uint64_t>().swap( game_masks );
+    header_columns.Clear();
+    std::vector<uint8_t>().swap( header_selected );
+    selected_games.clear();
+}
+
+// The header columns are only needed by header filters and queries, so they are built the first
+//  time one is used, rather than on every database load
+void MemoryPositionSearch::NeedHeaderColumns()
+{
+    if( header_columns.NbrGames()==0 && file_nbr_games>0 )
+    {
+        AutoTimer at("Build header columns");
+        header_columns.Build( in_memory_game_cache, file_first_game_id, file_nbr_games );
+    }
+}
+
+const HeaderColumns &MemoryPositionSearch::GetHeaderColumns()
+{
+    NeedHeaderColumns();
+    return header_columns;
+}
+
+int MemoryPositionSearch::SelectGames( const HeaderQuery &query )
+{
+    NeedHeaderColumns();
+    std::vector<uint8_t> selected;
+    query.Evaluate( header_columns, selected );
+    selected_games.clear();
+    for( size_t i=0; i<in_memory_game_cache.size(); i++ )
+    {
+        ListableGame *p = in_memory_game_cache[i].get();
+        uint32_t file_idx;
+        bool in_file = FileIdx( p->game_id, file_idx ) && file_idx<selected.size();
+        if( in_file ? selected[file_idx]!=0 : query.Match(p,header_columns.cb_idx,header_columns.cb_idx_valid) )
+            selected_games.push_back( in_memory_game_cache[i] );
+    }
+    cprintf( "Header query: %d of %d games selected\n", static_cast<int>(selected_games.size()), static_cast<int>(in_memory_game_cache.size()) );
+    return selected_games.size();
+}
+
+void MemoryPositionSearch::SetHeaderFilter( const HeaderFilter &filter )
+{
+    ForgetSearch();     // the results would change
+    header_filter = filter;
+    header_filter_set = !filter.IsEmpty();
+    if( !header_filter_set )
+    {
+        std::vector<uint8_t>().swap( header_selected );
+        return;
+    }
+    NeedHeaderColumns();
+    header_filter.Evaluate( header_columns, header_selected );
+    int nbr_selected = 0;
+    for( size_t i=0; i<header_selected.size(); i++ )
+        nbr_selected += header_selected[i];
+    cprintf( "Header filter: %d of %d games selected\n", nbr_selected, static_cast<int>(header_selected.size()) );
+}
+
 int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *progress )
 {
     return DoSearch(cp,progress,&in_memory_game_cache);
 }
 
-int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *progress, std::vector< smart_ptr<ListableGame> > *source )
+// Set up the target position for the quick and slow searches, ms and mq targets and the home
+//  row masks
+void MemoryPositionSearch::SetSearchTarget( const thc::ChessPosition &cp )
 {
-    games_found.clear();
-    search_position = cp;
-    search_position_set = true;
-    search_source = source;
-
     // Set up counts of total pieces, and individual pieces in the target position
     ms.total_count_target = 64;     // reverse count non-pieces from 64
     ms.black_count_target = 0;
@@ -454,33 +758,232 @@ int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *
     mq.rank8_target = *mq.rank8_target_ptr;
     mq.rank1_target = *mq.rank1_target_ptr;
     mq.rank2_target = *mq.rank2_target_ptr;
-    int nbr = source->size();
+}
+
+int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *progress, std::vector< smart_ptr<ListableGame> > *source )
+{
+    games_found.clear();
+    move_table.Clear();
+    search_position = cp;
+    search_position_set = true;
+    search_narrowed = false;
+    search_pattern = false;
+    search_source = source;
+    SetSearchTarget( cp );
+
+    // If the position is in the position index, the games the index covers don't need to be
+    //  searched, just look up the ply each one reaches the position (if it does) and confirm it
+    bool from_file = IsFileSource(source);
+    search_index_ply.clear();
+    if( from_file && index_nbr_games>0 )
+    {
+        thc::ChessPosition temp = cp;
+        std::vector<PositionIndexPosting> postings;
+        if( position_index.Lookup( temp.Hash64Calculate(), cp.white, postings ) )
+        {
+            search_index_ply.assign( index_nbr_games, INDEX_PLY_NOT_FOUND );
+            for( size_t i=0; i<postings.size(); i++ )
+            {
+                if( postings[i].game_idx < index_nbr_games )
+                    search_index_ply[ postings[i].game_idx ] = postings[i].ply;
+            }
+            cprintf( "Position index: %d games\n", static_cast<int>(postings.size()) );
+        }
+    }
+
+    // Otherwise a game can't reach the position unless its piece square mask includes the
+    //  position's mask
+    search_target_mask = piece_square_masks.PositionMask( mq.target_squares );
     {
         AutoTimer at("Search time");
 
-        // Leave only one defined
-        //#define CONSERVATIVE
-        //#define NO_PROMOTIONS_FLAWED
-        #define CORRECT_BEST_PRACTICE
-        for( int i=0; i<nbr; i++ )
+        // The games loaded from the database file are searched on all cores. Other sources
+        //  (eg the clipboard) are searched on this thread, their games might be loaded from
+        //  a file on demand so aren't safe to access from other threads
+        MpsJob job;
+        job.source    = source;
+        job.from_file = from_file;
+        job.parallel  = from_file && parallel_search;
+        job.pm        = NULL;
+        job.batch     = false;
+        bool aborted = RunSearchJob( job, progress );
+        if( aborted )
+            search_position_set = false;    // the results are incomplete, don't reuse them
+        if( job.nbr_masked_out > 0 )
+            cprintf( "Piece square masks: %d games skipped\n", static_cast<int>(job.nbr_masked_out) );
+        if( job.nbr_filtered_out > 0 )
+            cprintf( "Header filter: %d games skipped\n", static_cast<int>(job.nbr_filtered_out) );
+        if( prefix_sharing )
+            cprintf( "Shared prefixes: %d games decided by the previous game, %ld moves not replayed\n",
+                        static_cast<int>(job.nbr_prefix_shared), static_cast<long>(job.nbr_ply_skipped) );
+        cprintf( "Search paths: %d games quick, %d quick with promotions, %d slow (%d from setup positions)\n",
+                    static_cast<int>(job.nbr_quick), static_cast<int>(job.nbr_quick_promotion), static_cast<int>(job.nbr_slow),
+                    static_cast<int>(job.nbr_fen) );
+    }
+    return games_found.size();
+}
+
+// Narrow the last search's results to the games that reach cp by playing the compressed move
+//  from the last search position (at the ply they first reach it)
+bool MemoryPositionSearch::NarrowSearch( const thc::ChessPosition &cp, char compressed_move )
+{
+    if( !search_position_set || search_pattern || compressed_move=='\0' )
+        return false;
+    std::vector< smart_ptr<ListableGame> > &source = *search_source;
+    size_t nbr_narrowed = 0;
+    move_table.Clear();
+    for( size_t i=0; i<games_found.size(); i++ )
+    {
+        DoSearchFoundGame dsfg = games_found[i];
+        const char *blob = source[dsfg.idx]->CompressedMoves();
+        if( blob[dsfg.offset_last] == compressed_move )     // the game has at least offset_last moves
+        {
+            dsfg.offset_first = dsfg.offset_last = dsfg.offset_last+1;
+            games_found[nbr_narrowed++] = dsfg;
+            move_table.AddGame( source[dsfg.idx].get(), blob, dsfg.offset_first, dsfg.offset_last, cp.white );
+        }
+    }
+    cprintf( "Narrowed search: %d of %d games\n", static_cast<int>(nbr_narrowed), static_cast<int>(games_found.size()) );
+    games_found.resize( nbr_narrowed );
+    search_position = cp;
+    search_narrowed = true;
+    return true;
+}
+
+bool MemoryPositionSearch::CompleteNarrowedSearch( const thc::ChessPosition &cp, const std::vector<DoSearchFoundGame> &complete, const MpsMoveTable &complete_table )
+{
+    if( !IsSearchNarrowed() || !(cp==search_position) )
+        return false;
+    search_narrowed = false;
+
+    // The complete search doesn't know about our header filter, if any
+    std::vector<DoSearchFoundGame> filtered;
+    MpsMoveTable filtered_table;
+    const std::vector<DoSearchFoundGame> *result = &complete;
+    const MpsMoveTable *result_table = &complete_table;
+    if( header_filter_set )
+    {
+        for( size_t i=0; i<complete.size(); i++ )
+        {
+            ListableGame *p = (*search_source)[ complete[i].idx ].get();
+            uint32_t file_idx;
+            bool in_file = IsFileSource(search_source) && FileIdx( p->game_id, file_idx );
+            if( !HeaderFilteredOut( p, in_file, file_idx ) )
+            {
+                filtered.push_back( complete[i] );
+                filtered_table.AddGame( p, p->CompressedMoves(), complete[i].offset_first, complete[i].offset_last, cp.white );
+            }
+        }
+        result = &filtered;
+        result_table = &filtered_table;
+    }
+    bool changed = result->size() != games_found.size();
+    for( size_t i=0; !changed && i<result->size(); i++ )
+    {
+        changed = (*result)[i].idx          != games_found[i].idx ||
+                  (*result)[i].offset_first != games_found[i].offset_first;
+    }
+    if( changed )
+    {
+        cprintf( "Completed narrowed search: %d games, was %d\n", static_cast<int>(result->size()), static_cast<int>(games_found.size()) );
+        games_found = *result;
+        move_table  = *result_table;
+    }
+    return changed;
+}
+
+void MemoryPositionSearch::RestoreSearch( const thc::ChessPosition &cp, const std::vector<DoSearchFoundGame> &found, const MpsMoveTable &table )
+{
+    games_found = found;
+    move_table  = table;
+    search_position = cp;
+    search_position_set = true;
+    search_narrowed = false;
+    search_pattern = false;
+    search_source = &in_memory_game_cache;
+}
+
+// The position index goes by 64 bit hash alone, so confirm the game really does reach the
+//  position (board and side to move, as the search itself compares) at the indexed ply. If
+//  not, a hash collision, the game gets the full search
+static bool IndexHitConfirmed( const thc::ChessPosition &target, const char *blob, unsigned short ply )
+{
+    CompressMoves press;
+    for( unsigned short i=0; i<ply; i++ )
+    {
+        if( !*blob )
+            return false;
+        press.UncompressMove( *blob++ );
+    }
+    return press.cr.white==target.white && memcmp(press.cr.squares,target.squares,64)==0;
+}
+
+// Search games [begin,end) of the source, adding those that reach the search position to found.
+//  Runs on a worker thread (or the search thread itself), parent is the MemoryPositionSearch
+//  running the search
+void MemoryPositionSearch::SearchGames( const MemoryPositionSearch &parent, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                                        int begin, int end, std::vector<DoSearchFoundGame> &found, MpsMoveTable &table, int &nbr_masked_out )
+{
+    bool white_is_mover = parent.search_position.white;
+    prefix_moves = NULL;
+    nbr_checkpoints = 0;
+    nbr_prefix_shared = 0;
+    nbr_prefix_resumed = 0;
+    nbr_ply_skipped = 0;
+    nbr_quick = 0;
+    nbr_quick_promotion = 0;
+    nbr_slow = 0;
+    nbr_fen = 0;
+    nbr_filtered_out = 0;
+
+    // Sharing prefixes only pays if neighbouring games do start with the same moves, which isn't
+    //  usually the case (most databases are in date order). Try it on the first few games of
+    //  the chunk, and give up if it isn't working
+    bool share = parent.prefix_sharing;
+    int  nbr_sampled = 0;
+
+    // Leave only one defined
+    //#define CONSERVATIVE
+    //#define NO_PROMOTIONS_FLAWED
+    #define CORRECT_BEST_PRACTICE
+    for( int i=begin; i<end; i++ )
+    {
+        const smart_ptr<ListableGame> &p = source[i];
+        const char *fen = p->Fen();
+        DoSearchFoundGame dsfg;
+        dsfg.idx = i;
+        dsfg.game_id = p->game_id;
+        dsfg.offset_first=0;
+        dsfg.offset_last=0;
+        bool game_found;
+        uint32_t file_idx;
+        bool in_file = from_file && parent.FileIdx( p->game_id, file_idx );
+        if( parent.HeaderFilteredOut( p.get(), in_file, file_idx ) )
+        {
+            game_found = false;
+            nbr_filtered_out++;
+        }
+        else if( fen && *fen )
+        {
+            // A game from a setup position, eg a study or a partial game in the clipboard
+            nbr_fen++;
+            game_found = SearchGameFen( fen, p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
+        }
+        else if( in_file && file_idx<parent.search_index_ply.size() && parent.search_index_ply[file_idx]==INDEX_PLY_NOT_FOUND )
+            game_found = false;
+        else if( in_file && file_idx<parent.search_index_ply.size() && IndexHitConfirmed(parent.search_position,p->CompressedMoves(),parent.search_index_ply[file_idx]) )
+        {
+            game_found = true;
+            dsfg.offset_first = dsfg.offset_last = parent.search_index_ply[file_idx];
+        }
+        else if( in_file && file_idx<parent.game_masks.size() && (parent.game_masks[file_idx]&parent.search_target_mask)!=parent.search_target_mask )
+        {
+            game_found = false;
+            nbr_masked_out++;
+        }
+        else
         {
-            smart_ptr<ListableGame> p = (*source)[i];
-            const char *fen = p->Fen();
-            if( fen && *fen )
-                continue;   // a partial game in the clipboard
-            DoSearchFoundGame dsfg;
-            dsfg.idx = i;
-            dsfg.game_id = p->game_id;
-            dsfg.offset_first=0;
-            dsfg.offset_last=0;
-            /* Roster r = in_memory_game_cache[i]->RefRoster();
-            cprintf( "idx=%d, white=%s[%s], black=%s[%s], blob=%s\n",
-                        in_memory_game_cache[i]->game_id,
-                        in_memory_game_cache[i]->White(),  r.white.c_str(),
-                        in_memory_game_cache[i]->Black(),  r.black.c_str(),
-                        in_memory_game_cache[i]->CompressedMoves() ); */
             bool promotion_in_game = p->TestPromotion();
-            bool game_found;
             #ifdef CONSERVATIVE
             game_found = SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
             #endif
@@ -489,19 +992,373 @@ int  MemoryPositionSearch::DoSearch( const thc::ChessPosition &cp, ProgressBar *
             #endif
             #ifdef CORRECT_BEST_PRACTICE
             if( promotion_in_game )
-                game_found = SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
+            {
+                // The quick search handles most promotions too, it gives up if the promoting
+                //  side has too many pieces of a kind for fast mode
+                game_found = SearchGameOptimisedPromotionAllowed( p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
+                if( !quick_fast_mode_lost )
+                    nbr_quick_promotion++;
+                else
+                {
+                    nbr_slow++;
+                    game_found = SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
+                }
+            }
+            else if( share )
+            {
+                nbr_quick++;
+                game_found = SearchGameSharedPrefix( p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
+                if( ++nbr_sampled == MPS_PREFIX_SAMPLE )
+                    share = (nbr_prefix_shared+nbr_prefix_resumed)*MPS_PREFIX_MIN_HITS >= MPS_PREFIX_SAMPLE;
+            }
             else
+            {
+                nbr_quick++;
                 game_found = SearchGameOptimisedNoPromotionAllowed( p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
+            }
             #endif
-            if( game_found )
+        }
+        if( game_found )
+        {
+            found.push_back( dsfg );
+            table.AddGame( p.get(), p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last, white_is_mover );
+        }
+    }
+}
+
+// Batch search games [begin,end) of the source, adding the target positions they reach to hits
+//  (in source order, then in order of the ply they are reached)
+void MemoryPositionSearch::BatchSearchGames( const MemoryPositionSearch &parent, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                                        int begin, int end, std::vector<MpsBatchHit> &hits, int &nbr_masked_out )
+{
+    nbr_quick = 0;
+    nbr_quick_promotion = 0;
+    nbr_slow = 0;
+    nbr_fen = 0;
+    nbr_filtered_out = 0;
+    for( int i=begin; i<end; i++ )
+    {
+        const smart_ptr<ListableGame> &p = source[i];
+        const char *fen = p->Fen();
+        unsigned short offset_first, offset_last;
+        uint32_t file_idx;
+        bool in_file = from_file && parent.FileIdx( p->game_id, file_idx );
+        batch_game_hits.clear();
+        if( parent.HeaderFilteredOut( p.get(), in_file, file_idx ) )
+            nbr_filtered_out++;
+        else if( fen && *fen )
+        {
+            nbr_fen++;
+            SearchGameFen( fen, p->CompressedMoves(), offset_first, offset_last );
+        }
+        else if( in_file && file_idx<parent.game_masks.size() && (parent.game_masks[file_idx]&parent.search_target_mask)!=parent.search_target_mask )
+            nbr_masked_out++;
+        else if( p->TestPromotion() )
+        {
+            SearchGameOptimisedPromotionAllowed( p->CompressedMoves(), offset_first, offset_last );
+            if( !quick_fast_mode_lost )
+                nbr_quick_promotion++;
+            else
             {
-                games_found.push_back( dsfg );
+                nbr_slow++;
+                SearchGameSlowPromotionAllowed( std::string(p->CompressedMoves()), offset_first, offset_last );
             }
-            if( (i&0xff)==0 && progress )
-                progress->Perfraction( i, nbr );
+        }
+        else
+        {
+            nbr_quick++;
+            SearchGameOptimisedNoPromotionAllowed( p->CompressedMoves(), offset_first, offset_last );
+        }
+        for( size_t j=0; j<batch_game_hits.size(); j++ )
+        {
+            MpsBatchHit hit = batch_game_hits[j];
+            hit.dsfg.idx = i;
+            hit.dsfg.game_id = p->game_id;
+            hits.push_back( hit );
         }
     }
-    return games_found.size();
+}
+
+// Record the batch search target position (if any) the game has reached, the first time only
+void MemoryPositionSearch::BatchProbe( const char *squares, bool white, unsigned short offset )
+{
+    int target = batch_targets->Find( squares, white );
+    if( target < 0 )
+        return;
+    for( size_t i=0; i<batch_game_hits.size(); i++ )
+    {
+        if( batch_game_hits[i].target == target )
+            return;
+    }
+    MpsBatchHit hit;
+    hit.target = target;
+    hit.dsfg.idx = 0;
+    hit.dsfg.game_id = 0;
+    hit.dsfg.offset_first = hit.dsfg.offset_last = offset;
+    batch_game_hits.push_back( hit );
+}
+
+bool MemoryPositionSearch::DoBatchSearch( const std::vector<thc::ChessPosition> &positions, ProgressBar *progress, std::vector<MpsBatchResult> &results )
+{
+    return DoBatchSearch( positions, progress, results, &in_memory_game_cache );
+}
+
+bool MemoryPositionSearch::DoBatchSearch( const std::vector<thc::ChessPosition> &positions, ProgressBar *progress, std::vector<MpsBatchResult> &results,
+                                          std::vector< smart_ptr<ListableGame> > *source )
+{
+    ForgetSearch();     // the search target is replaced
+    search_source = source;
+    results.clear();
+    MpsBatchTargets targets;
+    std::vector<int> target_of_position;
+    int nbr_targets = targets.Build( positions, target_of_position );
+    if( nbr_targets == 0 )
+        return true;
+
+    // A game is abandoned when it can't reach any of the targets. So the piece counts targeted
+    //  are the least of any target position, the home row pawns targeted and the piece square
+    //  mask are those of every target position
+    MpsSlow  ms_all;
+    MpsQuick mq_all;
+    uint64_t white_home_mask_all=0, white_home_pawns_all=0, black_home_mask_all=0, black_home_pawns_all=0;
+    uint64_t target_mask_all=0;
+    for( size_t i=0; i<positions.size(); i++ )
+    {
+        SetSearchTarget( positions[i] );
+        uint64_t target_mask = piece_square_masks.PositionMask( mq.target_squares );
+        if( i == 0 )
+        {
+            ms_all = ms;
+            mq_all = mq;
+            white_home_mask_all  = white_home_mask;
+            white_home_pawns_all = white_home_pawns;
+            black_home_mask_all  = black_home_mask;
+            black_home_pawns_all = black_home_pawns;
+            target_mask_all      = target_mask;
+            continue;
+        }
+        ms_all.total_count_target      = std::min( ms_all.total_count_target,      ms.total_count_target );
+        ms_all.black_count_target      = std::min( ms_all.black_count_target,      ms.black_count_target );
+        ms_all.black_pawn_count_target = std::min( ms_all.black_pawn_count_target, ms.black_pawn_count_target );
+        ms_all.white_count_target      = std::min( ms_all.white_count_target,      ms.white_count_target );
+        ms_all.white_pawn_count_target = std::min( ms_all.white_pawn_count_target, ms.white_pawn_count_target );
+        mq_all.black_dark_bishop_target  = std::min( mq_all.black_dark_bishop_target,  mq.black_dark_bishop_target );
+        mq_all.black_light_bishop_target = std::min( mq_all.black_light_bishop_target, mq.black_light_bishop_target );
+        mq_all.black_rook_target         = std::min( mq_all.black_rook_target,         mq.black_rook_target );
+        mq_all.black_queen_target        = std::min( mq_all.black_queen_target,        mq.black_queen_target );
+        mq_all.black_knight_target       = std::min( mq_all.black_knight_target,       mq.black_knight_target );
+        mq_all.black_pawn_target         = std::min( mq_all.black_pawn_target,         mq.black_pawn_target );
+        mq_all.white_dark_bishop_target  = std::min( mq_all.white_dark_bishop_target,  mq.white_dark_bishop_target );
+        mq_all.white_light_bishop_target = std::min( mq_all.white_light_bishop_target, mq.white_light_bishop_target );
+        mq_all.white_rook_target         = std::min( mq_all.white_rook_target,         mq.white_rook_target );
+        mq_all.white_queen_target        = std::min( mq_all.white_queen_target,        mq.white_queen_target );
+        mq_all.white_knight_target       = std::min( mq_all.white_knight_target,       mq.white_knight_target );
+        mq_all.white_pawn_target         = std::min( mq_all.white_pawn_target,         mq.white_pawn_target );
+        white_home_mask_all  &= white_home_mask;
+        white_home_pawns_all &= white_home_pawns;
+        black_home_mask_all  &= black_home_mask;
+        black_home_pawns_all &= black_home_pawns;
+        target_mask_all      &= target_mask;
+    }
+    ms = ms_all;
+    mq = mq_all;
+    white_home_mask  = white_home_mask_all;
+    white_home_pawns = white_home_pawns_all;
+    black_home_mask  = black_home_mask_all;
+    black_home_pawns = black_home_pawns_all;
+    search_target_mask = target_mask_all;
+    search_index_ply.clear();
+
+    // The single target position is never matched, instead the board is looked up in the batch
+    //  targets before every move
+    memset( ms.slow_target_squares, 0, sizeof(ms.slow_target_squares) );
+    memset( mq.target_squares, 0, sizeof(mq.target_squares) );
+    mq.rank3_target = *mq.rank3_target_ptr;
+    mq.rank4_target = *mq.rank4_target_ptr;
+    mq.rank5_target = *mq.rank5_target_ptr;
+    mq.rank6_target = *mq.rank6_target_ptr;
+    mq.rank7_target = *mq.rank7_target_ptr;
+    mq.rank8_target = *mq.rank8_target_ptr;
+    mq.rank1_target = *mq.rank1_target_ptr;
+    mq.rank2_target = *mq.rank2_target_ptr;
+    batch_targets = &targets;
+    bool aborted;
+    std::vector<MpsBatchResult> target_results( nbr_targets );
+    {
+        AutoTimer at("Batch search time");
+        bool from_file = IsFileSource(source);
+        MpsJob job;
+        job.source    = source;
+        job.from_file = from_file;
+        job.parallel  = from_file && parallel_search;
+        job.pm        = NULL;
+        job.batch     = true;
+        aborted = RunSearchJob( job, progress );
+        batch_targets = NULL;
+
+        // Merge the hits, in source order
+        for( int chunk=0; !aborted && chunk<job.nbr_chunks; chunk++ )
+        {
+            std::vector<MpsBatchHit> &hits = job.chunk_hits[chunk];
+            for( size_t i=0; i<hits.size(); i++ )
+            {
+                MpsBatchResult &result = target_results[ hits[i].target ];
+                result.games_found.push_back( hits[i].dsfg );
+                ListableGame *p = (*source)[ hits[i].dsfg.idx ].get();
+                result.table.AddGame( p, p->CompressedMoves(), hits[i].dsfg.offset_first, hits[i].dsfg.offset_last, targets.White(hits[i].target) );
+            }
+        }
+        if( job.nbr_masked_out > 0 )
+            cprintf( "Piece square masks: %d games skipped\n", static_cast<int>(job.nbr_masked_out) );
+        if( job.nbr_filtered_out > 0 )
+            cprintf( "Header filter: %d games skipped\n", static_cast<int>(job.nbr_filtered_out) );
+        cprintf( "Batch search: %d positions, %d games quick, %d quick with promotions, %d slow (%d from setup positions)\n",
+                    nbr_targets, static_cast<int>(job.nbr_quick), static_cast<int>(job.nbr_quick_promotion), static_cast<int>(job.nbr_slow),
+                    static_cast<int>(job.nbr_fen) );
+    }
+    if( aborted )
+        return false;
+    results.resize( positions.size() );
+    for( size_t i=0; i<positions.size(); i++ )
+        results[i] = target_results[ target_of_position[i] ];
+    return true;
+}
+
+// Each worker grabs chunks of games until there are none left
+void MemoryPositionSearch::SearchWorker( MpsJob *job, MemoryPositionSearch *worker, PatternMatch *pm, ProgressBar *progress )
+{
+    while( !job->abort )
+    {
+        int chunk = job->next_chunk++;
+        if( chunk >= job->nbr_chunks )
+            break;
+        int begin = chunk * job->chunk_size;
+        int end = begin+job->chunk_size < job->nbr_games ? begin+job->chunk_size : job->nbr_games;
+        int nbr_masked_out = 0;
+        if( pm )
+            worker->PatternSearchGames( *job->parent, *pm, *job->source, job->from_file, begin, end, job->found[chunk], job->chunk_stats[chunk], nbr_masked_out );
+        else
+        {
+            if( job->batch )
+                worker->BatchSearchGames( *job->parent, *job->source, job->from_file, begin, end, job->chunk_hits[chunk], nbr_masked_out );
+            else
+            {
+                worker->SearchGames( *job->parent, *job->source, job->from_file, begin, end, job->found[chunk], job->chunk_tables[chunk], nbr_masked_out );
+                job->nbr_prefix_shared += worker->nbr_prefix_shared;
+                job->nbr_ply_skipped   += worker->nbr_ply_skipped;
+            }
+            job->nbr_quick         += worker->nbr_quick;
+            job->nbr_quick_promotion += worker->nbr_quick_promotion;
+            job->nbr_slow          += worker->nbr_slow;
+            job->nbr_fen           += worker->nbr_fen;
+        }
+        job->nbr_filtered_out += worker->nbr_filtered_out;
+        job->chunk_done[chunk] = 1;
+        job->nbr_masked_out += nbr_masked_out;
+        job->nbr_done += (end-begin);
+        if( progress && progress->Perfraction( job->nbr_done, job->nbr_games ) )
+            job->abort = true;
+        if( job->parent->cancel_flag && *job->parent->cancel_flag )
+            job->abort = true;
+    }
+    job->nbr_running--;
+}
+
+// Search the source's games in chunks, on all cores if job.parallel. Each worker thread has its
+//  own MemoryPositionSearch with a copy of the search target (and its own PatternMatch for a
+//  pattern search). The games found and pattern stats are merged in source order, so the
+//  results are the same whether or not the search is parallel. Returns bool aborted, if
+//  aborted the results are from the chunks completed before the first incomplete chunk only
+bool MemoryPositionSearch::RunSearchJob( MpsJob &job, ProgressBar *progress )
+{
+    job.parent      = this;
+    job.nbr_games   = job.source->size();
+    job.chunk_size  = MPS_GAMES_PER_CHUNK;
+    job.nbr_chunks  = (job.nbr_games + job.chunk_size-1) / job.chunk_size;
+    job.found.resize( job.nbr_chunks );
+    job.chunk_stats.resize( job.pm ? job.nbr_chunks : 0 );
+    job.chunk_tables.resize( job.pm||job.batch ? 0 : job.nbr_chunks );
+    job.chunk_hits.resize( job.batch ? job.nbr_chunks : 0 );
+    job.chunk_done.assign( job.nbr_chunks, 0 );
+    job.next_chunk  = 0;
+    job.nbr_done    = 0;
+    job.nbr_masked_out = 0;
+    job.nbr_prefix_shared = 0;
+    job.nbr_ply_skipped = 0;
+    job.nbr_quick = 0;
+    job.nbr_quick_promotion = 0;
+    job.nbr_slow = 0;
+    job.nbr_fen = 0;
+    job.nbr_filtered_out = 0;
+    job.nbr_running = 0;
+    job.abort       = false;
+
+    // Start the workers
+    unsigned int nbr_threads = job.parallel ? std::thread::hardware_concurrency() : 1;
+    if( nbr_threads > static_cast<unsigned int>(job.nbr_chunks) )
+        nbr_threads = job.nbr_chunks;
+    std::vector< smart_ptr<MemoryPositionSearch> > workers;
+    std::vector< smart_ptr<PatternMatch> > worker_pms;
+    std::vector<std::thread> threads;
+    for( unsigned int i=0; nbr_threads>1 && i<nbr_threads; i++ )
+    {
+        smart_ptr<MemoryPositionSearch> worker( new MemoryPositionSearch );
+        worker->CopySearchTarget( *this );
+        workers.push_back( worker );
+        smart_ptr<PatternMatch> worker_pm;
+        if( job.pm )
+        {
+            worker_pm.reset( new PatternMatch );
+            worker_pm->parm = job.pm->parm;
+            worker_pm->Prime( &worker->msi.cr );
+            worker_pms.push_back( worker_pm );
+        }
+        job.nbr_running++;
+        try
+        {
+            threads.push_back( std::thread(SearchWorker,&job,worker.get(),worker_pm.get(),static_cast<ProgressBar *>(NULL)) );
+        }
+        catch( std::system_error & )
+        {
+            job.nbr_running--;
+            break;
+        }
+    }
+    if( threads.size()==0 && job.nbr_chunks>0 )
+    {
+        job.nbr_running++;
+        SearchWorker( &job, this, job.pm, progress );  // do it ourselves, reporting progress as we go
+    }
+
+    // Meanwhile, report progress and watch for cancellation
+    while( job.nbr_running > 0 )
+    {
+        if( progress && progress->Perfraction( job.nbr_done, job.nbr_games ) )
+            job.abort = true;
+        if( cancel_flag && *cancel_flag )
+            job.abort = true;
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+
+    // Merge the games found, in source order
+    games_found.clear();
+    move_table.Clear();
+    bool aborted = false;
+    for( int chunk=0; !aborted && chunk<job.nbr_chunks; chunk++ )
+    {
+        aborted = !job.chunk_done[chunk];
+        if( !aborted )
+        {
+            games_found.insert( games_found.end(), job.found[chunk].begin(), job.found[chunk].end() );
+            if( job.pm )
+                job.stats.Add( job.chunk_stats[chunk] );
+            else if( !job.batch )
+                move_table.Add( job.chunk_tables[chunk] );
+        }
+    }
+    return aborted;
 }
 
 int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats )
@@ -514,8 +1371,11 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
 int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source )
 {
     games_found.clear();
+    move_table.Clear();
     search_position = pm.parm.cp;
     search_position_set = true;
+    search_narrowed = false;
+    search_pattern = true;
     search_source = source;
 
     // Set up counts of total pieces, and individual pieces in the target position
@@ -689,12 +1549,19 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
     mq.rank8_target = *mq.rank8_target_ptr;
     mq.rank1_target = *mq.rank1_target_ptr;
     mq.rank2_target = *mq.rank2_target_ptr;
-    int nbr = source->size();
+
+    // A game can't match unless its piece square mask includes the mask of at least one of
+    //  the target positions (reflected and/or colour reversed)
+    bool from_file = IsFileSource(source);
+    const char *targets[4];
+    search_nbr_targets = pm.GetTargets( targets );
+    for( int j=0; j<search_nbr_targets; j++ )
+        search_target_masks[j] = piece_square_masks.PositionMask( targets[j] );
     {
         AutoTimer at("Search time");
         #ifdef TEMP_EXPERIMENT
         thc::MOVELIST list;
-        #endif
+        int nbr = source->size();
         for( int i=0; i<nbr; i++ )
         {
             smart_ptr<ListableGame> p = (*source)[i];
@@ -800,56 +1667,109 @@ int  MemoryPositionSearch::DoPatternSearch( PatternMatch &pm, ProgressBar *progr
                 games_found.push_back( dsfg );
             }
             #endif
-            #ifndef TEMP_EXPERIMENT
-            //if( 0 == strcmp(p->White(),"Gu, Xiaobing") &&  0 == strcmp(p->Black(),"Ryjanova, Julia")  )
-            //    debug_trigger = true;
-            DoSearchFoundGame dsfg;
-            dsfg.idx = i;
-            dsfg.game_id = p->game_id;
-            dsfg.offset_first=0;
-            dsfg.offset_last=0;
-            bool promotion_in_game = p->TestPromotion();
-            bool game_found, reverse;
-            pm.NewGame();
-            if( promotion_in_game )
-                game_found = PatternSearchGameSlowPromotionAllowed( pm, reverse, std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
-            else
-                game_found = PatternSearchGameOptimisedNoPromotionAllowed( pm, reverse, p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
-            if( game_found )
-            {
-                stats.nbr_games++;
-                if( reverse )
-                {
-                    stats.nbr_reversed_games++;
-                    if( 0 == strcmp(p->Result(),"1-0") )
-                        stats.black_wins++;
-                    else if( 0 == strcmp(p->Result(),"0-1") )
-                        stats.white_wins++;
-                    else
-                        stats.draws++;
-                }
-                else
-                {
-                    if( 0 == strcmp(p->Result(),"1-0") )
-                        stats.white_wins++;
-                    else if( 0 == strcmp(p->Result(),"0-1") )
-                        stats.black_wins++;
-                    else
-                        stats.draws++;
-                }
-                games_found.push_back( dsfg );
-            }
-            #endif
             if( (i&0xff)==0 && progress )
             {
                 double permill = (static_cast<double>(i) * 1000.0) / static_cast<double>(nbr);
                 progress->Permill( static_cast<int>(permill) );
             }
         }
+        #else
+
+        // As for DoSearch(), games loaded from the database file are searched on all cores
+        MpsJob job;
+        job.source    = source;
+        job.from_file = from_file;
+        job.parallel  = from_file && parallel_search;
+        job.pm        = &pm;
+        job.batch     = false;
+        bool aborted = RunSearchJob( job, progress );
+        if( aborted )
+            search_position_set = false;    // the results are incomplete, don't reuse them
+        stats.Add( job.stats );
+        if( job.nbr_masked_out > 0 )
+            cprintf( "Piece square masks: %d games skipped\n", static_cast<int>(job.nbr_masked_out) );
+        if( job.nbr_filtered_out > 0 )
+            cprintf( "Header filter: %d games skipped\n", static_cast<int>(job.nbr_filtered_out) );
+        #endif
     }
     return games_found.size();
 }
 
+// Pattern search games [begin,end) of the source, adding those that match to found and
+//  stats. Runs on a worker thread (or the search thread itself) with the worker's own
+//  PatternMatch, parent is the MemoryPositionSearch running the search
+void MemoryPositionSearch::PatternSearchGames( const MemoryPositionSearch &parent, PatternMatch &pm, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                                        int begin, int end, std::vector<DoSearchFoundGame> &found, PATTERN_STATS &stats, int &nbr_masked_out )
+{
+    nbr_filtered_out = 0;
+    for( int i=begin; i<end; i++ )
+    {
+        const smart_ptr<ListableGame> &p = source[i];
+        //if( 0 == strcmp(p->White(),"Gu, Xiaobing") &&  0 == strcmp(p->Black(),"Ryjanova, Julia")  )
+        //    debug_trigger = true;
+        DoSearchFoundGame dsfg;
+        dsfg.idx = i;
+        dsfg.game_id = p->game_id;
+        dsfg.offset_first=0;
+        dsfg.offset_last=0;
+        bool promotion_in_game = p->TestPromotion();
+        bool game_found, reverse;
+        bool masked_out = false;
+        uint32_t file_idx;
+        bool in_file = from_file && parent.FileIdx( p->game_id, file_idx );
+        bool filtered_out = parent.HeaderFilteredOut( p.get(), in_file, file_idx );
+        if( !filtered_out && parent.search_nbr_targets>0 && in_file && file_idx<parent.game_masks.size() )
+        {
+            uint64_t game_mask = parent.game_masks[file_idx];
+            masked_out = true;
+            for( int j=0; masked_out && j<parent.search_nbr_targets; j++ )
+                masked_out = ((game_mask&parent.search_target_masks[j]) != parent.search_target_masks[j]);
+        }
+        pm.NewGame();
+        if( filtered_out )
+        {
+            game_found = false;
+            nbr_filtered_out++;
+        }
+        else if( masked_out )
+        {
+            game_found = false;
+            nbr_masked_out++;
+        }
+        else if( promotion_in_game )
+            game_found = PatternSearchGameSlowPromotionAllowed( pm, reverse, std::string(p->CompressedMoves()), dsfg.offset_first, dsfg.offset_last  );
+        else
+            game_found = PatternSearchGameOptimisedNoPromotionAllowed( pm, reverse, p->CompressedMoves(), dsfg.offset_first, dsfg.offset_last );
+        if( game_found )
+        {
+            // ResultBin() not Result(), the string accessors share a static pool of std::strings
+            //  and aren't thread safe. 1 is 1-0, 2 is 0-1
+            int result_bin = p->ResultBin();
+            stats.nbr_games++;
+            if( reverse )
+            {
+                stats.nbr_reversed_games++;
+                if( result_bin == 1 )
+                    stats.black_wins++;
+                else if( result_bin == 2 )
+                    stats.white_wins++;
+                else
+                    stats.draws++;
+            }
+            else
+            {
+                if( result_bin == 1 )
+                    stats.white_wins++;
+                else if( result_bin == 2 )
+                    stats.black_wins++;
+                else
+                    stats.draws++;
+            }
+            found.push_back( dsfg );
+        }
+    }
+}
+
 thc::Move MemoryPositionSearch::UncompressSlowMode( char code )
 {
     // Horrible kludge necessitated by our 'd'/'D' = dark bishops stuff
@@ -1270,26 +2190,169 @@ thc::Move MemoryPositionSearch::UncompressFastMode( char code, MpsSide *side, Mp
 #define SLOW_WHITE_HOME_ROW_TEST ((*ms.slow_rank2_ptr & white_home_mask) == white_home_pawns)
 #define SLOW_BLACK_HOME_ROW_TEST ((*ms.slow_rank7_ptr & black_home_mask) == black_home_pawns)
 
+// The quick board matches the target, rank by rank with early outs. Whole board SSE2 and
+//  AVX2 compares are slower, see tools/board-compare-benchmark.cpp (over the positions of
+//  install/book.pgn, 0.48ns per compare for this one, SSE2 1.9x and AVX2 1.4x that), since
+//  the first 8 byte compare here rejects 95% of positions
+#define QUICK_BOARD_MATCH ( \
+            *mq.rank3_ptr == mq.rank3_target && \
+            *mq.rank4_ptr == mq.rank4_target && \
+            *mq.rank5_ptr == mq.rank5_target && \
+            *mq.rank6_ptr == mq.rank6_target && \
+            *mq.rank7_ptr == mq.rank7_target && \
+            *mq.rank8_ptr == mq.rank8_target && \
+            *mq.rank1_ptr == mq.rank1_target && \
+            *mq.rank2_ptr == mq.rank2_target )
+
 
 bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
 {
     unsigned short offset=0;
-    bool target_white = search_position.white;  // searching for position with white to move?
     QuickGameInit();
+    return QuickSearch( moves_in, offset, false, false, offset_first, offset_last );
+}
+
+// As above, for a game with promotions. The quick search can't prune by counting captured
+//  pieces, since a promotion can replace them. Sets quick_fast_mode_lost (and returns false)
+//  if the game can't be searched this way, because a side has promoted to more pieces of a kind
+//  than fast mode allows, so its moves are compressed in slow mode
+bool MemoryPositionSearch::SearchGameOptimisedPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+{
+    unsigned short offset=0;
+    QuickGameInit();
+    quick_fast_mode_lost = false;
+    return QuickSearch( moves_in, offset, false, true, offset_first, offset_last );
+}
+
+// Set up msi_fen for a game starting from a setup position, including each side's fast mode
+//  slots (CompressMoves does the same when compressing the game). Returns false if the FEN is no
+//  good
+bool MemoryPositionSearch::FenGameInit( const char *fen )
+{
+    if( fen_init == fen )
+        return fen_init_okay;   // eg consecutive partial games in the clipboard, from the same position
+    fen_init = fen;
+    fen_init_okay = msi_fen.cr.Forsyth(fen);
+    if( !fen_init_okay )
+        return false;
+    for( int i=0; i<64; i++ )   // Impose the distinct dark squared bishop = 'd'/'D' convention
+    {
+        if( is_dark(i) && msi_fen.cr.squares[i]=='B' )
+            msi_fen.cr.squares[i] = 'D';
+        else if( is_dark(i) && msi_fen.cr.squares[i]=='b' )
+            msi_fen.cr.squares[i] = 'd';
+    }
+    msi_fen.sides[0].white = true;
+    msi_fen.sides[1].white = false;
+    TryFastMode( &msi_fen.sides[0], msi_fen.cr.squares );
+    TryFastMode( &msi_fen.sides[1], msi_fen.cr.squares );
+    return true;
+}
+
+// A game from a setup position. Every game is a promotion game as far as the quick search is
+//  concerned (the setup position might have promoted pieces already). The quick search starts
+//  with White to move, so if Black moves first that move is played on the slow search board.
+//  If the quick search can't follow the game, search it slowly
+bool MemoryPositionSearch::SearchGameFen( const char *fen, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+{
+    if( !FenGameInit(fen) )
+        return false;
+    msi = msi_fen;
+    const char *moves_start = moves_in;
+    unsigned short offset=0;
+    if( !msi.cr.white )
+    {
+        if( batch_targets )
+            BatchProbe( msi.cr.squares, false, 0 );
+        if( !search_position.white && memcmp(msi.cr.squares,ms.slow_target_squares,64)==0 )
+        {
+            offset_last = offset_first = 0;
+            return true;
+        }
+        if( *moves_in == '\0' )
+            return false;
+        char mover;
+        SlowPlayMove( *moves_in++, mover );
+        offset++;
+    }
+    memcpy( mqi.squares, msi.cr.squares, 64 );
+    mqi.side_white = msi.sides[0];
+    mqi.side_black = msi.sides[1];
+    quick_fast_mode_lost = false;
+    bool found = QuickSearch( moves_in, offset, false, true, offset_first, offset_last );
+    if( !quick_fast_mode_lost )
+    {
+        nbr_quick_promotion++;
+        return found;
+    }
+    nbr_slow++;
+    msi = msi_fen;
+    return SlowSearch( std::string(moves_start), offset_first, offset_last );
+}
+
+// Neighbouring games often start with the same moves, eg in a database made from a PGN file of
+//  games sorted by opening. The previous game's result applies if it was decided by moves this
+//  game shares, otherwise resume from the last checkpoint in the shared moves rather than from
+//  the start of the game
+bool MemoryPositionSearch::SearchGameSharedPrefix( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last )
+{
+    unsigned short common=0;
+    if( prefix_moves )
+    {
+        while( common<prefix_decided && moves_in[common]==prefix_moves[common] )
+            common++;
+        if( common == prefix_decided )
+        {
+            nbr_prefix_shared++;
+            if( prefix_found )
+                offset_first = offset_last = prefix_offset;
+            return prefix_found;
+        }
+    }
+    int nbr = common/MPS_CHECKPOINT_PLY;     // checkpoints usable
+    if( nbr > nbr_checkpoints )
+        nbr = nbr_checkpoints;
+    nbr_checkpoints = nbr;                  // later checkpoints are from the previous game's own moves
+    unsigned short offset=0;
+    if( nbr == 0 )
+        QuickGameInit();
+    else
+    {
+        mqi = checkpoints[nbr-1];
+        offset = nbr*MPS_CHECKPOINT_PLY;
+        nbr_prefix_resumed++;
+        nbr_ply_skipped += offset;
+    }
+    bool found = QuickSearch( moves_in+offset, offset, true, false, offset_first, offset_last );
+    prefix_moves   = moves_in;
+    prefix_decided = offset;
+    prefix_found   = found;
+    prefix_offset  = offset_first;
+    return found;
+}
+
+// The quick search proper, starting with mqi set up for the position after offset moves and
+//  moves_in pointing at the next move. Returns with offset the number of moves read (including
+//  the terminating '\0' if it was read)
+bool MemoryPositionSearch::QuickSearch( const char *moves_in, unsigned short &offset, bool checkpoint, bool promotions, unsigned short &offset_first, unsigned short &offset_last )
+{
+    bool target_white = search_position.white;  // searching for position with white to move?
     for(;;)
     {
+        // Save the state every so often (always with white to move) for SearchGameSharedPrefix()
+        if( checkpoint && offset%MPS_CHECKPOINT_PLY==0 && offset>0 && offset<=MPS_CHECKPOINT_PLY*MPS_NBR_CHECKPOINTS )
+        {
+            nbr_checkpoints = offset/MPS_CHECKPOINT_PLY;
+            checkpoints[nbr_checkpoints-1] = mqi;
+        }
+
         // Check for match before every move
+        if( batch_targets )
+            BatchProbe( mqi.squares, true, offset );
         if(
             target_white &&
             #if 1
-            *mq.rank3_ptr == mq.rank3_target &&
-            *mq.rank4_ptr == mq.rank4_target &&
-            *mq.rank5_ptr == mq.rank5_target &&
-            *mq.rank6_ptr == mq.rank6_target &&
-            *mq.rank7_ptr == mq.rank7_target &&
-            *mq.rank8_ptr == mq.rank8_target &&
-            *mq.rank1_ptr == mq.rank1_target &&
-            *mq.rank2_ptr == mq.rank2_target
+            QUICK_BOARD_MATCH
             #else
             *mq.rank3_ptr == *mq.rank3_target_ptr &&
             *mq.rank4_ptr == *mq.rank4_target_ptr &&
@@ -1306,6 +2369,13 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
             return true;
         }
 
+        // After promoting, White's pieces are reassigned before White's next move, as when compressing
+        if( !mqi.side_white.fast_mode && !TryFastMode(&mqi.side_white,mqi.squares) )
+        {
+            quick_fast_mode_lost = true;    // White's moves are in slow mode now
+            return false;
+        }
+
         // White move
         char code = *moves_in++;
         offset++;
@@ -1429,6 +2499,14 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 mqi.squares[dst] = 'Q';
                 mqi.squares[src] = EMPTY_CHARACTER;
                 mqi.side_white.queens[0] = dst;
+
+                // swap ?
+                if( mqi.side_white.nbr_queens==2 && mqi.side_white.queens[0]>mqi.side_white.queens[1] )
+                {
+                    int temp = mqi.side_white.queens[0];
+                    mqi.side_white.queens[0] = mqi.side_white.queens[1];
+                    mqi.side_white.queens[1] = temp;
+                }
                 break;
             }
 
@@ -1444,6 +2522,14 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 mqi.squares[dst] = 'Q';
                 mqi.squares[src] = EMPTY_CHARACTER;
                 mqi.side_white.queens[0] = dst;
+
+                // swap ?
+                if( mqi.side_white.nbr_queens==2 && mqi.side_white.queens[0]>mqi.side_white.queens[1] )
+                {
+                    int temp = mqi.side_white.queens[0];
+                    mqi.side_white.queens[0] = mqi.side_white.queens[1];
+                    mqi.side_white.queens[1] = temp;
+                }
                 break;
             }
 
@@ -1485,13 +2571,66 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
             default:
             {
                 int pawn_offset = (code>>4)&0x07;
+                if( pawn_offset>=6 && mqi.side_white.nbr_queens==2 )
+                {
+                    // With two queens, pawn codes 6 and 7 are rook and bishop moves of the second queen
+                    src = mqi.side_white.queens[1];
+                    if( pawn_offset == 6 )
+                    {
+                        if( code & R_RANK )                // code encodes rank ?
+                            dst = ((code<<3)&0x38) | (src&7);   // same file as src, rank from code
+                        else
+                            dst = (src&0x38) | (code&7);        // same rank as src, file from code
+                    }
+                    else
+                    {
+                        int file_delta = (code&7) - (src&7);
+                        if( code & B_FALL )  // FALL\ + file
+                            dst = src + 9*file_delta;
+                        else                  // RISE/ + file
+                            dst = src - 7*file_delta;
+                    }
+                    captured = mqi.squares[dst];
+                    mqi.squares[dst] = 'Q';
+                    mqi.squares[src] = EMPTY_CHARACTER;
+                    mqi.side_white.queens[1] = dst;
+
+                    // swap ?
+                    if( mqi.side_white.queens[0]>mqi.side_white.queens[1] )
+                    {
+                        int temp = mqi.side_white.queens[0];
+                        mqi.side_white.queens[0] = mqi.side_white.queens[1];
+                        mqi.side_white.queens[1] = temp;
+                    }
+                    break;
+                }
                 src = mqi.side_white.pawns[pawn_offset];
                 int delta;
                 switch( code&0x0f )
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // Promotion, the new piece replaces the pawn, and (see above) White's
+                        //  pieces are reassigned before White's next move
+                        switch( (code>>2)&3 )
+                        {
+                            case P_SINGLE:  delta = -8;   break;
+                            case P_LEFT:    delta = -9;   break;
+                            default:        delta = -7;   break;    // P_RIGHT
+                        }
+                        dst = src+delta;
+                        captured = mqi.squares[dst];
+                        switch( code&3 )
+                        {
+                            case P_QUEEN:   mqi.squares[dst] = 'Q';   break;
+                            case P_ROOK:    mqi.squares[dst] = 'R';   break;
+                            case P_BISHOP:  mqi.squares[dst] = is_dark(dst) ? 'D' : 'B';   break;
+                            case P_KNIGHT:  mqi.squares[dst] = 'N';   break;
+                        }
+                        mqi.squares[src] = EMPTY_CHARACTER;
+                        mqi.side_white.pawns[pawn_offset] = dst;
+                        mqi.side_white.fast_mode = false;
+                        break;
                     }
 
                     case P_DOUBLE:
@@ -1597,15 +2736,18 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 }
                 case 'q':
                 {
-                    if( mq.black_queen_target == 1 )
+                    if( mq.black_queen_target == 1 && !promotions )
                         return false;
+                    if( mqi.side_black.nbr_queens==2 && mqi.side_black.queens[0]==dst )
+                        mqi.side_black.queens[0] = mqi.side_black.queens[1];
+                    mqi.side_black.nbr_queens--;
                     break;
                 }
                 case 'r':
                 {
                     if( mqi.side_black.nbr_rooks==2 && mqi.side_black.rooks[0]==dst )
                         mqi.side_black.rooks[0] = mqi.side_black.rooks[1];
-                    if( --mqi.side_black.nbr_rooks < mq.black_rook_target )
+                    if( --mqi.side_black.nbr_rooks < mq.black_rook_target && !promotions )
                         return false;
                     break;
                 }
@@ -1613,36 +2755,31 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 {
                     if( mqi.side_black.nbr_knights==2 && mqi.side_black.knights[0]==dst )
                         mqi.side_black.knights[0] = mqi.side_black.knights[1];
-                    if( --mqi.side_black.nbr_knights < mq.black_knight_target )
+                    if( --mqi.side_black.nbr_knights < mq.black_knight_target && !promotions )
                         return false;
                     break;
                 }
                 case 'b':
                 {
-                    if( mq.black_light_bishop_target == 1 )
+                    if( mq.black_light_bishop_target == 1 && !promotions )
                         return false;
                     break;
                 }
                 case 'd':
                 {
-                    if( mq.black_dark_bishop_target == 1 )
+                    if( mq.black_dark_bishop_target == 1 && !promotions )
                         return false;
                     break;
                 }
             }
         }
 
+        if( batch_targets )
+            BatchProbe( mqi.squares, false, offset );
         if(
             !target_white &&
             #if 1
-            *mq.rank3_ptr == mq.rank3_target &&
-            *mq.rank4_ptr == mq.rank4_target &&
-            *mq.rank5_ptr == mq.rank5_target &&
-            *mq.rank6_ptr == mq.rank6_target &&
-            *mq.rank7_ptr == mq.rank7_target &&
-            *mq.rank8_ptr == mq.rank8_target &&
-            *mq.rank1_ptr == mq.rank1_target &&
-            *mq.rank2_ptr == mq.rank2_target
+            QUICK_BOARD_MATCH
             #else
             *mq.rank3_ptr == *mq.rank3_target_ptr &&
             *mq.rank4_ptr == *mq.rank4_target_ptr &&
@@ -1659,6 +2796,13 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
             return true;
         }
 
+        // After promoting, Black's pieces are reassigned before Black's next move, as when compressing
+        if( !mqi.side_black.fast_mode && !TryFastMode(&mqi.side_black,mqi.squares) )
+        {
+            quick_fast_mode_lost = true;    // Black's moves are in slow mode now
+            return false;
+        }
+
         // Black move
         code = *moves_in++;
         offset++;
@@ -1781,6 +2925,14 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 mqi.squares[dst] = 'q';
                 mqi.squares[src] = EMPTY_CHARACTER;
                 mqi.side_black.queens[0] = dst;
+
+                // swap ?
+                if( mqi.side_black.nbr_queens==2 && mqi.side_black.queens[0]>mqi.side_black.queens[1] )
+                {
+                    int temp = mqi.side_black.queens[0];
+                    mqi.side_black.queens[0] = mqi.side_black.queens[1];
+                    mqi.side_black.queens[1] = temp;
+                }
                 break;
             }
 
@@ -1796,6 +2948,14 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 mqi.squares[dst] = 'q';
                 mqi.squares[src] = EMPTY_CHARACTER;
                 mqi.side_black.queens[0] = dst;
+
+                // swap ?
+                if( mqi.side_black.nbr_queens==2 && mqi.side_black.queens[0]>mqi.side_black.queens[1] )
+                {
+                    int temp = mqi.side_black.queens[0];
+                    mqi.side_black.queens[0] = mqi.side_black.queens[1];
+                    mqi.side_black.queens[1] = temp;
+                }
                 break;
             }
 
@@ -1837,13 +2997,66 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
             default:
             {
                 int pawn_offset = (code>>4)&0x07;
+                if( pawn_offset>=6 && mqi.side_black.nbr_queens==2 )
+                {
+                    // With two queens, pawn codes 6 and 7 are rook and bishop moves of the second queen
+                    src = mqi.side_black.queens[1];
+                    if( pawn_offset == 6 )
+                    {
+                        if( code & R_RANK )                // code encodes rank ?
+                            dst = ((code<<3)&0x38) | (src&7);   // same file as src, rank from code
+                        else
+                            dst = (src&0x38) | (code&7);        // same rank as src, file from code
+                    }
+                    else
+                    {
+                        int file_delta = (code&7) - (src&7);
+                        if( code & B_FALL )  // FALL\ + file
+                            dst = src + 9*file_delta;
+                        else                  // RISE/ + file
+                            dst = src - 7*file_delta;
+                    }
+                    captured = mqi.squares[dst];
+                    mqi.squares[dst] = 'q';
+                    mqi.squares[src] = EMPTY_CHARACTER;
+                    mqi.side_black.queens[1] = dst;
+
+                    // swap ?
+                    if( mqi.side_black.queens[0]>mqi.side_black.queens[1] )
+                    {
+                        int temp = mqi.side_black.queens[0];
+                        mqi.side_black.queens[0] = mqi.side_black.queens[1];
+                        mqi.side_black.queens[1] = temp;
+                    }
+                    break;
+                }
                 src = mqi.side_black.pawns[pawn_offset];
                 int delta;
                 switch( code&0x0f )
                 {
                     default:
                     {
-                        return false;   // this code doesn't handle promotions
+                        // Promotion, the new piece replaces the pawn, and (see above) Black's
+                        //  pieces are reassigned before Black's next move
+                        switch( (code>>2)&3 )
+                        {
+                            case P_SINGLE:  delta =  8;   break;
+                            case P_LEFT:    delta =  9;   break;
+                            default:        delta =  7;   break;    // P_RIGHT
+                        }
+                        dst = src+delta;
+                        captured = mqi.squares[dst];
+                        switch( code&3 )
+                        {
+                            case P_QUEEN:   mqi.squares[dst] = 'q';   break;
+                            case P_ROOK:    mqi.squares[dst] = 'r';   break;
+                            case P_BISHOP:  mqi.squares[dst] = is_dark(dst) ? 'd' : 'b';   break;
+                            case P_KNIGHT:  mqi.squares[dst] = 'n';   break;
+                        }
+                        mqi.squares[src] = EMPTY_CHARACTER;
+                        mqi.side_black.pawns[pawn_offset] = dst;
+                        mqi.side_black.fast_mode = false;
+                        break;
                     }
 
                     case P_DOUBLE:
@@ -1949,15 +3162,18 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 }
                 case 'Q':
                 {
-                    if( mq.white_queen_target == 1 )
+                    if( mq.white_queen_target == 1 && !promotions )
                         return false;
+                    if( mqi.side_white.nbr_queens==2 && mqi.side_white.queens[0]==dst )
+                        mqi.side_white.queens[0] = mqi.side_white.queens[1];
+                    mqi.side_white.nbr_queens--;
                     break;
                 }
                 case 'R':
                 {
                     if( mqi.side_white.nbr_rooks==2 && mqi.side_white.rooks[0]==dst )
                         mqi.side_white.rooks[0] = mqi.side_white.rooks[1];
-                    if( --mqi.side_white.nbr_rooks < mq.white_rook_target )
+                    if( --mqi.side_white.nbr_rooks < mq.white_rook_target && !promotions )
                         return false;
                     break;
                 }
@@ -1965,19 +3181,19 @@ bool MemoryPositionSearch::SearchGameOptimisedNoPromotionAllowed( const char *mo
                 {
                     if( mqi.side_white.nbr_knights==2 && mqi.side_white.knights[0]==dst )
                         mqi.side_white.knights[0] = mqi.side_white.knights[1];
-                    if( --mqi.side_white.nbr_knights < mq.white_knight_target )
+                    if( --mqi.side_white.nbr_knights < mq.white_knight_target && !promotions )
                         return false;
                     break;
                 }
                 case 'B':
                 {
-                    if( mq.white_light_bishop_target == 1 )
+                    if( mq.white_light_bishop_target == 1 && !promotions )
                         return false;
                     break;
                 }
                 case 'D':
                 {
-                    if( mq.white_dark_bishop_target == 1 )
+                    if( mq.white_dark_bishop_target == 1 && !promotions )
                         return false;
                     break;
                 }
@@ -2679,14 +3895,63 @@ bool MemoryPositionSearch::PatternSearchGameOptimisedNoPromotionAllowed( Pattern
 }
 
 bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last )          // semi fast
+{
+    SlowGameInit();
+    return SlowSearch( moves_in, offset_first, offset_last );
+}
+
+// Play a compressed move on the slow search board, returning the move and the piece moved
+thc::Move MemoryPositionSearch::SlowPlayMove( char code, char &mover )
+{
+    MpsSide *side  = msi.cr.white ? &msi.sides[0] : &msi.sides[1];
+    MpsSide *other = msi.cr.white ? &msi.sides[1] : &msi.sides[0];
+    thc::Move mv;
+    if( side->fast_mode )
+    {
+        mv = UncompressFastMode(code,side,other);
+    }
+    else if( TryFastMode(side) )
+    {
+        mv = UncompressFastMode(code,side,other);
+    }
+    else
+    {
+        mv = UncompressSlowMode(code);
+        other->fast_mode = false;   // force other side to reset and retry
+    }
+    mover = msi.cr.squares[mv.src];
+    //std::string mvs = mv.NaturalOut(&msi.cr);
+    msi.cr.PlayMove(mv);
+    if( mv.special == thc::SPECIAL_PROMOTION_BISHOP ) // Impose the distinct dark squared bishop = 'd'/'D' convention over the top
+    {
+        if( is_dark(mv.dst) )
+        {
+            char c = msi.cr.squares[mv.dst];
+            if( c == 'B' )
+                c = 'D';
+            else if( c == 'b' )
+                c = 'd';
+            msi.cr.squares[mv.dst] = c;
+        }
+    }
+    //std::string s = msi.cr.ToDebugStr();
+    //cprintf( "After %s\n%s\n", mvs.c_str(), s.c_str() );
+    return mv;
+}
+
+// The slow search proper, starting with msi set up for the start of the game. The piece counts
+//  start at their maximum, which is fine for a game from a setup position too (they are only
+//  ever compared with the target position's counts)
+bool MemoryPositionSearch::SlowSearch( const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last )
 {
     bool target_white = search_position.white;  // searching for position with white to move?
     int black_count=16;
     int black_pawn_count=8;
     int white_count=16;
     int white_pawn_count=8;
-    SlowGameInit();
     int len = moves_in.size();
+    if( batch_targets )
+        BatchProbe( msi.cr.squares, msi.cr.white, 0 );
     if(
         (msi.cr.white == target_white) &&
         *ms.slow_rank3_ptr == *ms.slow_rank3_target_ptr &&
@@ -2704,40 +3969,10 @@ bool MemoryPositionSearch::SearchGameSlowPromotionAllowed( const std::string &mo
     }
     for( int i=0; i<len; i++ )
     {
-        MpsSide *side  = msi.cr.white ? &msi.sides[0] : &msi.sides[1];
-        MpsSide *other = msi.cr.white ? &msi.sides[1] : &msi.sides[0];
-        char code = moves_in[i];
-        thc::Move mv;
-        if( side->fast_mode )
-        {
-            mv = UncompressFastMode(code,side,other);
-        }
-        else if( TryFastMode(side) )
-        {
-            mv = UncompressFastMode(code,side,other);
-        }
-        else
-        {
-            mv = UncompressSlowMode(code);
-            other->fast_mode = false;   // force other side to reset and retry
-        }
-        char mover = msi.cr.squares[mv.src];
-        //std::string mvs = mv.NaturalOut(&msi.cr);
-        msi.cr.PlayMove(mv);
-        if( mv.special == thc::SPECIAL_PROMOTION_BISHOP ) // Impose the distinct dark squared bishop = 'd'/'D' convention over the top
-        {
-            if( is_dark(mv.dst) )
-            {
-                char c = msi.cr.squares[mv.dst];
-                if( c == 'B' )
-                    c = 'D';
-                else if( c == 'b' )
-                    c = 'd';
-                msi.cr.squares[mv.dst] = c;
-            }
-        }
-        //std::string s = msi.cr.ToDebugStr();
-        //cprintf( "After %s\n%s\n", mvs.c_str(), s.c_str() );
+        char mover;
+        thc::Move mv = SlowPlayMove( moves_in[i], mover );
+        if( batch_targets )
+            BatchProbe( msi.cr.squares, msi.cr.white, i+1 );
         if(
             (msi.cr.white == target_white) &&
             *ms.slow_rank3_ptr == *ms.slow_rank3_target_ptr &&
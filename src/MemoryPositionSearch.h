@@ -11,11 +11,18 @@
 #include <algorithm>
 #include <vector>
 #include <string>
+#include <string.h>
+#include <map>
+#include <atomic>
 #include "thc.h"
 #include "ProgressBar.h"
 #include "ListableGame.h"
 #include "MemoryPositionSearchSide.h"
 #include "PatternMatch.h"
+#include "PositionIndex.h"
+#include "PieceSquareMask.h"
+#include "HeaderColumns.h"
+#include "HeaderQuery.h"
 
 // For standard algorithm, works for any game
 struct MpsSlow
@@ -113,6 +120,65 @@ struct MpsQuickInit
     char squares[64];
 };
 
+// Games are searched in chunks of this many games, each worker thread grabs a chunk at a time
+#define MPS_GAMES_PER_CHUNK 1024
+
+// The quick search checkpoints its state every MPS_CHECKPOINT_PLY ply (must be even, so white
+//  is to move), for the first MPS_NBR_CHECKPOINTS checkpoints of each game (the state at ply 0
+//  is always available)
+#define MPS_CHECKPOINT_PLY   8
+#define MPS_NBR_CHECKPOINTS 16
+
+// Prefix sharing is abandoned for a chunk of games unless at least 1 in MPS_PREFIX_MIN_HITS of
+//  the first MPS_PREFIX_SAMPLE games searched benefit
+#define MPS_PREFIX_SAMPLE   64
+#define MPS_PREFIX_MIN_HITS 8
+
+// Ply in the position index lookup of a game that doesn't reach the search position
+#define INDEX_PLY_NOT_FOUND 0xffff
+
+struct MpsJob;
+
+// Each move in a given position has stats associated with it, "mover" is the player with the
+//  move in the position
+struct MOVE_STATS
+{
+    MOVE_STATS() { nbr_games=0; nbr_white_wins=0; nbr_black_wins=0; nbr_draws=0;
+                   nbr_mover_rated=0; mover_elo_total=0; nbr_opponent_rated=0; opponent_elo_total=0; opponent_rated_net_score=0; }
+    int nbr_games;
+    int nbr_white_wins;
+    int nbr_black_wins;
+    int nbr_draws;
+    int nbr_mover_rated;            // games where the mover has an Elo
+    int64_t mover_elo_total;
+    int nbr_opponent_rated;         // games with a result where the opponent has an Elo
+    int64_t opponent_elo_total;
+    int opponent_rated_net_score;   //  and the mover's wins minus losses in those games
+    void AddGame( int result_bin, bool white_is_mover, int white_elo, int black_elo );
+    void Add( const MOVE_STATS &other );
+
+    // Return 0 if no rated games
+    int AverageElo() const;
+    int Performance() const;        // linear approximation, opponents' average + 400*(W-L)/N
+
+    // Sort according to number of games
+    bool operator < (const MOVE_STATS& ms)  const { return nbr_games < ms.nbr_games; }
+    bool operator > (const MOVE_STATS& ms)  const { return nbr_games > ms.nbr_games; }
+    bool operator == (const MOVE_STATS& ms) const { return nbr_games == ms.nbr_games; }
+};
+
+// The opening explorer table for a position, calculated by the position search as it finds
+//  each game, so without playing through the games found again
+struct MpsMoveTable
+{
+    MOVE_STATS total;                   // all games found
+    std::map< char, MOVE_STATS > moves; // games continuing with each (compressed) move
+    std::map< std::string, int > paths; // the (compressed) moves leading to the position, with frequency
+    void Clear() { total = MOVE_STATS(); moves.clear(); paths.clear(); }
+    void AddGame( ListableGame *p, const char *blob, unsigned short offset_first, unsigned short offset_last, bool white_is_mover );
+    void Add( const MpsMoveTable &other );
+};
+
 struct DoSearchFoundGame
 {
     int idx;            // index into memory db
@@ -121,29 +187,157 @@ struct DoSearchFoundGame
     unsigned short offset_last;
 };
 
+// The target positions of a batch search, looked up by board (with the 'D'/'d' dark squared
+//  bishop convention) and side to move in an open addressing hash table
+struct MpsBatchSlot
+{
+    MpsBatchSlot() { signature=0; target=-1; }
+    uint64_t signature;
+    int      target;    // -1 if the slot is empty
+};
+
+class MpsBatchTargets
+{
+public:
+    MpsBatchTargets() { mask=0; }
+
+    // Returns the number of distinct targets, target_of_position gives the target of each position
+    int  Build( const std::vector<thc::ChessPosition> &positions, std::vector<int> &target_of_position );
+    int  NbrTargets() const { return static_cast<int>(whites.size()); }
+    bool White( int target ) const { return whites[target] ? true : false; }
+
+    // Returns the target, or -1 if the board isn't a target
+    int  Find( const char *squares, bool white ) const
+    {
+        if( table.size() == 0 )
+            return -1;
+        uint64_t signature = Signature( squares, white );
+        for( size_t i=signature&mask; table[i].target>=0; i=(i+1)&mask )
+        {
+            int target = table[i].target;
+            if( table[i].signature==signature && White(target)==white && memcmp(&boards[64*target],squares,64)==0 )
+                return target;
+        }
+        return -1;
+    }
+    static uint64_t Signature( const char *squares, bool white );
+
+private:
+    std::vector<MpsBatchSlot> table;
+    size_t                    mask;
+    std::vector<char>         boards;   // 64 squares for each target
+    std::vector<char>         whites;   // white to move, for each target
+};
+
+// A game reaching a batch search target position
+struct MpsBatchHit
+{
+    int target;
+    DoSearchFoundGame dsfg;
+};
+
+// The results for one batch search target position, as for a single position search
+struct MpsBatchResult
+{
+    std::vector<DoSearchFoundGame> games_found;
+    MpsMoveTable table;
+};
+
 class MemoryPositionSearch
 {
 public:
     MemoryPositionSearch()
     {
+        parallel_search = true;
+        prefix_sharing = true;
+        prefix_moves = NULL;
+        quick_fast_mode_lost = false;
+        fen_init_okay = false;
+        batch_targets = NULL;
+        header_filter_set = false;
+        nbr_checkpoints = 0;
+        cancel_flag = NULL;
         Init();
     }
     void Init();
     bool TryFastMode( MpsSide *side );
+    bool TryFastMode( MpsSide *side, const char *squares );
     bool SearchGameOptimisedNoPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster
+    bool SearchGameSharedPrefix( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );                   // faster again, for sorted games
+    bool SearchGameOptimisedPromotionAllowed( const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );      // fast, unless quick_fast_mode_lost
     bool SearchGameSlowPromotionAllowed(  const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
+    bool SearchGameFen( const char *fen, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );           // fast if possible
     bool PatternSearchGameOptimisedNoPromotionAllowed( PatternMatch &pm, bool &reverse, const char *moves_in, unsigned short &offset_first, unsigned short &offset_last  );    // much faster
     bool PatternSearchGameSlowPromotionAllowed( PatternMatch &pm, bool &reverse, const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last  );          // semi fast
     int  GetNbrGamesFound() { return games_found.size(); }
     std::vector< smart_ptr<ListableGame> > *search_source;
     std::vector< smart_ptr<ListableGame> >  &GetVectorSourceGames()   { return *search_source; }
     std::vector<DoSearchFoundGame>          &GetVectorGamesFound() { return games_found; }
+    MpsMoveTable                            &GetMoveTable() { return move_table; }
     int  DoSearch( const thc::ChessPosition &cp, ProgressBar *progress );
     int  DoSearch( const thc::ChessPosition &cp, ProgressBar *progress, std::vector< smart_ptr<ListableGame> > *source );
     int  DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats );
     int  DoPatternSearch( PatternMatch &pm, ProgressBar *progress, PATTERN_STATS &stats, std::vector< smart_ptr<ListableGame> > *source );
     bool IsThisSearchPosition( const thc::ChessPosition &cp )
         { return search_position_set && cp==search_position; }
+    void AttachDatabaseFile( const std::string &db_filename, const std::vector< smart_ptr<ListableGame> > &loaded );
+
+    // Search for many positions at once, eg every position in a repertoire, playing through
+    //  each game once however many positions there are. The results for each position are as
+    //  for a single position search (games found in source order, and the move table). The
+    //  last position search is forgotten. Returns false if cancelled
+    bool DoBatchSearch( const std::vector<thc::ChessPosition> &positions, ProgressBar *progress, std::vector<MpsBatchResult> &results );
+    bool DoBatchSearch( const std::vector<thc::ChessPosition> &positions, ProgressBar *progress, std::vector<MpsBatchResult> &results,
+                        std::vector< smart_ptr<ListableGame> > *source );
+    void DetachDatabaseFile();
+
+    // Searches of the database are parallel by default. The results are the same either way
+    //  (in source order), a single threaded search is for reproducing (eg timing) problems
+    void SetParallelSearch( bool parallel ) { parallel_search = parallel; }
+
+    // By default position searches skip the moves each game shares with the previous game,
+    //  again the results are the same either way
+    void SetPrefixSharing( bool share ) { prefix_sharing = share; }
+
+    // Restrict position, batch and pattern searches to games whose headers pass a filter. The
+    //  filter is checked before any of a game's moves are decoded, for the games loaded from
+    //  the database file it's evaluated in advance over the header columns. An empty filter
+    //  lifts the restriction. Results cached elsewhere (eg Database::position_cache) are stale
+    //  after a change of filter
+    void SetHeaderFilter( const HeaderFilter &filter );
+    bool IsHeaderFiltered() const { return header_filter_set; }
+    const HeaderColumns &GetHeaderColumns();   // eg to compile a HeaderQuery
+
+    // Select the in memory games a header query selects, in the same order, for use as the
+    //  source of a search (see GetSelectedGames()). The query is evaluated over the header
+    //  columns, so no game is unpacked. Searches of the selected games are as fast per game as
+    //  searches of all the in memory games (position index, piece square masks and all cores).
+    //  The selection lasts until the next SelectGames() or DetachDatabaseFile(). Returns the
+    //  number of games selected
+    int  SelectGames( const HeaderQuery &query );
+    std::vector< smart_ptr<ListableGame> > *GetSelectedGames() { return &selected_games; }
+
+    // Narrow the results of the last position search to the games that continue with the
+    //  compressed move to reach cp. Fast, since only the games already found are considered,
+    //  but games that reach cp by transposition are missing until the results are completed
+    //  with CompleteNarrowedSearch()
+    bool NarrowSearch( const thc::ChessPosition &cp, char compressed_move );
+    bool IsSearchNarrowed() { return search_position_set && search_narrowed; }
+
+    // Replace the narrowed results for cp with the complete results of a full search of the
+    //  same source (eg by another MemoryPositionSearch in the background). Returns true if
+    //  any games were missing
+    bool CompleteNarrowedSearch( const thc::ChessPosition &cp, const std::vector<DoSearchFoundGame> &complete, const MpsMoveTable &complete_table );
+
+    // Restore the (complete) results of an earlier search of the in memory games, eg from a cache
+    void RestoreSearch( const thc::ChessPosition &cp, const std::vector<DoSearchFoundGame> &found, const MpsMoveTable &table );
+
+    // Forget the last search, eg because the in memory games have been re-sorted
+    void ForgetSearch() { search_position_set=false; games_found.clear(); move_table.Clear(); }
+
+    // A search is abandoned (with incomplete results) if the cancel flag is set, eg by another
+    //  thread
+    void SetCancelFlag( std::atomic<bool> *cancel ) { cancel_flag = cancel; }
 
 public:
     std::vector< smart_ptr<ListableGame> > in_memory_game_cache;
@@ -151,7 +345,82 @@ public:
 private:
     thc::ChessPosition search_position;
     bool search_position_set;
+    bool search_narrowed;               // results are from NarrowSearch(), transpositions are missing
+    bool search_pattern;                // results are from a pattern search, can't be narrowed
     std::vector<DoSearchFoundGame> games_found;
+    MpsMoveTable move_table;            // of a position search (not a pattern search)
+    PositionIndex position_index;
+    uint32_t     file_first_game_id;    // game_id of the first game in the .tdb file, the ids then count down
+    uint32_t     file_nbr_games;        // number of games loaded from the .tdb file
+    uint32_t     index_nbr_games;       // number of loaded games the position index covers
+    PieceSquareMasks      piece_square_masks;
+    std::vector<uint64_t> game_masks;   // piece square mask of each loaded game, in .tdb file order
+    HeaderColumns         header_columns;   // headers of the loaded games, in .tdb file order (when first needed)
+    HeaderFilter          header_filter;
+    bool                  header_filter_set;
+    std::vector<uint8_t>  header_selected;  // for each loaded game, 1 if it passes the filter
+    std::vector< smart_ptr<ListableGame> > selected_games;  // from SelectGames(), some of the in memory games
+    void NeedHeaderColumns();
+
+    // Return true if the source is the in memory games, or those selected by SelectGames()
+    bool IsFileSource( const std::vector< smart_ptr<ListableGame> > *source ) const
+    {
+        return source==&in_memory_game_cache || source==&selected_games;
+    }
+
+    std::vector<unsigned short> search_index_ply;  // if the search position is indexed, each game's ply (or INDEX_PLY_NOT_FOUND)
+    uint64_t     search_target_mask;    // piece square mask of the search position
+    int          search_nbr_targets;    // pattern search target positions (reflected and/or reversed)
+    uint64_t     search_target_masks[4];//  and their piece square masks
+    bool         parallel_search;
+    bool         prefix_sharing;
+    std::atomic<bool> *cancel_flag;
+
+    // The previous game searched by SearchGameSharedPrefix()
+    const char     *prefix_moves;       // its moves, NULL if none
+    unsigned short prefix_decided;      // how many of its moves were read to decide the result
+    bool           prefix_found;        //  the result
+    unsigned short prefix_offset;       //  and the offset if found
+    int            nbr_checkpoints;     // checkpoints[i] is the state after (i+1)*MPS_CHECKPOINT_PLY of its moves
+    MpsQuickInit   checkpoints[MPS_NBR_CHECKPOINTS];
+    int            nbr_prefix_shared;   // games whose result was the previous game's
+    int            nbr_prefix_resumed;  // games searched from a checkpoint
+    int64_t        nbr_ply_skipped;     // moves not replayed thanks to the checkpoints
+
+    // How often each search path runs
+    int            nbr_quick;           // games without promotions, quick search
+    int            nbr_quick_promotion; // games with promotions, quick search
+    int            nbr_slow;            // games with promotions the quick search can't follow
+    int            nbr_fen;             // games from a setup position (also counted above)
+    int            nbr_filtered_out;    // games skipped by the header filter
+    bool           quick_fast_mode_lost;// the quick search gave up, a side's moves are in slow mode
+
+    // The setup position of the last game searched that didn't start from the standard starting
+    //  position
+    std::string    fen_init;
+    bool           fen_init_okay;
+    MpsSlowInit    msi_fen;
+
+    // During a batch search, the targets, and the targets reached by the game being searched
+    const MpsBatchTargets    *batch_targets;
+    std::vector<MpsBatchHit> batch_game_hits;
+
+    // Return true if the game was loaded from the .tdb file, with its position in the file
+    bool FileIdx( uint32_t game_id, uint32_t &file_idx ) const
+    {
+        file_idx = file_first_game_id - game_id;
+        return game_id<=file_first_game_id && file_idx<file_nbr_games;
+    }
+
+    // Return true if the header filter rules out the game
+    bool HeaderFilteredOut( ListableGame *p, bool in_file, uint32_t file_idx ) const
+    {
+        if( !header_filter_set )
+            return false;
+        if( in_file && file_idx<header_selected.size() )
+            return !header_selected[file_idx];
+        return !header_filter.Match( p, header_columns.cb_idx, header_columns.cb_idx_valid );
+    }
     MpsSlow      ms;
     MpsSlowInit  msi;
     MpsQuick     mq;
@@ -174,6 +443,22 @@ private:
         msi.sides[0] = mqi_init.side_white;
         msi.sides[1] = mqi_init.side_black;
     }
+    void InitPointers();
+    void SetSearchTarget( const thc::ChessPosition &cp );
+    void BatchProbe( const char *squares, bool white, unsigned short offset );
+    void BatchSearchGames( const MemoryPositionSearch &parent, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                        int begin, int end, std::vector<MpsBatchHit> &hits, int &nbr_masked_out );
+    void CopySearchTarget( const MemoryPositionSearch &parent );
+    bool RunSearchJob( MpsJob &job, ProgressBar *progress );
+    static void SearchWorker( MpsJob *job, MemoryPositionSearch *worker, PatternMatch *pm, ProgressBar *progress );
+    void SearchGames( const MemoryPositionSearch &parent, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                        int begin, int end, std::vector<DoSearchFoundGame> &found, MpsMoveTable &table, int &nbr_masked_out );
+    void PatternSearchGames( const MemoryPositionSearch &parent, PatternMatch &pm, const std::vector< smart_ptr<ListableGame> > &source, bool from_file,
+                        int begin, int end, std::vector<DoSearchFoundGame> &found, PATTERN_STATS &stats, int &nbr_masked_out );
+    bool FenGameInit( const char *fen );
+    thc::Move SlowPlayMove( char code, char &mover );
+    bool SlowSearch( const std::string &moves_in, unsigned short &offset_first, unsigned short &offset_last );
+    bool QuickSearch( const char *moves_in, unsigned short &offset, bool checkpoint, bool promotions, unsigned short &offset_first, unsigned short &offset_last );
     thc::Move UncompressSlowMode( char code );
     thc::Move UncompressFastMode( char code, MpsSide *side, MpsSide *other );
 };
@@ -60,6 +60,7 @@ bool PackedGameBinDb::RequestRecycle( int cb_idx )
         cb.players.clear();
         cb.events.clear();
         cb.sites.clear();
+        cb.strings_sorted = false;
         bin_db_control_block_used[cb_idx] = false;
         in_range = true;
     }
@@ -134,6 +135,7 @@ PackedGameBinDb::PackedGameBinDb(
     fields2 += compressed_moves;
     this->cb_idx=cb_idx;
     this->fields=fields2;
+    mapped_fields=NULL;
 }
 
 
@@ -168,22 +170,22 @@ void PackedGameBinDb::Unpack( Roster &r, std::string &blob )
 void PackedGameBinDb::Unpack( std::string &blob )
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    blob = fields.substr( cb->bb.Size() );
+    blob = std::string( Fields() + cb->bb.Size() );
 }
 
 void PackedGameBinDb::Unpack( Roster &r )
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int ievent = cb->bb.Read(0,&fields[0]);       // Event
-    int isite  = cb->bb.Read(1,&fields[0]);       // Site
-    int iwhite = cb->bb.Read(2,&fields[0]);       // White
-    int iblack = cb->bb.Read(3,&fields[0]);       // Black
-    uint32_t date = cb->bb.Read(4,&fields[0]);    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
-    int round = cb->bb.Read(5,&fields[0]);        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
-    int eco = cb->bb.Read(6,&fields[0]);          // ECO For now 500 codes (9 bits) (A..E)(00..99)
-    int result = cb->bb.Read(7,&fields[0]);       // Result (2 bits)
-    int white_elo = cb->bb.Read(8,&fields[0]);    // WhiteElo 12 bits (range 0..4095)
-    int black_elo = cb->bb.Read(9,&fields[0]);    // BlackElo 12 bits (range 0..4095)
+    int ievent = cb->bb.Read(0,Fields());       // Event
+    int isite  = cb->bb.Read(1,Fields());       // Site
+    int iwhite = cb->bb.Read(2,Fields());       // White
+    int iblack = cb->bb.Read(3,Fields());       // Black
+    uint32_t date = cb->bb.Read(4,Fields());    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    int round = cb->bb.Read(5,Fields());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), bb=board(0-1023)
+    int eco = cb->bb.Read(6,Fields());          // ECO For now 500 codes (9 bits) (A..E)(00..99)
+    int result = cb->bb.Read(7,Fields());       // Result (2 bits)
+    int white_elo = cb->bb.Read(8,Fields());    // WhiteElo 12 bits (range 0..4095)
+    int black_elo = cb->bb.Read(9,Fields());    // BlackElo 12 bits (range 0..4095)
     std::string sdate;
     std::string sround;
     std::string seco;
@@ -211,28 +213,28 @@ void PackedGameBinDb::Unpack( Roster &r )
 const char *PackedGameBinDb::Event()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(0,&fields[0]);
+    int i = cb->bb.Read(0,Fields());
     return cb->events[i].c_str();
 }
 
 const char *PackedGameBinDb::Site()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(1,&fields[0]);
+    int i = cb->bb.Read(1,Fields());
     return cb->sites[i].c_str();
 }
 
 const char *PackedGameBinDb::White()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(2,&fields[0]);
+    int i = cb->bb.Read(2,Fields());
     return cb->players[i].c_str();
 }
 
 const char *PackedGameBinDb::Black()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int i = cb->bb.Read(3,&fields[0]);
+    int i = cb->bb.Read(3,Fields());
     return cb->players[i].c_str();
 }
 
@@ -241,7 +243,7 @@ const char *PackedGameBinDb::Result()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sresult = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int result = cb->bb.Read(7,&fields[0]);       // Result (2 bits)
+    int result = cb->bb.Read(7,Fields());       // Result (2 bits)
     Bin2Result(result,sresult);
     return sresult.c_str();
 }
@@ -251,7 +253,7 @@ const char *PackedGameBinDb::Round()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sround = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int round = cb->bb.Read(5,&fields[0]);        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb->bb=board(0-1023)
+    int round = cb->bb.Read(5,Fields());        // Round for now 16 bits -> rrrrrrbbbbbbbbbb   rr=round (0-63), cb->bb=board(0-1023)
     Bin2Round (round,sround);
     return sround.c_str();
 }
@@ -261,7 +263,7 @@ const char *PackedGameBinDb::Date()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& sdate = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    uint32_t date = cb->bb.Read(4,&fields[0]);    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
+    uint32_t date = cb->bb.Read(4,Fields());    // Date 19 bits, format yyyyyyyyyymmmmddddd, (year values have 1500 offset)
     Bin2Date  (date,sdate);
     return sdate.c_str();
 }
@@ -271,7 +273,7 @@ const char *PackedGameBinDb::Eco()
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
     std::string& seco = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
-    int eco = cb->bb.Read(6,&fields[0]);          // ECO For now 500 codes (9 bits) (A..E)(00..99)
+    int eco = cb->bb.Read(6,Fields());          // ECO For now 500 codes (9 bits) (A..E)(00..99)
     Bin2Eco   (eco,seco);
     return seco.c_str();
 }
@@ -279,7 +281,7 @@ const char *PackedGameBinDb::Eco()
 const char *PackedGameBinDb::WhiteElo()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int white_elo = cb->bb.Read(8,&fields[0]);    // WhiteElo 12 bits (range 0..4095)
+    int white_elo = cb->bb.Read(8,Fields());    // WhiteElo 12 bits (range 0..4095)
     std::string& swhite_elo = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
     Bin2Elo   (white_elo,swhite_elo);
@@ -289,7 +291,7 @@ const char *PackedGameBinDb::WhiteElo()
 const char *PackedGameBinDb::BlackElo()
 {
     PackedGameBinDbControlBlock *cb = &bin_db_control_blocks[cb_idx];
-    int black_elo = cb->bb.Read(9,&fields[0]);    // BlackElo 12 bits (range 0..4095)
+    int black_elo = cb->bb.Read(9,Fields());    // BlackElo 12 bits (range 0..4095)
     std::string& sblack_elo = pool[pool_idx++];
     pool_idx &= (POOL_SIZE-1);
     Bin2Elo   (black_elo,sblack_elo);
@@ -241,6 +241,27 @@ void PatternMatch::PrimePattern( const thc::ChessPosition *rover )
 }
 
 // Test against criteria
+int PatternMatch::GetTargets( const char *target_squares[4] )
+{
+    int nbr = 0;
+    for( int i=0; !parm.material_balance && i<reflect_and_reverse; i++ )
+    {
+        PatternMatchTarget *target;
+        switch(i)
+        {
+            default:
+            case 0: target = &target_n;   break;
+            case 1: target = &target_m;   break;
+            case 2: target = &target_r;   break;
+            case 3: target = &target_rm;  break;
+        }
+        if( reflect_and_reverse==3 && i==1 )    // reflect_and_reverse==3 means do i==0 and i==2
+            continue;
+        target_squares[nbr++] = target->cp.squares;
+    }
+    return nbr;
+}
+
 bool PatternMatch::TestPattern( bool &reverse, bool white, const char *squares_rover )
 {
     //static bool debug;
@@ -17,6 +17,14 @@ struct PATTERN_STATS
     int black_wins;
     int draws;
     PATTERN_STATS() {nbr_games=0; nbr_reversed_games=0; white_wins=0; black_wins=0; draws=0;}
+    void Add( const PATTERN_STATS &other )
+    {
+        nbr_games          += other.nbr_games;
+        nbr_reversed_games += other.nbr_reversed_games;
+        white_wins         += other.white_wins;
+        black_wins         += other.black_wins;
+        draws              += other.draws;
+    }
 };
 
 struct PatternParameters
@@ -137,6 +145,10 @@ public:
     void NowReady() { ready = true; }
     bool IsReady()  { return ready; }
 
+    // The target positions a game must reach for a pattern match (after Prime()), returns
+    //  the number of targets, 0 for a material balance search (no fixed target position)
+    int GetTargets( const char *target_squares[4] );
+
     // Test for pattern
     bool Test( bool &reverse, MpsSide *ws, MpsSide *bs, bool white, const char *squares_rover, bool may_need_to_rebuild_side )
     {
@@ -0,0 +1,52 @@
+/****************************************************************************
+ * PieceSquareMask - Rule out games quickly, before playing through them
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PIECE_SQUARE_MASK_H
+#define PIECE_SQUARE_MASK_H
+#include <stdint.h>
+#include <vector>
+#include "ListableGame.h"
+
+// Each bit of a mask represents a piece square combo, eg white knight on f3. A game's mask
+//  has a bit set if the piece ever stands on the square during the game. A search for a
+//  position with a white knight on f3 needn't play through the (typically 10% or so of)
+//  games where no white knight ever stands on f3. A database chooses its own 64 most
+//  effective combos when it is written, following the DATABASE_EXPERIMENTS in Database.cpp;
+//  effectiveness E = S*(1-H), S = how often the combo is found in positions in the first
+//  30 ply or so (so how often it's likely to be in a searched for position), H = the
+//  proportion of games where it's found at all
+#define PIECE_SQUARE_NBR_COMBOS 64
+
+class PieceSquareMasks
+{
+public:
+    PieceSquareMasks() { Clear(); }
+    void Clear();
+
+    // Choose the combos, by sampling every step'th one of the first nbr_games games (step 0
+    //  means SampleStep(nbr_games))
+    void ChooseCombos( std::vector< smart_ptr<ListableGame> > &games, size_t nbr_games, size_t step=0 );
+    static size_t SampleStep( size_t nbr_games );
+
+    // Serialise the combos, PIECE_SQUARE_NBR_COMBOS (piece,square) pairs
+    void GetCombos( uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2] ) const;
+    void SetCombos( const uint8_t combos[PIECE_SQUARE_NBR_COMBOS*2] );
+    int  NbrCombos() const { return nbr_combos; }
+
+    // The mask of a game (starting from the standard position)
+    uint64_t GameMask( const char *blob ) const;
+
+    // The mask of the pieces in a position, accepts the 'D'/'d' dark squared bishop convention
+    uint64_t PositionMask( const char *squares ) const;
+
+private:
+    int     nbr_combos;
+    char    piece[PIECE_SQUARE_NBR_COMBOS];     // 'P','N','B','R','Q','K','p','n'... or '\0' if unused
+    uint8_t square[PIECE_SQUARE_NBR_COMBOS];    // thc::Square
+    uint64_t bit[12][64];                       // mask bit (if any) for each piece and square
+};
+
+#endif  // PIECE_SQUARE_MASK_H
@@ -0,0 +1,98 @@
+/****************************************************************************
+ * PositionCache - Results of recent database position searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <algorithm>
+#include "DebugPrintf.h"
+#include "PositionCache.h"
+
+// Approximate, the std::map node and std::list node overheads are a guess
+size_t POSITION_CACHE_ENTRY::MemoryUsed() const
+{
+    size_t total = sizeof(*this) + 4*sizeof(void *);
+    total += games_found.capacity() * sizeof(DoSearchFoundGame);
+    total += table.moves.size() * (sizeof(std::pair<const char,MOVE_STATS>) + 4*sizeof(void *));
+    std::map<std::string,int>::const_iterator it;
+    for( it=table.paths.begin(); it!=table.paths.end(); it++ )
+        total += sizeof(std::pair<const std::string,int>) + 4*sizeof(void *) + it->first.capacity();
+    return total;
+}
+
+// Searches match the board and the side to move, so both are in the key. Castling and en
+//  passant rights aren't, they don't change the games found, but Lookup() still checks the
+//  whole position
+static uint64_t CacheKey( const thc::ChessPosition &cp )
+{
+    thc::ChessPosition temp = cp;
+    uint64_t hash = temp.Hash64Calculate();
+    return cp.white ? hash : hash^0x9e3779b97f4a7c15ULL;
+}
+
+void PositionCache::Clear()
+{
+    if( lru.size() > 0 )
+        cprintf( "Position cache cleared, %d entries, %d hits, %d misses\n", static_cast<int>(lru.size()), nbr_hits, nbr_misses );
+    lru.clear();
+    index.clear();
+    bytes = 0;
+    nbr_hits = 0;
+    nbr_misses = 0;
+}
+
+const POSITION_CACHE_ENTRY *PositionCache::Lookup( const thc::ChessPosition &cp, const std::vector< smart_ptr<ListableGame> > *source )
+{
+    uint64_t hash = CacheKey( cp );
+    std::unordered_map< uint64_t, std::list<POSITION_CACHE_ENTRY>::iterator >::iterator it = index.find(hash);
+    if( it == index.end() )
+    {
+        nbr_misses++;
+        return NULL;
+    }
+    std::list<POSITION_CACHE_ENTRY>::iterator entry = it->second;
+    if( !(entry->position==cp) )
+    {
+        nbr_misses++;   // key collision
+        return NULL;
+    }
+    if( entry->source!=source || entry->nbr_source_games!=source->size() )
+    {
+        nbr_misses++;   // stale, the games have changed
+        Erase( hash );
+        return NULL;
+    }
+    nbr_hits++;
+    lru.splice( lru.begin(), lru, entry );
+    cprintf( "Position cache hit, %d games (%d hits, %d misses)\n", static_cast<int>(entry->games_found.size()), nbr_hits, nbr_misses );
+    return &*entry;
+}
+
+void PositionCache::Insert( POSITION_CACHE_ENTRY &entry )
+{
+    size_t entry_bytes = entry.MemoryUsed();
+    if( entry_bytes > max_bytes )
+        return;
+    uint64_t hash = CacheKey( entry.position );
+    Erase( hash );
+    lru.push_front( POSITION_CACHE_ENTRY() );
+    std::swap( lru.front(), entry );
+    index[hash] = lru.begin();
+    bytes += entry_bytes;
+
+    // Evict the least recently used entries to stay within the memory limit
+    while( bytes > max_bytes && lru.size() > 1 )
+        Erase( CacheKey(lru.back().position) );
+    cprintf( "Position cache: %d entries, %lu bytes\n", static_cast<int>(lru.size()), static_cast<unsigned long>(bytes) );
+}
+
+void PositionCache::Erase( uint64_t hash )
+{
+    std::unordered_map< uint64_t, std::list<POSITION_CACHE_ENTRY>::iterator >::iterator it = index.find(hash);
+    if( it != index.end() )
+    {
+        bytes -= it->second->MemoryUsed();
+        lru.erase( it->second );
+        index.erase( it );
+    }
+}
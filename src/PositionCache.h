@@ -0,0 +1,77 @@
+/****************************************************************************
+ * PositionCache - Results of recent database position searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITION_CACHE_H
+#define POSITION_CACHE_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include "thc.h"
+#include "ListableGame.h"
+#include "MemoryPositionSearch.h"
+
+// Individual path to a given position
+struct PATH_TO_POSITION
+{
+    PATH_TO_POSITION() { frequency=0; }
+    int frequency;
+    std::string blob;
+
+    // Sort according to frequency
+    bool operator < (const PATH_TO_POSITION& ptp)  const { return frequency < ptp.frequency; }
+    bool operator > (const PATH_TO_POSITION& ptp)  const { return frequency > ptp.frequency; }
+    bool operator == (const PATH_TO_POSITION& ptp) const { return frequency == ptp.frequency; }
+};
+
+// The results of a search for one position, the games found and the move table calculated
+//  from them
+struct POSITION_CACHE_ENTRY
+{
+    POSITION_CACHE_ENTRY() { source=NULL; nbr_source_games=0; }
+    thc::ChessPosition position;
+    const std::vector< smart_ptr<ListableGame> > *source;  // the games searched
+    size_t nbr_source_games;                               //  and how many there were
+    std::vector<DoSearchFoundGame> games_found;
+    MpsMoveTable table;
+    size_t MemoryUsed() const;
+};
+
+// Users go back and forth between the same handful of positions in the database dialog, so
+//  keep the most recently used results, up to a memory limit. Entries are keyed by position
+//  hash and side to move (the position itself is checked too, so a collision is just a miss).
+//  The cache must be cleared whenever the source games change, for example the database is
+//  reopened (including after appending to it) or the games are re-sorted
+#define POSITION_CACHE_MAX_BYTES (128*1024*1024)
+
+class PositionCache
+{
+public:
+    PositionCache( size_t max_bytes=POSITION_CACHE_MAX_BYTES )
+        { this->max_bytes=max_bytes; bytes=0; nbr_hits=0; nbr_misses=0; }
+    void Clear();
+
+    // Returns NULL if there are no results for the position, otherwise the results, valid
+    //  until the next Insert() or Clear()
+    const POSITION_CACHE_ENTRY *Lookup( const thc::ChessPosition &cp, const std::vector< smart_ptr<ListableGame> > *source );
+
+    // Takes over the contents of entry (entry is left empty)
+    void Insert( POSITION_CACHE_ENTRY &entry );
+    size_t MemoryUsed() { return bytes; }
+
+private:
+    std::list<POSITION_CACHE_ENTRY> lru;   // most recently used first
+    std::unordered_map< uint64_t, std::list<POSITION_CACHE_ENTRY>::iterator > index;
+    size_t bytes;
+    size_t max_bytes;
+    int    nbr_hits;
+    int    nbr_misses;
+    void Erase( uint64_t hash );
+};
+
+#endif  // POSITION_CACHE_H
@@ -0,0 +1,302 @@
+/****************************************************************************
+ * PositionIndex - Optional persistent index of the positions in a .tdb file
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include "DebugPrintf.h"
+#include "CompressMoves.h"
+#include "BinDbMappedFile.h"
+#include "BinDb.h"
+#include "PositionIndex.h"
+
+/*
+    The .tdi file format is;
+
+    PositionIndexHeader
+    PositionIndexKey  keys[nbr_keys+1]       sorted by hash, the last key is a sentinel
+    uint64_t          postings[nbr_postings] (game_idx<<16) | ply
+
+    The postings for keys[i] are postings[keys[i].first_posting] up to (but not including)
+    postings[keys[i+1].first_posting], sorted by game_idx then ply. A game can have two
+    postings for the same key, the first ply the position is reached with white to move and
+    the first ply it is reached with black to move.
+
+    The header records the length of the .tdb file and a checksum of its final bytes, so an
+    index that doesn't belong to the .tdb (eg the .tdb was recreated without -i) is ignored.
+    Games appended in place (see BinDbAppendInPlace()) go after the end of the indexed file,
+    so the index still covers the games it always did, the rest are searched without it.
+*/
+
+#define POSITION_INDEX_TDB_TAIL 4096    // size of the final part of the .tdb file checksummed
+
+struct PositionIndexHeader
+{
+    char     signature[4];          // "TDPI"
+    uint32_t hdr_len;               // sizeof(PositionIndexHeader), a future compatibility feature
+    uint64_t tdb_len;               // length of the .tdb file (it may have grown since)
+    uint32_t tdb_checksum;          // CRC-32 of the last POSITION_INDEX_TDB_TAIL bytes of those tdb_len bytes
+    uint32_t nbr_games;             // the first nbr_games games in the .tdb file are covered
+    uint32_t max_ply;               // POSITION_INDEX_MAX_PLY and POSITION_INDEX_MIN_GAMES used
+    uint32_t min_games;             //  when the index was built
+    uint64_t nbr_keys;
+    uint64_t nbr_postings;
+};
+
+struct PositionIndexKey
+{
+    uint64_t hash;
+    uint64_t first_posting;
+};
+
+std::string PositionIndex::Filename( const std::string &db_filename )
+{
+    std::string s = db_filename;
+    size_t len = s.length();
+    if( len>4 && s[len-4]=='.' && tolower(s[len-3])=='t' && tolower(s[len-2])=='d' && tolower(s[len-1])=='b' )
+        s = s.substr(0,len-4);
+    s += ".tdi";
+    return s;
+}
+
+// Identify the first tdb_len bytes of the .tdb file, or the whole file if tdb_len is 0.
+//  Return bool ok
+static bool TdbIdentity( const std::string &db_filename, uint64_t &tdb_len, uint32_t &tdb_checksum )
+{
+    FILE *f = fopen( db_filename.c_str(), "rb" );
+    if( !f )
+        return false;
+    BinDbMappedFile mf;
+    bool ok = mf.Map(f);
+    fclose(f);
+    if( tdb_len == 0 )
+        tdb_len = mf.len;
+    ok = ok && tdb_len<=mf.len;
+    if( ok )
+    {
+        uint64_t tail = tdb_len<POSITION_INDEX_TDB_TAIL ? tdb_len : POSITION_INDEX_TDB_TAIL;
+        tdb_checksum = Crc32( 0, mf.base + (tdb_len-tail), static_cast<size_t>(tail) );
+    }
+    return ok;
+}
+
+// Return bool ok
+bool PositionIndex::Open( const std::string &db_filename )
+{
+    Close();
+    std::string filename = Filename(db_filename);
+    FILE *f = fopen( filename.c_str(), "rb" );
+    if( !f )
+        return false;   // no index, the usual case
+    smart_ptr<BinDbMappedFile> mf( new BinDbMappedFile );
+    bool ok = mf->Map(f);
+    fclose(f);
+    PositionIndexHeader hdr;
+    ok = ok && mf->len>=sizeof(hdr);
+    if( ok )
+    {
+        memcpy( &hdr, mf->base, sizeof(hdr) );
+        ok = (0 == memcmp(hdr.signature,"TDPI",4)) && hdr.hdr_len==sizeof(hdr);
+    }
+    if( ok )
+    {
+        uint64_t keys_len     = (hdr.nbr_keys+1) * sizeof(PositionIndexKey);
+        uint64_t postings_len = hdr.nbr_postings * sizeof(uint64_t);
+        ok = hdr.nbr_keys<mf->len && hdr.nbr_postings<mf->len && sizeof(hdr)+keys_len+postings_len==mf->len;
+    }
+    if( ok )
+    {
+        uint64_t tdb_len=hdr.tdb_len;
+        uint32_t tdb_checksum=0;
+        ok = hdr.tdb_len>0 && TdbIdentity( db_filename, tdb_len, tdb_checksum ) && tdb_checksum==hdr.tdb_checksum;
+        if( !ok )
+            cprintf( "Position index %s doesn't match database, ignored\n", filename.c_str() );
+    }
+    if( ok )
+    {
+        keys         = reinterpret_cast<const PositionIndexKey *>( mf->base + sizeof(hdr) );
+        postings     = reinterpret_cast<const uint64_t *>( mf->base + sizeof(hdr) + (hdr.nbr_keys+1)*sizeof(PositionIndexKey) );
+        nbr_keys     = hdr.nbr_keys;
+        nbr_postings = hdr.nbr_postings;
+        nbr_games    = hdr.nbr_games;
+        mapped_file  = mf;
+        cprintf( "Position index %s: %lu games, %lu positions\n", filename.c_str(),
+                    static_cast<unsigned long>(nbr_games), static_cast<unsigned long>(nbr_keys) );
+    }
+    return ok;
+}
+
+void PositionIndex::Close()
+{
+    mapped_file.reset();
+    keys         = NULL;
+    postings     = NULL;
+    nbr_keys     = 0;
+    nbr_postings = 0;
+    nbr_games    = 0;
+}
+
+static bool KeyLessThan( const PositionIndexKey &key, uint64_t hash )
+{
+    return key.hash < hash;
+}
+
+bool PositionIndex::Lookup( uint64_t hash, bool white, std::vector<PositionIndexPosting> &found )
+{
+    found.clear();
+    if( !keys )
+        return false;
+    const PositionIndexKey *end = keys + nbr_keys;
+    const PositionIndexKey *key = std::lower_bound( keys, end, hash, KeyLessThan );
+    if( key==end || key->hash!=hash )
+        return false;
+    uint64_t first = key[0].first_posting;
+    uint64_t last  = key[1].first_posting;
+    if( first>last || last>nbr_postings )
+        return false;   // corrupt, let the caller search instead
+    for( uint64_t i=first; i<last; i++ )
+    {
+        PositionIndexPosting posting;
+        posting.game_idx = static_cast<uint32_t>(postings[i]>>16);
+        posting.ply      = static_cast<unsigned short>(postings[i]&0xffff);
+        bool white_to_move = ((posting.ply&1) == 0);
+        if( white_to_move == white )
+            found.push_back(posting);
+    }
+    return true;
+}
+
+// Two passes over the games. The first finds the positions to index, the second finds every
+//  game that reaches those positions. The games are replayed from the initial position, a
+//  .tdb file has no games with a FEN
+bool PositionIndexBuild( const std::string &db_filename, std::vector< smart_ptr<ListableGame> > &games, ProgressBar *pb )
+{
+    std::string filename = PositionIndex::Filename(db_filename);
+    uint32_t nbr_games = games.size();
+    bool aborted = false;
+
+    // Pass 1, the positions reached within POSITION_INDEX_MAX_PLY ply, once per game
+    std::vector<uint64_t> early;
+    std::vector<uint64_t> game_hashes;
+    for( uint32_t i=0; !aborted && i<nbr_games; i++ )
+    {
+        CompressMoves press;
+        const char *blob = games[i]->CompressedMoves();
+        game_hashes.clear();
+        game_hashes.push_back( press.cr.Hash64Calculate() );
+        for( int ply=1; ply<=POSITION_INDEX_MAX_PLY && *blob; ply++ )
+        {
+            press.UncompressMove( *blob++ );
+            game_hashes.push_back( press.cr.Hash64Calculate() );
+        }
+        std::sort( game_hashes.begin(), game_hashes.end() );
+        game_hashes.erase( std::unique(game_hashes.begin(),game_hashes.end()), game_hashes.end() );
+        early.insert( early.end(), game_hashes.begin(), game_hashes.end() );
+        if( (i&0xfff)==0 && pb )
+            aborted = pb->Perfraction( i, nbr_games*2 );
+    }
+
+    // Keep those reached by at least POSITION_INDEX_MIN_GAMES games
+    std::sort( early.begin(), early.end() );
+    std::vector<uint64_t> keys;
+    for( size_t i=0; i<early.size(); )
+    {
+        size_t j=i+1;
+        while( j<early.size() && early[j]==early[i] )
+            j++;
+        if( j-i >= POSITION_INDEX_MIN_GAMES )
+            keys.push_back(early[i]);
+        i = j;
+    }
+    std::vector<uint64_t>().swap(early);
+
+    // A bitmap of (the top bits of) the keys avoids most binary searches in pass 2, since
+    //  most positions reached later in games aren't indexed
+    const int filter_shift = 38;
+    std::vector<bool> filter( static_cast<size_t>(1)<<(64-filter_shift), false );
+    for( size_t i=0; i<keys.size(); i++ )
+        filter[ static_cast<size_t>(keys[i]>>filter_shift) ] = true;
+
+    // Pass 2, every game that reaches an indexed position at any ply, first ply with each side
+    //  to move only
+    std::vector< std::pair<uint64_t,uint64_t> > entries;
+    std::vector< std::pair<uint64_t,uint64_t> > game_entries;
+    for( uint32_t i=0; !aborted && i<nbr_games; i++ )
+    {
+        CompressMoves press;
+        const char *blob = games[i]->CompressedMoves();
+        game_entries.clear();
+        for( unsigned int ply=0; ply<0xffff; ply++ )
+        {
+            uint64_t hash = press.cr.Hash64Calculate();
+            if( filter[ static_cast<size_t>(hash>>filter_shift) ] && std::binary_search(keys.begin(),keys.end(),hash) )
+            {
+                bool already = false;
+                for( size_t j=0; !already && j<game_entries.size(); j++ )
+                {
+                    unsigned int earlier_ply = static_cast<unsigned int>(game_entries[j].second&0xffff);
+                    already = (game_entries[j].first==hash && (earlier_ply&1)==(ply&1));
+                }
+                if( !already )
+                    game_entries.push_back( std::pair<uint64_t,uint64_t>( hash, (static_cast<uint64_t>(i)<<16) | ply ) );
+            }
+            if( !*blob )
+                break;
+            press.UncompressMove( *blob++ );
+        }
+        entries.insert( entries.end(), game_entries.begin(), game_entries.end() );
+        if( (i&0xfff)==0 && pb )
+            aborted = pb->Perfraction( nbr_games+i, nbr_games*2 );
+    }
+    if( aborted )
+        return false;
+    std::sort( entries.begin(), entries.end() );
+
+    // Write the index
+    PositionIndexHeader hdr;
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.signature, "TDPI", 4 );
+    hdr.hdr_len      = sizeof(hdr);
+    hdr.nbr_games    = nbr_games;
+    hdr.max_ply      = POSITION_INDEX_MAX_PLY;
+    hdr.min_games    = POSITION_INDEX_MIN_GAMES;
+    hdr.nbr_keys     = keys.size();
+    hdr.nbr_postings = entries.size();
+    bool ok = TdbIdentity( db_filename, hdr.tdb_len, hdr.tdb_checksum );
+    FILE *ofile = ok ? fopen( filename.c_str(), "wb" ) : NULL;
+    ok = (ofile != NULL);
+    if( ok )
+        ok = (1 == fwrite( &hdr, sizeof(hdr), 1, ofile ));
+    size_t j=0;
+    for( size_t i=0; ok && i<=keys.size(); i++ )
+    {
+        PositionIndexKey key;
+        key.hash = i<keys.size() ? keys[i] : 0;
+        while( j<entries.size() && entries[j].first<key.hash )
+            j++;
+        if( i == keys.size() )
+            j = entries.size();     // sentinel
+        key.first_posting = j;
+        ok = (1 == fwrite( &key, sizeof(key), 1, ofile ));
+    }
+    for( size_t i=0; ok && i<entries.size(); i++ )
+        ok = (1 == fwrite( &entries[i].second, sizeof(uint64_t), 1, ofile ));
+    if( ofile )
+        ok = (0 == fclose(ofile)) && ok;
+    if( ok )
+        cprintf( "Position index %s: %lu games, %lu positions, %lu postings\n", filename.c_str(),
+                    static_cast<unsigned long>(nbr_games), static_cast<unsigned long>(keys.size()), static_cast<unsigned long>(entries.size()) );
+    else
+    {
+        cprintf( "Cannot write position index %s\n", filename.c_str() );
+        if( ofile )
+            remove( filename.c_str() );
+    }
+    return ok;
+}
@@ -0,0 +1,136 @@
+/****************************************************************************
+ * RepertoireReport - Annotate a repertoire with database coverage
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#include <stdio.h>
+#include <map>
+#include "DebugPrintf.h"
+#include "CompressMoves.h"
+#include "RepertoireReport.h"
+
+bool RepertoireReport::Annotate( MoveTree &tree, thc::ChessPosition &start_position, MemoryPositionSearch &db, ProgressBar *progress )
+{
+    nbr_positions = 0;
+    nbr_positions_found = 0;
+    nbr_uncovered = 0;
+    nodes.clear();
+    if( tree.variations.size() == 0 )
+        return true;
+
+    // Find every position in the repertoire, the start position first
+    thc::ChessRules cr(start_position);
+    std::vector<MoveTree> &main_line = tree.variations[0];
+    AddNode( NULL, cr, &main_line, 0 );
+    Collect( main_line, cr );
+    std::vector<thc::ChessPosition> positions;
+    for( size_t i=0; i<nodes.size(); i++ )
+        positions.push_back( nodes[i].position );
+
+    // One pass through the database games finds all of them
+    std::vector<MpsBatchResult> results;
+    if( !db.DoBatchSearch( positions, progress, results ) )
+        return false;
+    nbr_positions = static_cast<int>(nodes.size());
+    for( size_t i=0; i<nodes.size(); i++ )
+    {
+        REPERTOIRE_NODE &rn = nodes[i];
+        if( results[i].table.total.nbr_games == 0 )
+            continue;
+        nbr_positions_found++;
+        std::string txt = Comment( rn, results[i] );
+        if( rn.node == NULL )
+        {
+            if( main_line.size() > 0 )
+            {
+                std::string &pre_comment = main_line[0].game_move.pre_comment;
+                pre_comment = pre_comment.length() ? pre_comment + " " + txt : txt;
+            }
+        }
+        else
+        {
+            std::string &comment = rn.node->game_move.comment;
+            comment = comment.length() ? comment + " " + txt : txt;
+        }
+    }
+    cprintf( "Repertoire report: %d positions, %d found in database, %d moves not covered\n", nbr_positions, nbr_positions_found, nbr_uncovered );
+    nodes.clear();
+    return true;
+}
+
+// The repertoire's moves in a position are the next move in the variation and the first
+//  move of each of its alternatives
+void RepertoireReport::AddNode( MoveTree *node, const thc::ChessRules &position, const std::vector<MoveTree> *var, size_t next )
+{
+    REPERTOIRE_NODE rn;
+    rn.node = node;
+    rn.position = position;
+    if( next < var->size() )
+    {
+        const MoveTree &mt = (*var)[next];
+        rn.covered.push_back( mt.game_move.move );
+        for( size_t i=0; i<mt.variations.size(); i++ )
+        {
+            if( mt.variations[i].size() > 0 )
+                rn.covered.push_back( mt.variations[i][0].game_move.move );
+        }
+    }
+    nodes.push_back( rn );
+}
+
+// A node's variations are alternatives to its move, so they start from the position before it
+void RepertoireReport::Collect( std::vector<MoveTree> &var, thc::ChessRules cr )
+{
+    for( size_t j=0; j<var.size(); j++ )
+    {
+        MoveTree &mt = var[j];
+        for( size_t i=0; i<mt.variations.size(); i++ )
+            Collect( mt.variations[i], cr );
+        cr.PlayMove( mt.game_move.move );
+        AddNode( &mt, cr, &var, j+1 );
+    }
+}
+
+std::string RepertoireReport::Comment( REPERTOIRE_NODE &rn, const MpsBatchResult &result )
+{
+    const MOVE_STATS &total = result.table.total;
+    int nbr_games = total.nbr_games;
+    int draws_plus_no_result = nbr_games - total.nbr_white_wins - total.nbr_black_wins;
+    double percentage_score = ((1.0*total.nbr_white_wins + 0.5*draws_plus_no_result) * 100.0) / nbr_games;
+    char buf[200];
+    sprintf( buf, "%d %s, white scores %.1f%% +%d -%d =%d",
+            nbr_games,
+            nbr_games==1 ? "game" : "games",
+            percentage_score,
+            total.nbr_white_wins, total.nbr_black_wins, total.nbr_draws );
+    std::string txt = buf;
+
+    // The database moves not in the repertoire, most popular first
+    std::multimap< MOVE_STATS, char > dst;
+    std::map< char, MOVE_STATS >::const_iterator it;
+    for( it=result.table.moves.begin(); it!=result.table.moves.end(); it++ )
+        dst.insert( std::pair< MOVE_STATS, char >( it->second, it->first ) );
+    int nbr_listed = 0;
+    std::multimap< MOVE_STATS, char >::reverse_iterator it2;
+    for( it2=dst.rbegin(); it2!=dst.rend(); it2++ )
+    {
+        CompressMoves press(rn.position);
+        thc::Move mv = press.UncompressMove( it2->second );
+        bool covered = false;
+        for( size_t i=0; !covered && i<rn.covered.size(); i++ )
+            covered = (mv == rn.covered[i]);
+        if( covered )
+            continue;
+        nbr_uncovered++;
+        if( nbr_listed >= REPERTOIRE_NBR_UNCOVERED )
+            continue;
+        std::string s = mv.NaturalOut(&rn.position);
+        if( !rn.position.white )
+            s = "..." + s;
+        sprintf( buf, "%s%s %d", nbr_listed==0 ? "; not covered: " : ", ", s.c_str(), it2->first.nbr_games );
+        txt += buf;
+        nbr_listed++;
+    }
+    return txt;
+}
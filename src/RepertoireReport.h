@@ -0,0 +1,51 @@
+/****************************************************************************
+ * RepertoireReport - Annotate a repertoire with database coverage
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2016, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef REPERTOIRE_REPORT_H
+#define REPERTOIRE_REPORT_H
+#include <string>
+#include <vector>
+#include "thc.h"
+#include "MoveTree.h"
+#include "MemoryPositionSearch.h"
+
+// A repertoire is a game with (deep) variations. Every move in the repertoire, main line and
+//  variations, is annotated with the number of database games reaching the position after the
+//  move, the score in those games and the most popular database moves the repertoire doesn't
+//  cover from there (at the end of a line that's simply the most popular moves). The start
+//  position is reported in the pre-comment of the first move. Positions reached by no games
+//  are left alone. All positions are found with a single batch search, one pass through the
+//  games rather than one search per position
+#define REPERTOIRE_NBR_UNCOVERED 3
+
+struct REPERTOIRE_NODE
+{
+    MoveTree *node;                     // NULL for the start position
+    thc::ChessRules position;           // the position after the node's move
+    std::vector<thc::Move> covered;     // the repertoire's moves in the position
+};
+
+class RepertoireReport
+{
+public:
+    RepertoireReport() { nbr_positions=0; nbr_positions_found=0; nbr_uncovered=0; }
+
+    // Returns false if the search is aborted, in which case the tree is unchanged
+    bool Annotate( MoveTree &tree, thc::ChessPosition &start_position, MemoryPositionSearch &db, ProgressBar *progress );
+
+    // Summary of the last Annotate()
+    int nbr_positions;          // positions in the repertoire
+    int nbr_positions_found;    //  that the database has games for
+    int nbr_uncovered;          // database moves the repertoire doesn't cover, in those positions
+
+private:
+    std::vector<REPERTOIRE_NODE> nodes;
+    void AddNode( MoveTree *node, const thc::ChessRules &position, const std::vector<MoveTree> *var, size_t next );
+    void Collect( std::vector<MoveTree> &var, thc::ChessRules cr );
+    std::string Comment( REPERTOIRE_NODE &rn, const MpsBatchResult &result );
+};
+
+#endif  // REPERTOIRE_REPORT_H
@@ -790,6 +790,8 @@ public:
         void OnUpdateDatabasePattern(wxUpdateUIEvent &);
     void OnDatabaseMaterial(wxCommandEvent &);
         void OnUpdateDatabaseMaterial(wxUpdateUIEvent &);
+    void OnDatabaseRepertoire(wxCommandEvent &);
+        void OnUpdateDatabaseRepertoire(wxUpdateUIEvent &);
     void OnTraining   (wxCommandEvent &);
         void OnUpdateTraining(wxUpdateUIEvent &);
     void OnGeneral    (wxCommandEvent &);
@@ -1210,6 +1212,8 @@ BEGIN_EVENT_TABLE(ChessFrame, wxFrame)
         EVT_UPDATE_UI (ID_DATABASE_PATTERN,             ChessFrame::OnUpdateDatabasePattern)
     EVT_MENU (ID_DATABASE_MATERIAL,                 ChessFrame::OnDatabaseMaterial)
         EVT_UPDATE_UI (ID_DATABASE_MATERIAL,            ChessFrame::OnUpdateDatabaseMaterial)
+    EVT_MENU (ID_DATABASE_REPERTOIRE,               ChessFrame::OnDatabaseRepertoire)
+        EVT_UPDATE_UI (ID_DATABASE_REPERTOIRE,          ChessFrame::OnUpdateDatabaseRepertoire)
     EVT_MENU (ID_DATABASE_MAINTENANCE,              ChessFrame::OnDatabaseMaintenance)
         EVT_UPDATE_UI (ID_DATABASE_MAINTENANCE,          ChessFrame::OnUpdateDatabaseMaintenance)
     EVT_MENU (ID_FILE_OPEN_SHELL,                    ChessFrame::OnFileOpenShell)   // Doesn't appear in any actual menu, used to open files from Windows Explorer
@@ -1324,6 +1328,7 @@ ChessFrame::ChessFrame(const wxString& title, const wxPoint& pos, const wxSize&
     menu_database->Append (ID_DATABASE_SEARCH,              "Position search", "Search the database for the current position");
     menu_database->Append (ID_DATABASE_PATTERN,             "Pattern search", "Search the database for situations where a group of pieces are at specific locations");
     menu_database->Append (ID_DATABASE_MATERIAL,            "Material balance search", "Search the database for a specific material balance, with optional locked down squares" );
+    menu_database->Append (ID_DATABASE_REPERTOIRE,          "Repertoire coverage report", "Annotate a copy of the current game and its variations with database games, scores and moves not covered" );
     menu_database->Append (ID_DATABASE_SHOW_ALL,            "Show all games", "Show all database games - equivalent to searching for the standard starting position");
     menu_database->Append (ID_DATABASE_PLAYERS,             "Show all ordered by player", "Show all games ordered by White player, useful for searching for players");
     menu_database->Append (ID_DATABASE_SELECT,              "Select current database", "Specify which database file to use for searches");
@@ -2452,6 +2457,11 @@ void ChessFrame::OnDatabaseMaterial(wxCommandEvent &)
     objs.gl->CmdDatabaseMaterial();
 }
 
+void ChessFrame::OnDatabaseRepertoire(wxCommandEvent &)
+{
+    objs.gl->CmdDatabaseRepertoire();
+}
+
 void ChessFrame::OnUpdateDatabaseSearch(wxUpdateUIEvent &)
 {
 }
@@ -2484,6 +2494,10 @@ void ChessFrame::OnUpdateDatabaseMaterial(wxUpdateUIEvent &)
 {
 }
 
+void ChessFrame::OnUpdateDatabaseRepertoire(wxUpdateUIEvent &)
+{
+}
+
 void ChessFrame::OnDatabaseMaintenance(wxCommandEvent &)
 {
     wxString old_file    = objs.repository->engine.m_file;
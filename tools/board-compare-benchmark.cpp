@@ -0,0 +1,301 @@
+// board-compare-benchmark.cpp
+//  Measure the quick search's board compare (QUICK_BOARD_MATCH in MemoryPositionSearch.cpp,
+//  rank by rank with early outs) against whole board SSE2 and AVX2 compares, over the
+//  positions of real games. This is the measurement behind keeping the scalar compare
+//
+//  Build (from this directory);
+//    g++ -O2 -std=c++11 -I../src board-compare-benchmark.cpp ../src/thc.cpp -o board-compare-benchmark
+//  Run;
+//    board-compare-benchmark [pgn-file]      (default ../install/book.pgn)
+//
+//  The query mix is the database dialog's; positions taken from the games themselves at
+//  ply 0 (the initial position, every game matches), 6 and 12 (openings, many games match),
+//  20 and 30 (middlegame, few games match) and 40 (usually only the game it came from
+//  matches), 20 queries of each. Each query is compared with every position in every game
+//  that has the same side to move, as the quick search does (games with a FEN are
+//  skipped). AVX2 is used if the CPU has it, decided at run time (GCC and Clang), or
+//  if the build targets it (eg /arch:AVX2 with Visual C++)
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include "thc.h"
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#define AVX2_RUNTIME_CHECK
+#else
+#define AVX2_FUNCTION
+#endif
+
+// One position, laid out as the quick search board (a8=0 -> h1=63)
+struct Board
+{
+    char squares[64];
+};
+
+// The target, with the ranks preloaded as the quick search does
+struct Target
+{
+    char squares[64];
+    uint64_t rank[8];   // rank[0] = rank 8 ... rank[7] = rank 1
+};
+
+static void TargetSet( Target &t, const char *squares )
+{
+    memcpy( t.squares, squares, 64 );
+    memcpy( t.rank, squares, 64 );
+}
+
+// As QUICK_BOARD_MATCH, ranks 3,4,5,6,7,8,1,2 in that order
+static inline bool ScalarMatch( const Board &b, const Target &t )
+{
+    const uint64_t *r = reinterpret_cast<const uint64_t *>(b.squares);
+    return r[5]==t.rank[5] && r[4]==t.rank[4] && r[3]==t.rank[3] && r[2]==t.rank[2] &&
+           r[1]==t.rank[1] && r[0]==t.rank[0] && r[7]==t.rank[7] && r[6]==t.rank[6];
+}
+
+static inline bool Sse2Match( const Board &b, const Target &t )
+{
+    const __m128i *s = reinterpret_cast<const __m128i*>(b.squares);
+    const __m128i *u = reinterpret_cast<const __m128i*>(t.squares);
+    __m128i eq = _mm_and_si128( _mm_cmpeq_epi8(_mm_loadu_si128(s+0),_mm_loadu_si128(u+0)),
+                                _mm_cmpeq_epi8(_mm_loadu_si128(s+1),_mm_loadu_si128(u+1)) );
+    eq = _mm_and_si128( eq, _mm_cmpeq_epi8(_mm_loadu_si128(s+2),_mm_loadu_si128(u+2)) );
+    eq = _mm_and_si128( eq, _mm_cmpeq_epi8(_mm_loadu_si128(s+3),_mm_loadu_si128(u+3)) );
+    return _mm_movemask_epi8(eq) == 0xffff;
+}
+
+static inline AVX2_FUNCTION bool Avx2Match( const Board &b, const Target &t )
+{
+    const __m256i *s = reinterpret_cast<const __m256i*>(b.squares);
+    const __m256i *u = reinterpret_cast<const __m256i*>(t.squares);
+    __m256i lo = _mm256_cmpeq_epi8( _mm256_loadu_si256(s+0), _mm256_loadu_si256(u+0) );
+    __m256i hi = _mm256_cmpeq_epi8( _mm256_loadu_si256(s+1), _mm256_loadu_si256(u+1) );
+    return _mm256_movemask_epi8( _mm256_and_si256(lo,hi) ) == -1;
+}
+
+// One pass over all the positions for each method, the loops are written out so each
+//  compare can be inlined
+static int ScalarPass( const Board *boards, size_t n, const Target &t )
+{
+    int nbr_found = 0;
+    for( size_t i=0; i<n; i++ )
+    {
+        if( ScalarMatch(boards[i],t) )
+            nbr_found++;
+    }
+    return nbr_found;
+}
+
+static int Sse2Pass( const Board *boards, size_t n, const Target &t )
+{
+    int nbr_found = 0;
+    for( size_t i=0; i<n; i++ )
+    {
+        if( Sse2Match(boards[i],t) )
+            nbr_found++;
+    }
+    return nbr_found;
+}
+
+static AVX2_FUNCTION int Avx2Pass( const Board *boards, size_t n, const Target &t )
+{
+    int nbr_found = 0;
+    for( size_t i=0; i<n; i++ )
+    {
+        if( Avx2Match(boards[i],t) )
+            nbr_found++;
+    }
+    return nbr_found;
+}
+
+// The positions of the games in a PGN file, White to move and Black to move. Just enough
+//  PGN parsing for the purpose, comments, variations and NAGs are skipped
+static std::vector<Board> white_boards;
+static std::vector<Board> black_boards;
+static std::vector< std::vector<Board> > games;     // every position, by game
+
+static void AddPosition( std::vector<Board> &game, thc::ChessRules &cr )
+{
+    Board b;
+    memcpy( b.squares, cr.squares, 64 );
+    game.push_back( b );
+    (cr.white ? white_boards : black_boards).push_back( b );
+}
+
+static void ReadGames( const char *filename )
+{
+    FILE *f = fopen( filename, "rt" );
+    if( !f )
+    {
+        printf( "Cannot open %s\n", filename );
+        exit(-1);
+    }
+    std::string movetext;
+    bool fen = false;
+    char buf[4096];
+    bool more = true;
+    while( more )
+    {
+        more = (fgets(buf,sizeof(buf),f) != NULL);
+        bool tag = more && buf[0]=='[';
+        if( (!more || tag) && movetext.length() > 0 )
+        {
+            // Play through the game just read
+            if( !fen )
+            {
+                thc::ChessRules cr;
+                std::vector<Board> game;
+                AddPosition( game, cr );
+                int depth = 0;
+                std::string token;
+                for( size_t i=0; i<=movetext.length(); i++ )
+                {
+                    char c = (i<movetext.length() ? movetext[i] : ' ');
+                    if( c=='{' || c=='(' )
+                        depth++;
+                    else if( c=='}' || c==')' )
+                        depth--;
+                    else if( depth==0 && !isspace(c) )
+                        token += c;
+                    else if( depth==0 && token.length() > 0 )
+                    {
+                        size_t j=0;
+                        while( j<token.length() && (isdigit(token[j]) || token[j]=='.') )
+                            j++;
+                        std::string san = token.substr(j);
+                        token.clear();
+                        if( san.length()==0 || san[0]=='$' || san=="*" || san=="-0" || san=="-1" || san=="/2-1/2" )
+                            continue;
+                        thc::Move mv;
+                        if( !mv.NaturalIn(&cr,san.c_str()) )
+                            break;
+                        cr.PlayMove( mv );
+                        AddPosition( game, cr );
+                    }
+                }
+                games.push_back( game );
+            }
+            movetext.clear();
+            fen = false;
+        }
+        if( tag )
+        {
+            if( strncmp(buf,"[FEN ",5) == 0 )
+                fen = true;
+        }
+        else if( more )
+            movetext += buf;
+    }
+    fclose(f);
+}
+
+typedef int (*PASS_FUNCTION)( const Board *boards, size_t n, const Target &t );
+
+// Nanoseconds per compare over the query mix, best of several runs. In the quick search the
+//  board being compared is always in the L1 cache (it's updated in place, move by move), so
+//  the positions are taken a block at a time and every query is run over the block before
+//  moving on, otherwise this would mostly measure memory bandwidth
+#define BLOCK_SIZE 128
+static double Measure( PASS_FUNCTION pass, const std::vector<Target> &targets, const std::vector<bool> &target_white, long &nbr_found )
+{
+    double best = 0.0;
+    for( int run=0; run<5; run++ )
+    {
+        nbr_found = 0;
+        long nbr_compares = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( int side=0; side<2; side++ )
+        {
+            const std::vector<Board> &boards = side==0 ? white_boards : black_boards;
+            for( size_t begin=0; begin<boards.size(); begin+=BLOCK_SIZE )
+            {
+                size_t n = boards.size()-begin < BLOCK_SIZE ? boards.size()-begin : BLOCK_SIZE;
+                for( size_t i=0; i<targets.size(); i++ )
+                {
+                    if( target_white[i] == (side==0) )
+                    {
+                        nbr_found += pass( &boards[begin], n, targets[i] );
+                        nbr_compares += n;
+                    }
+                }
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double ns = elapsed.count()*1e9 / nbr_compares;
+        if( run==0 || ns<best )
+            best = ns;
+    }
+    return best;
+}
+
+int main( int argc, const char *argv[] )
+{
+    ReadGames( argc>1 ? argv[1] : "../install/book.pgn" );
+    printf( "%d games, %d positions White to move, %d positions Black to move\n",
+            (int)games.size(), (int)white_boards.size(), (int)black_boards.size() );
+
+    // The query mix
+    const int plies[] = { 0, 6, 12, 20, 30, 40 };
+    const int nbr_per_ply = 20;
+    std::vector<Target> targets;
+    std::vector<bool> target_white;
+    srand(1);
+    for( size_t p=0; p<sizeof(plies)/sizeof(plies[0]); p++ )
+    {
+        for( int n=0, tries=0; n<nbr_per_ply && tries<100000 && games.size()>0; tries++ )
+        {
+            const std::vector<Board> &game = games[ rand()%games.size() ];
+            if( static_cast<int>(game.size()) > plies[p] )
+            {
+                Target t;
+                TargetSet( t, game[plies[p]].squares );
+                targets.push_back( t );
+                target_white.push_back( plies[p]%2 == 0 );
+                n++;
+            }
+        }
+    }
+
+    // How often the scalar compare's first rank (rank 3) rejects the position outright
+    long nbr_compares=0, nbr_rank3_rejects=0;
+    for( size_t i=0; i<targets.size(); i++ )
+    {
+        const std::vector<Board> &boards = target_white[i] ? white_boards : black_boards;
+        for( size_t j=0; j<boards.size(); j++ )
+        {
+            nbr_compares++;
+            if( reinterpret_cast<const uint64_t *>(boards[j].squares)[5] != targets[i].rank[5] )
+                nbr_rank3_rejects++;
+        }
+    }
+    printf( "%d queries, %ld compares, %.1f%% rejected by the first (rank 3) compare\n",
+            (int)targets.size(), nbr_compares, nbr_compares ? 100.0*nbr_rank3_rejects/nbr_compares : 0.0 );
+
+    long found_scalar, found_sse2, found_avx2;
+    double scalar = Measure( ScalarPass, targets, target_white, found_scalar );
+    double sse2   = Measure( Sse2Pass,   targets, target_white, found_sse2 );
+    printf( "Scalar (rank by rank): %.3f ns/compare, %ld found\n", scalar, found_scalar );
+    printf( "SSE2 (whole board)   : %.3f ns/compare, %ld found, %.2fx scalar time\n", sse2, found_sse2, sse2/scalar );
+    bool avx2 = true;
+    #ifdef AVX2_RUNTIME_CHECK
+    avx2 = __builtin_cpu_supports("avx2");
+    #elif !defined(__AVX2__)
+    avx2 = false;
+    #endif
+    if( !avx2 )
+        printf( "AVX2 (whole board)   : not available\n" );
+    else
+    {
+        double t = Measure( Avx2Pass, targets, target_white, found_avx2 );
+        printf( "AVX2 (whole board)   : %.3f ns/compare, %ld found, %.2fx scalar time\n", t, found_avx2, t/scalar );
+    }
+    return 0;
+}